@@ -0,0 +1,126 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "phold_random.hpp"
+#include "simulator.hpp"
+
+// Batched execution on the sequential kernel: a PHOLD-style model run with
+// Simulator::runBatched at growing batch caps. Events carry their own random
+// seed and only bump a counter on their LP, so events inside one lookahead
+// window commute and every batch size executes the same trajectory.
+// Usage: bench_batch [lps] [population] [lookahead] [end_time]
+
+struct BatchLp {
+    std::uint64_t processed;   // reversible counter
+};
+
+struct BatchParams {
+    std::uint32_t lpCount = 1024;
+    double lookahead = 0.1;
+    double meanDelay = 1.0;
+};
+
+BatchParams batchParams;
+BatchLp* batchLps = nullptr;
+Simulator<CalendarQueue>* batchSim = nullptr;
+
+// Scheduling is left out of the undo handlers; the bench never rolls back
+__attribute__((noinline, annotate("reverse_ignore"))) void scheduleBatchEvent(std::uint64_t seed, double now);
+
+// Four handlers with the same body, so a batch holds several call targets to group by
+inline void batchStep(BatchLp& lp, std::uint64_t seed) {
+    lp.processed = lp.processed + 1;
+    scheduleBatchEvent(pholdRandom(seed, 0), batchSim->now());
+}
+
+__attribute__((annotate("reverse"))) void batchEvent0(BatchLp& lp, std::uint64_t seed) { batchStep(lp, seed); }
+__attribute__((annotate("reverse"))) void batchEvent1(BatchLp& lp, std::uint64_t seed) { batchStep(lp, seed); }
+__attribute__((annotate("reverse"))) void batchEvent2(BatchLp& lp, std::uint64_t seed) { batchStep(lp, seed); }
+__attribute__((annotate("reverse"))) void batchEvent3(BatchLp& lp, std::uint64_t seed) { batchStep(lp, seed); }
+
+void scheduleBatchEvent(std::uint64_t seed, double now) {
+    BatchLp& dst = batchLps[pholdRandom(seed, 1) % batchParams.lpCount];
+    double timestamp = now + batchParams.lookahead - batchParams.meanDelay * std::log(pholdUniform(pholdRandom(seed, 2)));
+    // The seed goes in as a prvalue: lvalue arguments are bound by reference
+    switch (seed & 3) {
+    case 0: batchSim->scheduleEvent<batchEvent0>(timestamp, dst, std::uint64_t{seed}); break;
+    case 1: batchSim->scheduleEvent<batchEvent1>(timestamp, dst, std::uint64_t{seed}); break;
+    case 2: batchSim->scheduleEvent<batchEvent2>(timestamp, dst, std::uint64_t{seed}); break;
+    default: batchSim->scheduleEvent<batchEvent3>(timestamp, dst, std::uint64_t{seed}); break;
+    }
+}
+
+struct BatchRun {
+    std::size_t batches;
+    std::uint64_t events;
+    double seconds;
+};
+
+BatchRun runBatch(std::size_t population, double endTime, const BatchConfig& config) {
+    std::vector<BatchLp> lps(batchParams.lpCount, BatchLp{0});
+    Simulator<CalendarQueue> sim;
+    batchLps = lps.data();
+    batchSim = &sim;
+
+    for (std::uint64_t i = 0; i < batchParams.lpCount; ++i)
+        for (std::uint64_t j = 0; j < population; ++j)
+            scheduleBatchEvent(pholdRandom(i, ~j), 0.0);
+
+    // Run in unit slices, dropping history behind each one as a real driver would
+    auto start = std::chrono::steady_clock::now();
+    std::size_t batches = 0;
+    for (double t = 1.0; t < endTime + 1.0; t += 1.0) {
+        batches += sim.runBatched(std::min(t, endTime), config);
+        sim.fossilCollect(std::min(t, endTime));
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    BatchRun result{batches, 0, seconds};
+    for (const BatchLp& lp : lps)
+        result.events += lp.processed;
+    return result;
+}
+
+int main(int argc, char** argv) {
+    batchParams.lpCount = argc > 1 ? static_cast<std::uint32_t>(std::atoi(argv[1])) : 1024;
+    std::size_t population = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 16;
+    batchParams.lookahead = argc > 3 ? std::atof(argv[3]) : 0.1;
+    double endTime = argc > 4 ? std::atof(argv[4]) : 50.0;
+
+    std::printf("Batched PHOLD: %u LPs, population %zu, window = lookahead %.3f, end time %.1f\n",
+                batchParams.lpCount, population, batchParams.lookahead, endTime);
+    std::printf("%10s %8s %10s %10s %14s %14s %9s\n", "max batch", "grouped", "batches", "avg batch",
+                "events", "events/s", "speedup");
+
+    struct Row {
+        std::size_t maxBatch;
+        bool grouped;
+    };
+    const Row rows[] = {{1, true},   {4, true},    {16, true},   {64, true},
+                        {256, true}, {1024, true}, {4096, true}, {4096, false}};
+
+    double baseline = 0.0;
+    std::uint64_t expected = 0;
+    for (const Row& row : rows) {
+        BatchConfig config;
+        config.window = batchParams.lookahead;
+        config.maxBatch = row.maxBatch;
+        config.groupByHandler = row.grouped;
+        BatchRun run = runBatch(population, endTime, config);
+
+        double rate = run.events / run.seconds;
+        if (baseline == 0.0) {
+            baseline = rate;
+            expected = run.events;
+        }
+
+        std::printf("%10zu %8s %10zu %10.1f %14llu %14.0f %8.2fx%s\n", row.maxBatch, row.grouped ? "yes" : "no",
+                    run.batches, static_cast<double>(run.events) / run.batches,
+                    static_cast<unsigned long long>(run.events), rate, rate / baseline,
+                    run.events == expected ? "" : "  MISMATCH");
+    }
+    return 0;
+}
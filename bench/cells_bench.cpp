@@ -0,0 +1,171 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "phold_random.hpp"
+#include "simulator.hpp"
+
+// Batched variants on the sequential kernel: a grid of cells where every cell
+// gets one update per time step and one clamp half a step later, all with the
+// same handler at the same timestamp. Both handlers are annotated
+// "reverse,batch", so with BatchConfig::useBatchVariants a whole step runs as
+// one call of the handler's batched variant instead of one trampoline call per
+// event. The update only adds (no reverse log), the clamp overwrites (saved in
+// the log), so both kinds of batched undo variant are exercised.
+//  - run:      Simulator::run, one event at a time
+//  - batched:  runBatched with window 0, each handler's events back to back
+//  - variants: the same, through the batched variants
+// All three must end in the same state, and a batched run rolled back to the
+// middle must end where a run to the middle does.
+// Usage: bench_cells [cells] [steps]
+
+struct Cell {
+    std::uint64_t energy;
+    std::uint64_t updates;
+};
+
+struct CellParams {
+    std::uint32_t cellCount = 4096;
+    std::uint64_t clampPerStep = 1ULL << 22;   // the clamp limit grows by this much per step
+};
+
+CellParams cellParams;
+Cell* cells = nullptr;
+Simulator<>* cellSim = nullptr;
+
+// Scheduling is left out of the undo handlers: rollback only restores the cells
+__attribute__((noinline, annotate("reverse_ignore"))) void scheduleCellStep(std::uint64_t step);
+
+__attribute__((annotate("reverse,batch"))) void cellUpdate(Cell& cell, std::uint64_t input) {
+    cell.energy = cell.energy + input;
+    cell.updates = cell.updates + 1;
+}
+
+__attribute__((annotate("reverse,batch"))) void cellClamp(Cell& cell, std::uint64_t limit) {
+    if (cell.energy > limit)
+        cell.energy = limit;
+}
+
+__attribute__((annotate("reverse"))) void cellTick(std::uint64_t step) {
+    scheduleCellStep(step + 1);
+}
+
+void scheduleCellStep(std::uint64_t step) {
+    double timestamp = static_cast<double>(step);
+    std::uint64_t limit = step * cellParams.clampPerStep;
+    // Values go in as prvalues: lvalue arguments are bound by reference
+    for (std::uint32_t i = 0; i < cellParams.cellCount; ++i)
+        cellSim->scheduleEvent<cellUpdate>(timestamp, cells[i], std::uint64_t{pholdRandom(i, step) >> 40});
+    for (std::uint32_t i = 0; i < cellParams.cellCount; ++i)
+        cellSim->scheduleEvent<cellClamp>(timestamp + 0.5, cells[i], std::uint64_t{limit});
+    cellSim->scheduleEvent<cellTick>(timestamp + 0.5, std::uint64_t{step});
+}
+
+std::uint64_t cellDigest(const std::vector<Cell>& grid) {
+    std::uint64_t digest = 0;
+    for (const Cell& cell : grid)
+        digest = pholdRandom(digest ^ cell.energy, cell.updates);
+    return digest;
+}
+
+enum class CellMode { Run, Batched, Variants };
+
+struct CellRun {
+    std::uint64_t updates;
+    std::uint64_t digest;
+    double seconds;
+};
+
+CellRun runCells(CellMode mode, double endTime) {
+    std::vector<Cell> grid(cellParams.cellCount, Cell{0, 0});
+    Simulator<> sim;
+    cells = grid.data();
+    cellSim = &sim;
+    scheduleCellStep(0);
+
+    BatchConfig config;
+    config.useBatchVariants = mode == CellMode::Variants;
+    config.maxBatch = 2 * cellParams.cellCount;
+
+    // Run in unit slices, dropping history behind each one as a real driver would
+    auto start = std::chrono::steady_clock::now();
+    for (double t = 1.0; t < endTime + 1.0; t += 1.0) {
+        if (mode == CellMode::Run)
+            sim.run(std::min(t, endTime));
+        else
+            sim.runBatched(std::min(t, endTime), config);
+        sim.fossilCollect(std::min(t, endTime));
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    CellRun result{0, cellDigest(grid), seconds};
+    for (const Cell& cell : grid)
+        result.updates += cell.updates;
+    return result;
+}
+
+// A run with variants to endTime rolled back to rollbackTime, against a run to rollbackTime
+bool checkRollback(double endTime, double rollbackTime, double& seconds) {
+    std::vector<Cell> grid(cellParams.cellCount, Cell{0, 0});
+    Simulator<> sim;
+    cells = grid.data();
+    cellSim = &sim;
+    scheduleCellStep(0);
+    BatchConfig config;
+    config.maxBatch = 2 * cellParams.cellCount;
+    sim.runBatched(endTime, config);
+
+    auto start = std::chrono::steady_clock::now();
+    sim.rollback(rollbackTime);
+    seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::uint64_t rolledBack = cellDigest(grid);
+
+    std::vector<Cell> reference(cellParams.cellCount, Cell{0, 0});
+    Simulator<> referenceSim;
+    cells = reference.data();
+    cellSim = &referenceSim;
+    scheduleCellStep(0);
+    referenceSim.run(rollbackTime);
+    return rolledBack == cellDigest(reference);
+}
+
+int main(int argc, char** argv) {
+    cellParams.cellCount = argc > 1 ? static_cast<std::uint32_t>(std::atoi(argv[1])) : 4096;
+    double endTime = argc > 2 ? std::atof(argv[2]) : 200.0;
+
+    // Whether the reverse-pass emitted batched variants this build can use
+    Cell probe{0, 0};
+    Event update = CreateEvent<cellUpdate>(0.0, probe, std::uint64_t{0});
+    bool variants = static_cast<bool>(findBatchRoute(update.forward, update.trampoline()));
+
+    std::printf("Batched variants: %u cells, %.0f steps, variants %s\n", cellParams.cellCount, endTime,
+                variants ? "available" : "not available");
+    std::printf("%-10s %14s %14s %9s\n", "mode", "updates", "updates/s", "speedup");
+
+    struct Row {
+        const char* label;
+        CellMode mode;
+    };
+    const Row rows[] = {{"run", CellMode::Run}, {"batched", CellMode::Batched}, {"variants", CellMode::Variants}};
+
+    double baseline = 0.0;
+    std::uint64_t expected = 0;
+    bool ok = true;
+    for (const Row& row : rows) {
+        CellRun run = runCells(row.mode, endTime);
+        double rate = run.updates / run.seconds;
+        if (baseline == 0.0) {
+            baseline = rate;
+            expected = run.digest;
+        }
+        ok = ok && run.digest == expected;
+        std::printf("%-10s %14llu %14.0f %8.2fx%s\n", row.label, static_cast<unsigned long long>(run.updates), rate,
+                    rate / baseline, run.digest == expected ? "" : "  MISMATCH");
+    }
+
+    double seconds = 0.0;
+    bool restored = checkRollback(endTime, endTime / 2, seconds);
+    std::printf("rollback to %.1f: %.4f s%s\n", endTime / 2, seconds, restored ? "" : "  MISMATCH");
+    return ok && restored ? 0 : 1;
+}
@@ -0,0 +1,109 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include "checkpoint.hpp"
+#include "phold_model.hpp"
+
+// Checkpoint/restore on PHOLD, with the LP state in a StateArena:
+//  - reference:    the run to end_time without checkpoints
+//  - checkpointed: the same run with a checkpoint every `interval`
+//  - prefix:       the run up to end_time / 2, checkpointed there
+//  - restored:     that checkpoint restored and run on to end_time
+// The checkpointed and restored runs must end in the reference's LP state.
+// Usage: bench_checkpoint [lps] [population] [remote_fraction] [lookahead] [end_time] [interval] [threads]
+//                         [sequential|conservative|optimistic] [path]
+
+PholdRun finish(TimeWarp& kernel, double setupSeconds) {
+    kernel.run();
+    PholdRun result = pholdResult(kernel.stats());
+    result.setupSeconds = setupSeconds;
+    return result;
+}
+
+PholdRun runFresh(TimeWarpConfig config, std::size_t population) {
+    auto start = std::chrono::steady_clock::now();
+    StateArena arena(pholdParams.lpCount * sizeof(PholdLp));
+    PholdLp* lps = arena.allocate<PholdLp>(pholdParams.lpCount);
+
+    TimeWarp kernel(pholdParams.lpCount, config);
+    kernel.attachState(arena);
+    pholdSeed(kernel, lps, population);
+    return finish(kernel, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+}
+
+bool runRestored(TimeWarpConfig config, const char* path, PholdRun& result) {
+    auto start = std::chrono::steady_clock::now();
+    std::unique_ptr<CheckpointSnapshot> snapshot = CheckpointSnapshot::open(path);
+    if (!snapshot)
+        return false;
+    StateArena arena(*snapshot);
+    if (!arena.valid())
+        return false;
+    pholdLps = static_cast<PholdLp*>(arena.base());
+
+    TimeWarp kernel(pholdParams.lpCount, config);
+    kernel.attachState(arena);
+    if (!kernel.restore(*snapshot))
+        return false;
+    result = finish(kernel, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    return true;
+}
+
+void printRun(const char* label, const PholdRun& run, bool match) {
+    const TimeWarpStats& s = run.stats;
+    std::printf("%-14s %14llu %14.0f %12.4f %12llu %14llu%s\n", label,
+                static_cast<unsigned long long>(s.committed()), s.committed() / s.seconds, run.setupSeconds,
+                static_cast<unsigned long long>(s.checkpoints),
+                static_cast<unsigned long long>(s.checkpointPages),
+                match ? "" : "  MISMATCH");
+}
+
+int main(int argc, char** argv) {
+    pholdParams.lpCount = argc > 1 ? static_cast<LpId>(std::atoi(argv[1])) : 1024;
+    std::size_t population = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 16;
+    pholdParams.remoteFraction = argc > 3 ? std::atof(argv[3]) : 0.5;
+    pholdParams.lookahead = argc > 4 ? std::atof(argv[4]) : 0.1;
+    double endTime = argc > 5 ? std::atof(argv[5]) : 100.0;
+    double interval = argc > 6 ? std::atof(argv[6]) : 10.0;
+    std::size_t threads = argc > 7 ? std::strtoull(argv[7], nullptr, 10) : 1;
+    const char* mode = argc > 8 ? argv[8] : "optimistic";
+    const char* path = argc > 9 ? argv[9] : "phold.ckpt";
+
+    TimeWarpConfig config;
+    config.mode = modeFromName(mode);
+    config.threads = threads;
+    config.lookahead = pholdParams.lookahead;
+    config.endTime = endTime;
+
+    std::printf("PHOLD checkpoints: %u LPs, population %zu, remote %.2f, lookahead %.3f, end time %.1f, every %.1f, %s on %zu threads\n",
+                pholdParams.lpCount, population, pholdParams.remoteFraction, pholdParams.lookahead, endTime,
+                interval, mode, threads);
+    std::printf("%-14s %14s %14s %12s %12s %14s\n", "run", "committed", "events/s", "setup s", "checkpoints", "pages written");
+
+    PholdRun reference = runFresh(config, population);
+    printRun("reference", reference, reference.lpEvents == reference.stats.committed());
+
+    config.checkpointPath = path;
+    config.checkpointInterval = interval;
+    PholdRun checkpointed = runFresh(config, population);
+    printRun("checkpointed", checkpointed, checkpointed.digest == reference.digest &&
+                                           checkpointed.stats.committed() == reference.stats.committed());
+
+    config.endTime = endTime / 2;
+    config.checkpointInterval = endTime / 2;
+    PholdRun prefix = runFresh(config, population);
+    printRun("prefix", prefix, prefix.lpEvents == prefix.stats.committed() && prefix.stats.checkpoints == 1);
+
+    // Restored without checkpoints of its own, so the prefix's snapshot stays the newest
+    config.endTime = endTime;
+    config.checkpointPath = nullptr;
+    PholdRun restored;
+    if (!runRestored(config, path, restored)) {
+        std::printf("restore of %s failed\n", path);
+        return 1;
+    }
+    printRun("restored", restored, restored.digest == reference.digest && restored.lpEvents == reference.lpEvents &&
+                                   prefix.stats.committed() + restored.stats.committed() == reference.stats.committed());
+    return 0;
+}
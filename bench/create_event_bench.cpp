@@ -0,0 +1,67 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <string>
+#include "test_funcs.hpp"
+#include "event.hpp"
+
+// The lookup CreateEvent used before the reverse-pass emitted the undo registry:
+// dladdr + __cxa_demangle + "__undo_" string + dlsym for every event
+template <typename FuncType>
+std::string getUnmangledName(FuncType funcPtr) {
+    Dl_info info;
+    if (dladdr(reinterpret_cast<void*>(reinterpret_cast<uintptr_t>(funcPtr)), &info) && info.dli_sname) {
+        int status = 0;
+        char* demangledName = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+        if (status == 0 && demangledName != nullptr) {
+            std::string result(demangledName);
+            free(demangledName);
+            return result;
+        }
+        return std::string(info.dli_sname);
+    }
+    return "";
+}
+
+template <typename FuncType, typename... Args>
+Event legacyCreateEvent(double timestamp, FuncType func, Args&&... args) {
+    std::string reverseFunctionName = "__undo_" + getUnmangledName(func);
+    auto undoFunc = reinterpret_cast<FuncType>(dlsym(RTLD_DEFAULT, reverseFunctionName.c_str()));
+    return makeEvent(timestamp, func, undoFunc, std::forward<Args>(args)...);
+}
+
+// Time `iterations` event creations, returning ns per event
+template <typename Create>
+double timeCreate(const char* label, std::size_t iterations, Create create) {
+    std::size_t bound = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < iterations; ++i) {
+        Event e = create(static_cast<double>(i));
+        bound += e.undo() != nullptr;
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    double ns = std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+    std::printf("%-28s %10.1f ns/event  (%zu/%zu undo bound)\n", label, ns, bound, iterations);
+    return ns;
+}
+
+int main(int argc, char** argv) {
+    std::size_t iterations = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000000;
+    int a = 1;
+
+    double legacy = timeCreate("dladdr/dlsym (before)", iterations, [&](double ts) {
+        return legacyCreateEvent(ts, freeFunctionBinaryAddByOne, a);
+    });
+    double runtime = timeCreate("registry lookup", iterations, [&](double ts) {
+        return CreateEvent(ts, freeFunctionBinaryAddByOne, a);
+    });
+    double bound = timeCreate("CreateEvent<F> (after)", iterations, [&](double ts) {
+        return CreateEvent<freeFunctionBinaryAddByOne>(ts, a);
+    });
+
+    std::printf("speedup: %.1fx (registry %.1fx)\n", legacy / bound, legacy / runtime);
+    return 0;
+}
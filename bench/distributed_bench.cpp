@@ -0,0 +1,116 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "phold_model.hpp"
+#include "transport.hpp"
+
+// Distributed PHOLD: the optimistic kernel spread over 1, 2, 4, ... ranks,
+// local processes forked by launchLocalRanks and connected by Unix sockets or
+// shared memory, each running `threads` workers. Every run must commit the
+// same events and end in the same per-LP state as the sequential kernel.
+// Usage: bench_distributed [lps] [population] [remote_fraction] [lookahead] [end_time] [max_ranks]
+//                          [threads] [socket|shm]
+
+// `lps` is set up before the ranks are forked, so it is at the same address in each of them
+PholdRun runPhold(std::vector<PholdLp>& lps, const TimeWarpConfig& config, std::size_t population) {
+    TimeWarp kernel(pholdParams.lpCount, config);
+    pholdSeed(kernel, lps.data(), population);
+
+    kernel.run();
+
+    // Rank 0 collects every other rank's LP counters: first LP, then one counter per LP
+    if (Transport* transport = config.transport) {
+        if (transport->rank() != 0) {
+            std::vector<std::uint64_t> block;
+            for (LpId i = 0; i < pholdParams.lpCount; ++i) {
+                if (kernel.isLocal(i)) {
+                    if (block.empty())
+                        block.push_back(i);
+                    block.push_back(lps[i].processed);
+                }
+            }
+            transport->send(0, block.data(), block.size() * sizeof(std::uint64_t));
+            return PholdRun{kernel.stats()};
+        }
+
+        std::vector<unsigned char> message;
+        std::size_t source;
+        for (std::size_t missing = transport->ranks() - 1; missing > 0;) {
+            if (!transport->receive(message, source)) {
+                std::this_thread::yield();
+                continue;
+            }
+            std::vector<std::uint64_t> block(message.size() / sizeof(std::uint64_t));
+            std::memcpy(block.data(), message.data(), block.size() * sizeof(std::uint64_t));
+            for (std::size_t k = 1; k < block.size(); ++k)
+                lps[block[0] + k - 1].processed = block[k];
+            --missing;
+        }
+    }
+
+    return pholdResult(kernel.stats());
+}
+
+void printRun(const char* label, std::size_t ranks, std::size_t threads, const PholdRun& run, double baseline, bool match) {
+    const TimeWarpStats& s = run.stats;
+    double rate = s.committed() / s.seconds;
+    std::printf("%-12s %6zu %8zu %14llu %14.0f %12llu %9.1f%% %10llu %12llu %8.2fx%s\n", label, ranks, threads,
+                static_cast<unsigned long long>(s.committed()), rate,
+                static_cast<unsigned long long>(s.rolledBack),
+                100.0 * s.committed() / s.processed,
+                static_cast<unsigned long long>(s.gvtRounds),
+                static_cast<unsigned long long>(s.peakHistory), rate / baseline,
+                match ? "" : "  MISMATCH");
+}
+
+int main(int argc, char** argv) {
+    pholdParams.lpCount = argc > 1 ? static_cast<LpId>(std::atoi(argv[1])) : 1024;
+    std::size_t population = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 16;
+    pholdParams.remoteFraction = argc > 3 ? std::atof(argv[3]) : 0.5;
+    pholdParams.lookahead = argc > 4 ? std::atof(argv[4]) : 0.1;
+    double endTime = argc > 5 ? std::atof(argv[5]) : 100.0;
+    std::size_t maxRanks = argc > 6 ? std::strtoull(argv[6], nullptr, 10) : 4;
+    std::size_t threads = argc > 7 ? std::strtoull(argv[7], nullptr, 10) : 1;
+    TransportKind kind = argc > 8 && std::strcmp(argv[8], "shm") == 0 ? TransportKind::SharedMemory : TransportKind::Socket;
+
+    std::printf("Distributed PHOLD: %u LPs, population %zu, remote %.2f, lookahead %.3f, end time %.1f, %s transport\n",
+                pholdParams.lpCount, population, pholdParams.remoteFraction, pholdParams.lookahead, endTime,
+                kind == TransportKind::Socket ? "socket" : "shared memory");
+    std::printf("%-12s %6s %8s %14s %14s %12s %10s %10s %12s %9s\n", "mode", "ranks", "threads", "committed",
+                "events/s", "rolled back", "efficiency", "gvt rounds", "peak history", "speedup");
+
+    std::vector<PholdLp> lps(pholdParams.lpCount);
+
+    TimeWarpConfig config;
+    config.mode = ExecutionMode::Sequential;
+    config.lookahead = pholdParams.lookahead;
+    config.endTime = endTime;
+    PholdRun reference = runPhold(lps, config, population);
+    double baseline = reference.stats.committed() / reference.stats.seconds;
+    printRun("sequential", 1, 1, reference, baseline, reference.lpEvents == reference.stats.committed());
+
+    config.mode = ExecutionMode::Optimistic;
+    config.threads = threads;
+    for (std::size_t ranks = 1; ranks <= maxRanks; ranks *= 2) {
+        std::unique_ptr<Transport> transport = launchLocalRanks(ranks, kind);
+        if (!transport)
+            return 1;
+
+        config.transport = transport.get();
+        PholdRun run = runPhold(lps, config, population);
+        if (transport->rank() != 0) {
+            transport.reset();
+            std::exit(0);
+        }
+
+        const TimeWarpStats& s = run.stats;
+        printRun("distributed", ranks, threads, run, baseline,
+                 run.lpEvents == s.committed() && s.committed() == reference.stats.committed() &&
+                 run.digest == reference.digest);
+        transport.reset();
+    }
+    return 0;
+}
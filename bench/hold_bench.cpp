@@ -0,0 +1,68 @@
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include "event.hpp"
+#include "pending_set.hpp"
+
+// Classic hold model: keep N events pending and repeatedly dequeue the earliest,
+// execute it, and enqueue a successor at now + Exp(1). Reports ns per hold
+// (one dequeue plus one enqueue) for each pending-set implementation. The
+// second table rounds the increments up to whole time units, so most pending
+// events share their timestamp with many others; ties are stamped with a
+// scheduling counter, as the Simulator does.
+
+__attribute__((annotate("reverse"))) void holdHandler(long& executed) {
+    executed = executed + 1;
+}
+
+template <typename PendingSet>
+double runHold(std::size_t pending, std::size_t holds, long& executed, bool ties) {
+    std::mt19937_64 rng(42);
+    std::exponential_distribution<double> exponential(1.0);
+    auto increment = [&] { return ties ? std::ceil(exponential(rng)) : exponential(rng); };
+    std::uint32_t sequence = 0;
+    PendingSet queue;
+
+    for (std::size_t i = 0; i < pending; ++i) {
+        Event event = CreateEvent<holdHandler>(increment(), executed);
+        event.key.setOrigin(0, sequence++);
+        queue.push(event);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < holds; ++i) {
+        Event event = queue.top();
+        queue.pop();
+        event.call();
+        event.setTimestamp(event.timestamp() + increment());
+        event.key.setOrigin(0, sequence++);
+        queue.push(event);
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    return std::chrono::duration<double, std::nano>(end - start).count() / holds;
+}
+
+int main(int argc, char** argv) {
+    // Largest queue is 10^maxExponent pending events (default 10^7, ~640 MB per set)
+    int maxExponent = argc > 1 ? std::atoi(argv[1]) : 7;
+    std::size_t holds = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 2000000;
+    long executed = 0;
+
+    for (bool ties : {false, true}) {
+        std::printf("%s\n", ties ? "whole-unit increments (many equal timestamps)" : "Exp(1) increments");
+        std::printf("%10s %14s %14s %14s\n", "pending", "binary_heap", "pairing_heap", "calendar");
+        std::size_t pending = 1000;
+        for (int exponent = 3; exponent <= maxExponent; ++exponent, pending *= 10) {
+            double binary = runHold<BinaryHeap>(pending, holds, executed, ties);
+            double pairing = runHold<PairingHeap>(pending, holds, executed, ties);
+            double calendar = runHold<CalendarQueue>(pending, holds, executed, ties);
+            std::printf("%10zu %11.1f ns %11.1f ns %11.1f ns\n", pending, binary, pairing, calendar);
+        }
+    }
+
+    std::printf("executed %ld events\n", executed);
+    return 0;
+}
@@ -0,0 +1,75 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include "phold_model.hpp"
+
+// PHOLD strong scaling: the same model on 1, 2, 4, ... worker threads, in each
+// execution mode. Every run must end in the same per-LP state.
+// Usage: bench_phold [lps] [population] [remote_fraction] [lookahead] [end_time] [max_threads]
+//                    [sequential|conservative|optimistic|all]
+
+PholdRun runPhold(ExecutionMode mode, std::size_t threads, std::size_t population, double endTime) {
+    std::vector<PholdLp> lps(pholdParams.lpCount);
+
+    TimeWarpConfig config;
+    config.mode = mode;
+    config.threads = threads;
+    config.lookahead = pholdParams.lookahead;
+    config.endTime = endTime;
+    TimeWarp kernel(pholdParams.lpCount, config);
+    pholdSeed(kernel, lps.data(), population);
+
+    kernel.run();
+    return pholdResult(kernel.stats());
+}
+
+int main(int argc, char** argv) {
+    pholdParams.lpCount = argc > 1 ? static_cast<LpId>(std::atoi(argv[1])) : 1024;
+    std::size_t population = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 16;
+    pholdParams.remoteFraction = argc > 3 ? std::atof(argv[3]) : 0.5;
+    pholdParams.lookahead = argc > 4 ? std::atof(argv[4]) : 0.1;
+    double endTime = argc > 5 ? std::atof(argv[5]) : 100.0;
+    std::size_t maxThreads = argc > 6 ? std::strtoull(argv[6], nullptr, 10) : std::thread::hardware_concurrency();
+    const char* only = argc > 7 ? argv[7] : "all";
+
+    std::printf("PHOLD: %u LPs, population %zu, remote %.2f, lookahead %.3f, end time %.1f\n",
+                pholdParams.lpCount, population, pholdParams.remoteFraction, pholdParams.lookahead, endTime);
+    std::printf("%-12s %8s %14s %14s %12s %10s %10s %12s %10s %9s\n", "mode", "threads", "committed", "events/s",
+                "rolled back", "efficiency", "windows", "peak history", "pool KiB", "speedup");
+
+    // Speedups are relative to the first row, the sequential run when all modes are compared
+    double baseline = 0.0;
+    std::uint64_t expected = 0;
+    std::uint64_t expectedDigest = 0;
+    for (ExecutionMode mode : {ExecutionMode::Sequential, ExecutionMode::Conservative, ExecutionMode::Optimistic}) {
+        if (std::strcmp(only, "all") != 0 && std::strcmp(only, modeName(mode)) != 0)
+            continue;
+
+        std::size_t modeThreads = mode == ExecutionMode::Sequential ? 1 : maxThreads;
+        for (std::size_t threads = 1; threads <= modeThreads; threads = threads < modeThreads && threads * 2 > modeThreads ? modeThreads : threads * 2) {
+            PholdRun run = runPhold(mode, threads, population, endTime);
+            const TimeWarpStats& s = run.stats;
+
+            double rate = s.committed() / s.seconds;
+            if (baseline == 0.0) {
+                baseline = rate;
+                expected = s.committed();
+                expectedDigest = run.digest;
+            }
+
+            std::printf("%-12s %8zu %14llu %14.0f %12llu %9.1f%% %10llu %12llu %10llu %8.2fx%s\n", modeName(mode), threads,
+                        static_cast<unsigned long long>(s.committed()), rate,
+                        static_cast<unsigned long long>(s.rolledBack),
+                        100.0 * s.committed() / s.processed,
+                        static_cast<unsigned long long>(s.windows),
+                        static_cast<unsigned long long>(s.peakHistory),
+                        static_cast<unsigned long long>(s.poolPeakBytes / 1024), rate / baseline,
+                        run.lpEvents == s.committed() && s.committed() == expected && run.digest == expectedDigest ? "" : "  MISMATCH");
+            if (threads == modeThreads)
+                break;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,40 @@
+#include "phold_model.hpp"
+
+#include <cmath>
+
+PholdParams pholdParams;
+PholdLp* pholdLps = nullptr;
+
+void pholdEvent(PholdLp& lp) {
+    lp.processed = lp.processed + 1;
+
+    std::uint64_t r1 = pholdRandom(lp.id, 2 * lp.processed);
+    std::uint64_t r2 = pholdRandom(lp.id, 2 * lp.processed + 1);
+
+    LpId remote = static_cast<LpId>(r1 % pholdParams.lpCount);
+    LpId dst = pholdUniform(r2) <= pholdParams.remoteFraction ? remote : lp.id;
+    double delay = pholdParams.lookahead - pholdParams.meanDelay * std::log(pholdUniform(r1 ^ r2));
+
+    TimeWarp::send<pholdEvent>(dst, TimeWarp::now() + delay, pholdLps[dst]);
+}
+
+void pholdSeed(TimeWarp& kernel, PholdLp* lps, std::size_t population) {
+    pholdLps = lps;
+    for (LpId i = 0; i < pholdParams.lpCount; ++i) {
+        lps[i] = PholdLp{0, i};
+        for (std::size_t j = 0; j < population; ++j) {
+            double u = pholdUniform(pholdRandom(i, ~static_cast<std::uint64_t>(j)));
+            kernel.scheduleInitial<pholdEvent>(i, pholdParams.lookahead - pholdParams.meanDelay * std::log(u), lps[i]);
+        }
+    }
+}
+
+PholdRun pholdResult(const TimeWarpStats& stats) {
+    PholdRun result;
+    result.stats = stats;
+    for (LpId i = 0; i < pholdParams.lpCount; ++i) {
+        result.lpEvents += pholdLps[i].processed;
+        result.digest = pholdRandom(result.digest, pholdLps[i].processed);
+    }
+    return result;
+}
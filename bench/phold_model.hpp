@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include "phold_random.hpp"
+#include "time_warp.hpp"
+
+// PHOLD: every LP starts with a population of events; each event executed on an
+// LP sends one new event to a uniformly random LP (with probability
+// remoteFraction) or to itself, lookahead + Exp(meanDelay) into the future.
+
+struct PholdParams {
+    LpId lpCount = 1024;
+    double remoteFraction = 0.5;
+    double lookahead = 0.1;
+    double meanDelay = 1.0;
+};
+
+struct PholdLp {
+    std::uint64_t processed;   // reversible counter; also indexes the LP's random stream
+    LpId id;
+};
+
+extern PholdParams pholdParams;
+extern PholdLp* pholdLps;
+
+__attribute__((annotate("reverse"))) void pholdEvent(PholdLp& lp);
+
+// Shared benchmark fixture: seeding, summarizing a run and naming its mode
+
+// What a PHOLD run ended with; runs of the same model must agree on all but the stats
+struct PholdRun {
+    TimeWarpStats stats;
+    std::uint64_t lpEvents = 0;   // sum of the LP counters, must equal stats.committed()
+    std::uint64_t digest = 0;     // hash of every LP's counter
+    double setupSeconds = 0.0;    // seeding, or restoring a checkpoint
+};
+
+// Point pholdLps at `lps`, reset every LP and seed it with `population` events
+void pholdSeed(TimeWarp& kernel, PholdLp* lps, std::size_t population);
+
+// Sums and hashes the LP counters of pholdLps
+PholdRun pholdResult(const TimeWarpStats& stats);
+
+inline const char* modeName(ExecutionMode mode) {
+    switch (mode) {
+    case ExecutionMode::Sequential: return "sequential";
+    case ExecutionMode::Conservative: return "conservative";
+    default: return "optimistic";
+    }
+}
+
+// Optimistic unless `name` is "sequential" or "conservative"
+inline ExecutionMode modeFromName(const char* name) {
+    for (ExecutionMode mode : {ExecutionMode::Sequential, ExecutionMode::Conservative}) {
+        if (std::strcmp(name, modeName(mode)) == 0)
+            return mode;
+    }
+    return ExecutionMode::Optimistic;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstdint>
+
+// Counter-based random stream: a pure function of (LP, draw), so undoing an event
+// only has to restore the counter it was drawn with
+inline std::uint64_t pholdRandom(std::uint64_t lp, std::uint64_t draw) {
+    std::uint64_t z = lp * 0x9e3779b97f4a7c15ULL ^ draw * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// Uniform in (0, 1]
+inline double pholdUniform(std::uint64_t bits) {
+    return static_cast<double>((bits >> 11) + 1) * 0x1.0p-53;
+}
@@ -0,0 +1,35 @@
+#include "queue_model.hpp"
+
+#include <cmath>
+
+QueueParams queueParams;
+QueueLp* queueLps = nullptr;
+
+void queueArrival(QueueLp& lp) {
+    lp.arrivals = lp.arrivals + 1;
+    lp.waiting = lp.waiting + 1;
+
+    // The server was idle: this job goes straight into service
+    if (lp.waiting == 1) {
+        double service = queueParams.lookahead - queueParams.meanService * std::log(pholdUniform(pholdRandom(lp.id, 2 * lp.arrivals)));
+        TimeWarp::send<queueDeparture>(lp.id, TimeWarp::now() + service, lp);
+    }
+}
+
+void queueDeparture(QueueLp& lp) {
+    lp.departures = lp.departures + 1;
+    lp.waiting = lp.waiting - 1;
+
+    std::uint64_t r1 = pholdRandom(lp.id, 2 * lp.departures + 1);
+    std::uint64_t r2 = pholdRandom(r1, lp.departures);
+    LpId remote = static_cast<LpId>(r1 % queueParams.serverCount);
+    LpId dst = pholdUniform(r2) <= queueParams.remoteFraction ? remote : lp.id;
+    double transit = queueParams.lookahead - queueParams.meanTransit * std::log(pholdUniform(r1 ^ r2));
+    TimeWarp::send<queueArrival>(dst, TimeWarp::now() + transit, queueLps[dst]);
+
+    // Start on the next job in line
+    if (lp.waiting > 0) {
+        double service = queueParams.lookahead - queueParams.meanService * std::log(pholdUniform(pholdRandom(r2, lp.id)));
+        TimeWarp::send<queueDeparture>(lp.id, TimeWarp::now() + service, lp);
+    }
+}
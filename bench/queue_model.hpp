@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include "phold_random.hpp"
+#include "time_warp.hpp"
+
+// Closed queuing network: every LP is a FIFO single-server queue, and a fixed
+// population of jobs circulates between them. A job arriving at an idle server
+// starts service; when it departs it travels to a uniformly random server (with
+// probability remoteFraction) or rejoins its own queue, and the server starts on
+// the next waiting job. Service and transit times are lookahead + Exp(mean).
+
+struct QueueParams {
+    LpId serverCount = 256;
+    double remoteFraction = 0.5;
+    double lookahead = 0.1;
+    double meanService = 1.0;
+    double meanTransit = 1.0;
+};
+
+struct QueueLp {
+    std::uint64_t waiting;      // jobs queued or in service
+    std::uint64_t arrivals;     // reversible counters; also index the LP's random stream
+    std::uint64_t departures;
+    LpId id;
+};
+
+extern QueueParams queueParams;
+extern QueueLp* queueLps;
+
+__attribute__((annotate("reverse"))) void queueArrival(QueueLp& lp);
+__attribute__((annotate("reverse"))) void queueDeparture(QueueLp& lp);
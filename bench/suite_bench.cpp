@@ -0,0 +1,365 @@
+#include <sys/resource.h>
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "phold_model.hpp"
+#include "profile.hpp"
+#include "queue_model.hpp"
+#include "simulator.hpp"
+
+// Benchmark suite: standard DES workloads with reversible handlers, reported as
+// one JSON document so results can be tracked per commit.
+//   phold   PHOLD on the Time Warp kernel
+//   hold    the hold model on the sequential kernel, ending with a rollback
+//           that must restore the state of one time unit earlier
+//   queue   a closed queuing network on the Time Warp kernel
+// With --profile (and a FRACTURE_PROFILE=1 build) each workload also reports
+// the cycles spent per engine phase and per handler.
+// Usage: bench_suite [--quick] [--threads N] [--mode sequential|conservative|optimistic]
+//                    [--remote F] [--lookahead L] [--only phold|hold|queue] [--profile] [--label TEXT]
+
+namespace {
+    struct SuiteOptions {
+        bool quick = false;
+        bool profile = false;
+        std::size_t threads = 1;
+        ExecutionMode mode = ExecutionMode::Optimistic;
+        double remoteFraction = 0.5;
+        double lookahead = 0.1;
+        const char* only = nullptr;
+        const char* label = "";
+    };
+
+    // Wall time of each phase of a workload, in run order
+    struct PhaseTimer {
+        std::vector<std::pair<const char*, double>> phases;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        void end(const char* phase) {
+            auto now = std::chrono::steady_clock::now();
+            phases.emplace_back(phase, std::chrono::duration<double>(now - start).count());
+            start = now;
+        }
+
+        double seconds(const char* phase) const {
+            for (const auto& [name, seconds] : phases)
+                if (std::strcmp(name, phase) == 0)
+                    return seconds;
+            return 0.0;
+        }
+    };
+
+    struct WorkloadResult {
+        const char* name;
+        std::string params;              // JSON members describing the configuration
+        std::uint64_t committed = 0;
+        std::uint64_t processed = 0;
+        std::uint64_t rolledBack = 0;
+        std::uint64_t poolPeakBytes = 0;
+        std::uint64_t poolReservedBytes = 0;
+        std::uint64_t peakRssBytes = 0;
+        bool verified = false;
+        PhaseTimer timer;
+        ProfileReport profile;
+    };
+
+    // Process-wide high-water mark so far; workloads run in order, so it never
+    // drops below an earlier workload's
+    std::uint64_t peakRssBytes() {
+        rusage usage{};
+        getrusage(RUSAGE_SELF, &usage);
+        return static_cast<std::uint64_t>(usage.ru_maxrss) * 1024;
+    }
+
+    void recordTimeWarp(WorkloadResult& result, const TimeWarpStats& stats) {
+        result.committed = stats.committed();
+        result.processed = stats.processed;
+        result.rolledBack = stats.rolledBack;
+        result.poolPeakBytes = stats.poolPeakBytes;
+        result.poolReservedBytes = stats.poolReservedBytes;
+        result.peakRssBytes = peakRssBytes();
+    }
+
+    TimeWarpConfig timeWarpConfig(const SuiteOptions& options, double endTime) {
+        TimeWarpConfig config;
+        config.mode = options.mode;
+        config.threads = options.threads;
+        config.endTime = endTime;
+        config.lookahead = options.lookahead;
+        return config;
+    }
+
+    WorkloadResult runPhold(const SuiteOptions& options) {
+        WorkloadResult result{"phold"};
+        std::size_t population = 16;
+        double endTime = options.quick ? 10.0 : 100.0;
+        pholdParams.lpCount = 1024;
+        pholdParams.remoteFraction = options.remoteFraction;
+        pholdParams.lookahead = options.lookahead;
+
+        std::vector<PholdLp> lps(pholdParams.lpCount);
+        TimeWarp kernel(pholdParams.lpCount, timeWarpConfig(options, endTime));
+        pholdSeed(kernel, lps.data(), population);
+        result.timer.end("setup");
+
+        kernel.run();
+        result.timer.end("run");
+
+        PholdRun run = pholdResult(kernel.stats());
+        recordTimeWarp(result, run.stats);
+        result.verified = run.lpEvents == result.committed;
+        result.timer.end("verify");
+
+        char params[256];
+        std::snprintf(params, sizeof(params),
+                      "\"lps\": %u, \"population\": %zu, \"remote_fraction\": %g, \"lookahead\": %g, \"end_time\": %g",
+                      pholdParams.lpCount, population, pholdParams.remoteFraction, pholdParams.lookahead, endTime);
+        result.params = params;
+        return result;
+    }
+
+    WorkloadResult runQueue(const SuiteOptions& options) {
+        WorkloadResult result{"queue"};
+        std::size_t jobsPerServer = 4;
+        double endTime = options.quick ? 10.0 : 100.0;
+        queueParams.serverCount = 1024;
+        queueParams.remoteFraction = options.remoteFraction;
+        queueParams.lookahead = options.lookahead;
+
+        std::vector<QueueLp> lps(queueParams.serverCount);
+        queueLps = lps.data();
+        TimeWarp kernel(queueParams.serverCount, timeWarpConfig(options, endTime));
+        for (LpId i = 0; i < queueParams.serverCount; ++i) {
+            lps[i] = QueueLp{0, 0, 0, i};
+            for (std::size_t j = 0; j < jobsPerServer; ++j) {
+                double u = pholdUniform(pholdRandom(i, ~static_cast<std::uint64_t>(j)));
+                kernel.scheduleInitial<queueArrival>(i, queueParams.lookahead - queueParams.meanTransit * std::log(u), lps[i]);
+            }
+        }
+        result.timer.end("setup");
+
+        kernel.run();
+        result.timer.end("run");
+
+        // Every committed event is one arrival or departure, and no queue can
+        // have more departures than arrivals
+        std::uint64_t lpEvents = 0;
+        bool consistent = true;
+        for (const QueueLp& lp : lps) {
+            lpEvents += lp.arrivals + lp.departures;
+            consistent = consistent && lp.waiting == lp.arrivals - lp.departures;
+        }
+        recordTimeWarp(result, kernel.stats());
+        result.verified = consistent && lpEvents == result.committed;
+        result.timer.end("verify");
+
+        char params[256];
+        std::snprintf(params, sizeof(params),
+                      "\"servers\": %u, \"jobs_per_server\": %zu, \"remote_fraction\": %g, \"lookahead\": %g, \"end_time\": %g",
+                      queueParams.serverCount, jobsPerServer, queueParams.remoteFraction, queueParams.lookahead, endTime);
+        result.params = params;
+        return result;
+    }
+}
+
+// Hold model: a fixed population of events, each of which bumps a counter on a
+// random LP and reschedules itself an Exp(1) delay later
+struct HoldLp {
+    std::uint64_t executed;   // reversible counter
+};
+
+std::vector<HoldLp>* holdLps = nullptr;
+Simulator<CalendarQueue>* holdSim = nullptr;
+
+// Scheduling is left out of the undo handler; the rollback at the end of the run
+// only restores state
+__attribute__((noinline, annotate("reverse_ignore"))) void scheduleHold(std::uint64_t seed, double now);
+
+__attribute__((annotate("reverse"))) void holdEvent(HoldLp& lp, std::uint64_t seed) {
+    lp.executed = lp.executed + 1;
+    scheduleHold(pholdRandom(seed, lp.executed), holdSim->now());
+}
+
+void scheduleHold(std::uint64_t seed, double now) {
+    HoldLp& lp = (*holdLps)[seed % holdLps->size()];
+    double delay = -std::log(pholdUniform(pholdRandom(seed, 1)));
+    // The seed goes in as a prvalue: lvalue arguments are bound by reference
+    holdSim->scheduleEvent<holdEvent>(now + delay, lp, std::uint64_t{seed});
+}
+
+namespace {
+    WorkloadResult runHold(const SuiteOptions& options) {
+        WorkloadResult result{"hold"};
+        std::size_t pending = options.quick ? 10000 : 100000;
+        std::size_t lpCount = 1024;
+        double endTime = options.quick ? 10.0 : 50.0;
+
+        std::vector<HoldLp> lps(lpCount, HoldLp{0});
+        Simulator<CalendarQueue> sim;
+        holdLps = &lps;
+        holdSim = &sim;
+        for (std::uint64_t i = 0; i < pending; ++i)
+            scheduleHold(pholdRandom(i, ~i), 0.0);
+        result.timer.end("setup");
+
+        // Unit slices with fossil collection behind each, as a real driver would;
+        // the last time unit keeps its history for the rollback check
+        double checkpointTime = endTime - 1.0;
+        for (double t = 1.0; t <= checkpointTime; t += 1.0) {
+            sim.run(t);
+            sim.fossilCollect(t);
+        }
+        sim.run(checkpointTime);
+        std::vector<HoldLp> checkpoint = lps;
+        sim.run(endTime);
+        result.timer.end("run");
+
+        std::uint64_t executed = 0;
+        for (const HoldLp& lp : lps)
+            executed += lp.executed;
+        result.poolPeakBytes = sim.historyStats().peakBytes();
+        result.poolReservedBytes = sim.historyStats().reservedBytes();
+        result.peakRssBytes = peakRssBytes();
+
+        // Undo the last time unit: the undo handlers must restore the checkpoint
+        std::size_t historyBefore = sim.executedEventCount();
+        sim.rollback(checkpointTime);
+        result.rolledBack = historyBefore - sim.executedEventCount();
+        result.processed = executed;
+        result.committed = executed - result.rolledBack;
+        result.timer.end("rollback");
+
+        bool restored = true;
+        for (std::size_t i = 0; restored && i < lps.size(); ++i)
+            restored = lps[i].executed == checkpoint[i].executed;
+        result.verified = restored;
+        result.timer.end("verify");
+
+        char params[256];
+        std::snprintf(params, sizeof(params), "\"lps\": %zu, \"pending\": %zu, \"end_time\": %g", lpCount, pending, endTime);
+        result.params = params;
+        return result;
+    }
+
+    void printProfile(const ProfileReport& report) {
+        std::printf("      \"profile\": {\n");
+        std::printf("        \"phases\": {");
+        for (std::size_t i = 0; i < kProfilePhases; ++i)
+            std::printf("%s\"%s\": {\"count\": %llu, \"cycles\": %llu}", i ? ", " : "", kProfilePhaseNames[i],
+                        static_cast<unsigned long long>(report.total.phases[i].count),
+                        static_cast<unsigned long long>(report.total.phases[i].cycles));
+        std::printf("},\n");
+        std::printf("        \"handlers\": [");
+        for (std::size_t i = 0; i < report.handlers.size(); ++i) {
+            const ProfileHandler& handler = report.handlers[i];
+            const ProfileCounter& forward = handler.counters[ProfilePhase::Forward];
+            const ProfileCounter& reverse = handler.counters[ProfilePhase::Reverse];
+            std::printf("%s\n          {\"name\": \"%s\", \"forward\": %llu, \"forward_cycles\": %llu, "
+                        "\"reverse\": %llu, \"reverse_cycles\": %llu, \"saved_words\": %llu}",
+                        i ? "," : "", handler.name.c_str(), static_cast<unsigned long long>(forward.count),
+                        static_cast<unsigned long long>(forward.cycles), static_cast<unsigned long long>(reverse.count),
+                        static_cast<unsigned long long>(reverse.cycles), static_cast<unsigned long long>(forward.logWords));
+        }
+        std::printf("%s]\n", report.handlers.empty() ? "" : "\n        ");
+        std::printf("      },\n");
+    }
+
+    void printResult(const WorkloadResult& result, bool last, bool profile) {
+        double run = result.timer.seconds("run");
+        std::printf("    {\n");
+        std::printf("      \"name\": \"%s\",\n", result.name);
+        std::printf("      \"params\": {%s},\n", result.params.c_str());
+        std::printf("      \"committed_events\": %llu,\n", static_cast<unsigned long long>(result.committed));
+        std::printf("      \"processed_events\": %llu,\n", static_cast<unsigned long long>(result.processed));
+        std::printf("      \"rolled_back_events\": %llu,\n", static_cast<unsigned long long>(result.rolledBack));
+        std::printf("      \"committed_events_per_second\": %.1f,\n", run > 0.0 ? result.committed / run : 0.0);
+        std::printf("      \"rollback_ratio\": %.6f,\n",
+                    result.processed ? static_cast<double>(result.rolledBack) / result.processed : 0.0);
+        std::printf("      \"memory\": {\"pool_peak_bytes\": %llu, \"pool_reserved_bytes\": %llu, \"process_peak_rss_bytes\": %llu},\n",
+                    static_cast<unsigned long long>(result.poolPeakBytes),
+                    static_cast<unsigned long long>(result.poolReservedBytes),
+                    static_cast<unsigned long long>(result.peakRssBytes));
+        std::printf("      \"phase_seconds\": {");
+        for (std::size_t i = 0; i < result.timer.phases.size(); ++i)
+            std::printf("%s\"%s\": %.6f", i ? ", " : "", result.timer.phases[i].first, result.timer.phases[i].second);
+        std::printf("},\n");
+        if (profile)
+            printProfile(result.profile);
+        std::printf("      \"verified\": %s\n", result.verified ? "true" : "false");
+        std::printf("    }%s\n", last ? "" : ",");
+    }
+}
+
+int main(int argc, char** argv) {
+    SuiteOptions options;
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (std::strcmp(arg, "--quick") == 0) {
+            options.quick = true;
+        } else if (std::strcmp(arg, "--profile") == 0) {
+            options.profile = true;
+        } else if (std::strcmp(arg, "--threads") == 0 && value) {
+            options.threads = std::strtoull(value, nullptr, 10);
+            ++i;
+        } else if (std::strcmp(arg, "--mode") == 0 && value) {
+            options.mode = modeFromName(value);
+            ++i;
+        } else if (std::strcmp(arg, "--remote") == 0 && value) {
+            options.remoteFraction = std::atof(value);
+            ++i;
+        } else if (std::strcmp(arg, "--lookahead") == 0 && value) {
+            options.lookahead = std::atof(value);
+            ++i;
+        } else if (std::strcmp(arg, "--only") == 0 && value) {
+            options.only = value;
+            ++i;
+        } else if (std::strcmp(arg, "--label") == 0 && value) {
+            options.label = value;
+            ++i;
+        } else {
+            std::fprintf(stderr, "unknown argument %s\n", arg);
+            return 2;
+        }
+    }
+
+    using Workload = WorkloadResult (*)(const SuiteOptions&);
+    const std::pair<const char*, Workload> workloads[] = {{"phold", runPhold}, {"hold", runHold}, {"queue", runQueue}};
+
+    std::vector<WorkloadResult> results;
+    for (const auto& [name, workload] : workloads) {
+        if (options.only && std::strcmp(options.only, name) != 0)
+            continue;
+        if (options.profile) {
+            profileReset();
+            profileStart();
+        }
+        results.push_back(workload(options));
+        if (options.profile) {
+            profileStop();
+            results.back().profile = profileReport();
+        }
+    }
+
+    std::printf("{\n");
+    std::printf("  \"suite\": \"fracture\",\n");
+    std::printf("  \"label\": \"%s\",\n", options.label);
+    std::printf("  \"mode\": \"%s\",\n", modeName(options.mode));
+    std::printf("  \"threads\": %zu,\n", options.mode == ExecutionMode::Sequential ? std::size_t{1} : options.threads);
+    std::printf("  \"quick\": %s,\n", options.quick ? "true" : "false");
+    std::printf("  \"workloads\": [\n");
+    for (std::size_t i = 0; i < results.size(); ++i)
+        printResult(results[i], i + 1 == results.size(), options.profile);
+    std::printf("  ]\n");
+    std::printf("}\n");
+
+    bool verified = true;
+    for (const WorkloadResult& result : results)
+        verified = verified && result.verified;
+    return verified ? 0 : 1;
+}
@@ -0,0 +1,342 @@
+#include "checkpoint.hpp"
+
+#include <algorithm>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace {
+    constexpr std::size_t kMaxArenas = 16;
+
+    // Arenas the fault handler knows; slots are claimed and released with a CAS
+    std::atomic<StateArena*> liveArenas[kMaxArenas];
+    struct sigaction previousFault;
+    std::once_flag faultHandlerInstalled;
+
+    void onFault(int signal, siginfo_t* info, void* context) {
+        if (StateArena::markDirty(info->si_addr))
+            return;
+
+        // Not ours: hand over to whoever was there before, or fault again with the default action
+        if ((previousFault.sa_flags & SA_SIGINFO) && previousFault.sa_sigaction) {
+            previousFault.sa_sigaction(signal, info, context);
+        } else if (previousFault.sa_handler != SIG_DFL && previousFault.sa_handler != SIG_IGN) {
+            previousFault.sa_handler(signal);
+        } else {
+            ::sigaction(SIGSEGV, &previousFault, nullptr);
+        }
+    }
+
+    void installFaultHandler() {
+        std::call_once(faultHandlerInstalled, [] {
+            struct sigaction action {};
+            action.sa_sigaction = onFault;
+            action.sa_flags = SA_SIGINFO | SA_RESTART;
+            sigemptyset(&action.sa_mask);
+            ::sigaction(SIGSEGV, &action, &previousFault);
+        });
+    }
+
+    // Handler pointers are stored as offsets from this function, which is
+    // part of the same image as every handler
+    __attribute__((noinline)) void imageAnchor() {
+        asm volatile("");
+    }
+
+    std::uintptr_t anchor() {
+        return reinterpret_cast<std::uintptr_t>(&imageAnchor);
+    }
+
+    // Changes whenever the program's layout does: where the undo registry lies
+    // relative to the code, and how many handlers it lists
+    std::uint64_t imageFingerprint() {
+        std::uintptr_t registry = __start_fracture_undo ? reinterpret_cast<std::uintptr_t>(__start_fracture_undo) - anchor() : 0;
+        return registry * 0x9e3779b97f4a7c15ULL ^ static_cast<std::uint64_t>(__stop_fracture_undo - __start_fracture_undo);
+    }
+
+    template <typename Pointer>
+    void relocate(Pointer& pointer, bool store) {
+        auto value = reinterpret_cast<std::uintptr_t>(pointer);
+        if (value != 0)
+            pointer = reinterpret_cast<Pointer>(store ? value - anchor() : value + anchor());
+    }
+
+    void relocateEvent(Event& event, bool store) {
+        // The undo handler and trampoline are offsets from the forward handler
+        relocate(event.forward, store);
+    }
+
+    std::size_t roundUp(std::size_t value, std::size_t to) {
+        return (value + to - 1) / to * to;
+    }
+
+    // File layout after the header page and the arena pages
+    std::size_t tablesOffset(const CheckpointHeader& header) {
+        return header.pageSize + header.arenaCapacity;
+    }
+
+    std::size_t eventsOffset(const CheckpointHeader& header) {
+        return roundUp(header.lpCount * sizeof(CheckpointLp), alignof(CheckpointEvent));
+    }
+
+    bool writeAll(int fd, const void* data, std::size_t bytes, std::size_t offset) {
+        const auto* cursor = static_cast<const unsigned char*>(data);
+        while (bytes > 0) {
+            ssize_t written = ::pwrite(fd, cursor, bytes, static_cast<off_t>(offset));
+            if (written <= 0)
+                return false;
+            cursor += written;
+            offset += static_cast<std::size_t>(written);
+            bytes -= static_cast<std::size_t>(written);
+        }
+        return true;
+    }
+
+    std::string slotPath(const char* path, int slot) {
+        return std::string(path) + (slot == 0 ? ".0" : ".1");
+    }
+
+    bool readHeader(int fd, CheckpointHeader& header) {
+        return ::pread(fd, &header, sizeof(header), 0) == static_cast<ssize_t>(sizeof(header)) &&
+               std::memcmp(header.magic, kCheckpointMagic, sizeof(kCheckpointMagic)) == 0;
+    }
+}
+
+StateArena::StateArena(std::size_t capacity, std::uintptr_t address) {
+    pageSize = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+    reserved = roundUp(capacity, pageSize);
+
+    // The fixed address is what lets events point into the arena across a restore;
+    // if it is taken, any address still works for runs that are not restored elsewhere
+    void* mapped = ::mmap(reinterpret_cast<void*>(address), reserved, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED_NOREPLACE, -1, 0);
+    if (mapped == MAP_FAILED)
+        mapped = ::mmap(nullptr, reserved, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mapped == MAP_FAILED) {
+        std::perror("StateArena: mmap");
+        reserved = 0;
+        return;
+    }
+    data = static_cast<unsigned char*>(mapped);
+    dirtyBits.reset(new std::atomic<std::uint64_t>[(reserved / pageSize + 63) / 64]());
+}
+
+StateArena::StateArena(const CheckpointSnapshot& snapshot) {
+    const CheckpointHeader& header = snapshot.header();
+    pageSize = header.pageSize;
+    reserved = header.arenaCapacity;
+    top = header.arenaUsed;
+
+    void* address = reinterpret_cast<void*>(header.arenaAddress);
+    void* mapped = ::mmap(address, reserved, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED_NOREPLACE, -1, 0);
+    if (mapped != address) {
+        if (mapped != MAP_FAILED)
+            ::munmap(mapped, reserved);
+        std::fprintf(stderr, "StateArena: address %p of the snapshot is in use\n", address);
+        reserved = top = 0;
+        return;
+    }
+
+    // The pages in use come straight from the file, copy-on-write
+    std::size_t bytes = roundUp(top, pageSize);
+    if (bytes > 0 && ::mmap(address, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+                            snapshot.descriptor(), static_cast<off_t>(header.pageSize)) == MAP_FAILED) {
+        std::perror("StateArena: mmap snapshot");
+        ::munmap(address, reserved);
+        reserved = top = 0;
+        return;
+    }
+    data = static_cast<unsigned char*>(address);
+    dirtyBits.reset(new std::atomic<std::uint64_t>[(reserved / pageSize + 63) / 64]());
+}
+
+StateArena::~StateArena() {
+    for (auto& slot : liveArenas) {
+        StateArena* self = this;
+        slot.compare_exchange_strong(self, nullptr);
+    }
+    if (data)
+        ::munmap(data, reserved);
+}
+
+void* StateArena::allocate(std::size_t bytes, std::size_t alignment) {
+    std::size_t start = roundUp(top, alignment);
+    if (!data || start + bytes > reserved)
+        return nullptr;
+    top = start + bytes;
+    return data + start;
+}
+
+bool StateArena::markDirty(void* address) {
+    auto* byte = static_cast<unsigned char*>(address);
+    for (auto& slot : liveArenas) {
+        StateArena* arena = slot.load(std::memory_order_acquire);
+        if (!arena || byte < arena->data || byte >= arena->data + arena->reserved)
+            continue;
+
+        std::size_t page = static_cast<std::size_t>(byte - arena->data) / arena->pageSize;
+        arena->dirtyBits[page / 64].fetch_or(std::uint64_t(1) << (page % 64), std::memory_order_relaxed);
+        ::mprotect(arena->data + page * arena->pageSize, arena->pageSize, PROT_READ | PROT_WRITE);
+        return true;
+    }
+    return false;
+}
+
+bool StateArena::dirty(std::size_t page) const {
+    if (!tracked)
+        return true;
+    return dirtyBits[page / 64].load(std::memory_order_relaxed) >> (page % 64) & 1;
+}
+
+void StateArena::protect() {
+    installFaultHandler();
+    bool listed = false;
+    for (auto& slot : liveArenas)
+        listed = listed || slot.load() == this;
+    for (std::size_t i = 0; i < kMaxArenas && !listed; ++i) {
+        StateArena* empty = nullptr;
+        listed = liveArenas[i].compare_exchange_strong(empty, this);
+    }
+    // Untracked arenas are written in full by every snapshot
+    tracked = listed;
+    if (!listed)
+        return;
+
+    std::size_t pages = roundUp(top, pageSize) / pageSize;
+    for (std::size_t word = 0; word < (pages + 63) / 64; ++word)
+        dirtyBits[word].store(0, std::memory_order_relaxed);
+    if (pages > 0)
+        ::mprotect(data, pages * pageSize, PROT_READ);
+}
+
+std::unique_ptr<CheckpointSnapshot> CheckpointSnapshot::open(const char* path) {
+    std::unique_ptr<CheckpointSnapshot> best;
+    for (int slot = 0; slot < 2; ++slot) {
+        int fd = ::open(slotPath(path, slot).c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            continue;
+
+        CheckpointHeader header;
+        if (!readHeader(fd, header) || header.version != kCheckpointVersion || !header.complete ||
+            header.eventSize != kEventSize || header.pageSize != static_cast<std::uint32_t>(::sysconf(_SC_PAGESIZE)) ||
+            header.imageFingerprint != imageFingerprint() || (best && best->head.sequence > header.sequence)) {
+            ::close(fd);
+            continue;
+        }
+
+        std::unique_ptr<CheckpointSnapshot> snapshot(new CheckpointSnapshot());
+        snapshot->fd = fd;
+        snapshot->head = header;
+        snapshot->mappedBytes = eventsOffset(header) + header.eventCount * sizeof(CheckpointEvent);
+        void* tables = ::mmap(nullptr, snapshot->mappedBytes, PROT_READ, MAP_PRIVATE, fd,
+                              static_cast<off_t>(tablesOffset(header)));
+        if (tables == MAP_FAILED)
+            continue;
+        snapshot->mapped = tables;
+        best = std::move(snapshot);
+    }
+    return best;
+}
+
+CheckpointSnapshot::~CheckpointSnapshot() {
+    if (mapped)
+        ::munmap(mapped, mappedBytes);
+    if (fd >= 0)
+        ::close(fd);
+}
+
+const CheckpointLp* CheckpointSnapshot::lps() const {
+    return static_cast<const CheckpointLp*>(mapped);
+}
+
+void CheckpointSnapshot::pendingEvent(std::size_t i, Event& event, LpId& dst) const {
+    const auto* events = static_cast<const unsigned char*>(mapped) + eventsOffset(head);
+    CheckpointEvent stored;
+    std::memcpy(static_cast<void*>(&stored), events + i * sizeof(CheckpointEvent), sizeof(stored));
+    relocateEvent(stored.event, false);
+    event = stored.event;
+    dst = stored.dst;
+}
+
+CheckpointWriter::CheckpointWriter(const char* path, StateArena* arena) : arena(arena) {
+    for (int slot = 0; slot < 2; ++slot) {
+        files[slot] = ::open(slotPath(path, slot).c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (files[slot] < 0) {
+            std::perror("CheckpointWriter: open");
+            continue;
+        }
+        // Continue the numbering, so our snapshots win over older ones at the same path
+        CheckpointHeader header;
+        if (readHeader(files[slot], header))
+            sequence = std::max(sequence, header.sequence + 1);
+    }
+}
+
+CheckpointWriter::~CheckpointWriter() {
+    for (int fd : files)
+        if (fd >= 0)
+            ::close(fd);
+}
+
+std::size_t CheckpointWriter::write(double time, const std::vector<CheckpointLp>& lps, const std::vector<CheckpointEvent>& events) {
+    int slot = static_cast<int>(sequence % 2);
+    int fd = files[slot];
+    if (fd < 0)
+        return 0;
+
+    CheckpointHeader header{};
+    std::memcpy(header.magic, kCheckpointMagic, sizeof(kCheckpointMagic));
+    header.version = kCheckpointVersion;
+    header.sequence = sequence++;
+    header.imageFingerprint = imageFingerprint();
+    header.eventSize = kEventSize;
+    header.pageSize = static_cast<std::uint32_t>(::sysconf(_SC_PAGESIZE));
+    header.time = time;
+    header.arenaAddress = arena ? reinterpret_cast<std::uintptr_t>(arena->data) : 0;
+    header.arenaCapacity = arena ? arena->reserved : 0;
+    header.arenaUsed = arena ? arena->top : 0;
+    header.lpCount = lps.size();
+    header.eventCount = events.size();
+
+    // Incomplete until the end, and durably so before anything it describes changes
+    bool ok = writeAll(fd, &header, sizeof(header), 0) && ::fdatasync(fd) == 0;
+
+    // Pages this file lacks: new since its last snapshot, dirtied since the
+    // previous snapshot (which went to the other file), or dirtied since this one
+    std::size_t written = 0;
+    if (arena && ok) {
+        std::size_t pages = roundUp(arena->top, arena->pageSize) / arena->pageSize;
+        lastDirty.resize((arena->reserved / arena->pageSize + 63) / 64, 0);
+        for (std::size_t page = 0; page < pages && ok; ++page) {
+            bool stale = page * arena->pageSize >= covered[slot] || arena->dirty(page) ||
+                         (lastDirty[page / 64] >> (page % 64) & 1);
+            if (!stale)
+                continue;
+            ok = writeAll(fd, arena->data + page * arena->pageSize, arena->pageSize, header.pageSize + page * arena->pageSize);
+            ++written;
+        }
+        for (std::size_t word = 0; word < lastDirty.size(); ++word)
+            lastDirty[word] = arena->dirtyBits[word].load(std::memory_order_relaxed);
+        covered[slot] = ok ? pages * arena->pageSize : 0;
+        arena->protect();
+    }
+
+    std::vector<CheckpointEvent> stored(events);
+    for (CheckpointEvent& event : stored)
+        relocateEvent(event.event, true);
+    std::size_t tables = tablesOffset(header);
+    ok = ok && writeAll(fd, lps.data(), lps.size() * sizeof(CheckpointLp), tables) &&
+         writeAll(fd, stored.data(), stored.size() * sizeof(CheckpointEvent), tables + eventsOffset(header)) &&
+         ::fdatasync(fd) == 0;
+
+    header.complete = ok ? 1 : 0;
+    if (!ok || !writeAll(fd, &header, sizeof(header), 0) || ::fdatasync(fd) != 0)
+        std::perror("CheckpointWriter: write");
+    return written;
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "event.hpp"
+
+// Checkpoint/restore for long runs. The kernel snapshots the committed state
+// whenever GVT passes a multiple of TimeWarpConfig::checkpointInterval: the
+// model state, each LP's send counter and every pending event. A restored
+// kernel continues from there, and so can any number of runs with different
+// parameters that share the same prefix.
+//
+// Model state must live in a StateArena: a bump allocator over a reservation at
+// a fixed virtual address. Events keep raw argument pointers, so an arena
+// comes back at the same address and references into it stay valid; handler
+// pointers are stored relative to the program image and only restore into the
+// same binary. Writes are incremental: after each snapshot the arena is
+// write-protected, the first store to a page marks it dirty (SIGSEGV handler),
+// and the next snapshot only writes the dirty pages. Snapshots alternate
+// between <path>.0 and <path>.1, and a file's header is only marked complete
+// after its contents are on disk, so a crash while writing one keeps the other.
+// Restoring maps the arena pages of the file copy-on-write, which makes start-up
+// independent of the model's size.
+
+// Default arena address: far above the heap and below the mmap area on x86-64
+constexpr std::uintptr_t kStateArenaAddress = 0x200000000000;
+
+class CheckpointSnapshot;
+
+class StateArena {
+public:
+    explicit StateArena(std::size_t capacity, std::uintptr_t address = kStateArenaAddress);
+    // The model state of a snapshot, mapped at the address it was taken from
+    explicit StateArena(const CheckpointSnapshot& snapshot);
+    ~StateArena();
+
+    StateArena(const StateArena&) = delete;
+    StateArena& operator=(const StateArena&) = delete;
+
+    void* allocate(std::size_t bytes, std::size_t alignment = alignof(std::max_align_t));
+
+    template <typename T>
+    T* allocate(std::size_t count) {
+        return static_cast<T*>(allocate(count * sizeof(T), alignof(T)));
+    }
+
+    // First allocation; a restored model finds its state from here
+    void* base() const { return data; }
+    std::size_t used() const { return top; }
+    std::size_t capacity() const { return reserved; }
+    bool valid() const { return data != nullptr; }
+
+    // Called by the fault handler: true if `address` is a write-protected page of an arena
+    static bool markDirty(void* address);
+
+private:
+    friend class CheckpointWriter;
+
+    bool dirty(std::size_t page) const;
+    void protect();   // clears the dirty bits and write-protects every page in use
+
+    unsigned char* data = nullptr;
+    std::size_t reserved = 0;
+    std::size_t top = 0;
+    std::size_t pageSize = 0;
+    bool tracked = false;                                      // write-protected, listed for the fault handler
+    std::unique_ptr<std::atomic<std::uint64_t>[]> dirtyBits;   // one bit per page, set by the fault handler
+};
+
+// File format; bump kCheckpointVersion whenever a layout below changes
+inline constexpr char kCheckpointMagic[8] = "FRCKPT";
+inline constexpr std::uint32_t kCheckpointVersion = 1;
+
+struct CheckpointHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t complete;        // set last, once everything else is on disk
+    std::uint64_t sequence;        // snapshots taken so far; the newest complete file wins
+    std::uint64_t imageFingerprint;  // identifies the binary the handler offsets belong to
+    std::uint32_t eventSize;
+    std::uint32_t pageSize;
+    double time;                   // every event before it is committed, none after it executed
+    std::uint64_t arenaAddress;
+    std::uint64_t arenaCapacity;
+    std::uint64_t arenaUsed;       // arena pages start at pageSize, in place
+    std::uint64_t lpCount;         // LP table, then pending events, after the arena pages
+    std::uint64_t eventCount;
+};
+
+struct CheckpointLp {
+    std::uint32_t nextSequence;
+    std::uint32_t reserved;
+    double lookahead;
+};
+
+struct CheckpointEvent {
+    Event event;                   // handler pointers relative to the program image
+    LpId dst;
+};
+
+// A complete snapshot, mapped read-only
+class CheckpointSnapshot {
+public:
+    // The newest complete snapshot among <path>.0 and <path>.1 that this binary
+    // can restore, or nullptr
+    static std::unique_ptr<CheckpointSnapshot> open(const char* path);
+    ~CheckpointSnapshot();
+
+    const CheckpointHeader& header() const { return head; }
+    double time() const { return head.time; }
+    const CheckpointLp* lps() const;
+    // The i-th pending event, with live handler pointers
+    void pendingEvent(std::size_t i, Event& event, LpId& dst) const;
+    int descriptor() const { return fd; }
+
+private:
+    CheckpointSnapshot() = default;
+
+    int fd = -1;
+    CheckpointHeader head{};
+    void* mapped = nullptr;                  // LP table and events
+    std::size_t mappedBytes = 0;
+};
+
+// Writes snapshots, alternating between <path>.0 and <path>.1
+class CheckpointWriter {
+public:
+    CheckpointWriter(const char* path, StateArena* arena);
+    ~CheckpointWriter();
+
+    // Returns the number of arena pages written
+    std::size_t write(double time, const std::vector<CheckpointLp>& lps, const std::vector<CheckpointEvent>& events);
+
+private:
+    StateArena* arena;
+    int files[2] = {-1, -1};
+    std::uint64_t sequence = 0;
+    std::size_t covered[2] = {0, 0};         // arena bytes each file holds from its last snapshot
+    std::vector<std::uint64_t> lastDirty;    // pages written by the previous snapshot, for the other file
+};
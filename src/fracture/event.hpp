@@ -0,0 +1,412 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <cstddef>
+#include <cstdio>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "event_key.hpp"
+#include "reverse_log.hpp"
+#include "trace.hpp"
+
+// Generic handler pointer; forward and undo handlers are stored as this type and
+// cast back to their real signature by the trampoline
+using HandlerPtr = void (*)();
+
+// Calls `handler` with the arguments stored in `args`; one instantiation per signature
+using EventTrampoline = void (*)(HandlerPtr handler, void* args);
+
+// Size of an Event: one cache line, header plus inline argument buffer
+constexpr std::size_t kEventSize = 64;
+
+// Event class that stores its key (timestamp and tie-breakers, see
+// event_key.hpp), the forward and undo handlers and their arguments inline. It
+// never allocates and is trivially copyable, so pending-event queues can move
+// events around with plain memcpy.
+//
+// The undo handler and the trampoline are kept as 32-bit offsets from the
+// forward handler, which leaves 32 bytes for arguments: all three are code of
+// the same program, and the x86-64 code models keep a program's code within
+// 2 GiB. Offsets also survive the program being loaded at another address.
+class alignas(kEventSize) Event {
+public:
+    static constexpr std::size_t kHeaderSize = sizeof(EventKey) + sizeof(HandlerPtr) + 2 * sizeof(std::int32_t);
+    static constexpr std::size_t kArgCapacity = kEventSize - kHeaderSize;
+    static constexpr std::size_t kArgAlignment = alignof(double);
+
+    EventKey key;
+    HandlerPtr forward = nullptr;
+    std::int32_t undoOffset = 0;         // 0: no undo handler
+    std::int32_t trampolineOffset = 0;
+    alignas(kArgAlignment) unsigned char args[kArgCapacity];
+
+    double timestamp() const { return key.timestamp(); }
+    void setTimestamp(double timestamp) { key.setTimestamp(timestamp); }
+
+    // Lower priorities run first among events with equal timestamps
+    void setPriority(std::uint8_t priority) { key.setPriority(priority); }
+
+    void setHandlers(HandlerPtr forwardFunc, HandlerPtr undoFunc, EventTrampoline trampolineFunc) {
+        forward = forwardFunc;
+        undoOffset = undoFunc ? offsetOf(reinterpret_cast<std::intptr_t>(undoFunc)) : 0;
+        trampolineOffset = offsetOf(reinterpret_cast<std::intptr_t>(trampolineFunc));
+    }
+
+    HandlerPtr undo() const { return undoOffset ? reinterpret_cast<HandlerPtr>(at(undoOffset)) : nullptr; }
+    EventTrampoline trampoline() const { return reinterpret_cast<EventTrampoline>(at(trampolineOffset)); }
+
+    // `log` must be the thread's active reverse log (see ReverseLogScope)
+    void call(ReverseLog& log) {
+        if (forward) {
+            trampoline()(forward, args);
+            log.endForward();
+        }
+    }
+
+    void callUndo(ReverseLog& log) {
+        if (undoOffset) {
+            log.beginUndo();
+            trampoline()(undo(), args);
+        }
+    }
+
+    void call() { call(currentReverseLog()); }
+    void callUndo() { callUndo(currentReverseLog()); }
+
+private:
+    std::int32_t offsetOf(std::intptr_t code) const {
+        return static_cast<std::int32_t>(code - reinterpret_cast<std::intptr_t>(forward));
+    }
+    std::intptr_t at(std::int32_t offset) const { return reinterpret_cast<std::intptr_t>(forward) + offset; }
+};
+
+static_assert(sizeof(Event) == kEventSize, "Event must be exactly one cache line");
+static_assert(std::is_trivially_copyable_v<Event>, "Event must be trivially relocatable");
+static_assert(Event::kArgCapacity >= 32, "an LP reference and three 8-byte arguments must fit in an Event");
+
+// Helper function to wrap arguments in std::ref if they are references
+template <typename T>
+auto wrapArgument(T&& arg) -> decltype(std::forward<T>(arg)) {
+    return std::forward<T>(arg);
+}
+
+template <typename T>
+std::reference_wrapper<T> wrapArgument(T& arg) {
+    return std::ref(arg);
+}
+
+// Trivially copyable argument pack. std::tuple is not trivially copyable, so the
+// bound arguments are kept in an aggregate of indexed slots instead.
+template <std::size_t I, typename T>
+struct ArgSlot {
+    T value;
+};
+
+template <typename Seq, typename... Ts>
+struct ArgPackImpl;
+
+template <std::size_t... I, typename... Ts>
+struct ArgPackImpl<std::index_sequence<I...>, Ts...> : ArgSlot<I, Ts>... {
+    template <typename FuncType>
+    void apply(FuncType func) {
+        func(static_cast<ArgSlot<I, Ts>&>(*this).value...);
+    }
+};
+
+template <typename... Ts>
+using ArgPack = ArgPackImpl<std::index_sequence_for<Ts...>, Ts...>;
+
+// Stored type of an argument passed to CreateEvent
+template <typename T>
+using BoundArg = std::decay_t<decltype(wrapArgument(std::declval<T>()))>;
+
+// The one trampoline per handler signature and argument pack
+template <typename FuncType, typename Pack>
+void invokeHandler(HandlerPtr handler, void* args) {
+    std::launder(static_cast<Pack*>(args))->apply(reinterpret_cast<FuncType>(handler));
+}
+
+// Entry of the static forward->undo registry emitted by the reverse-pass
+struct UndoEntry {
+    void* forward;
+    void* undo;
+    const char* name;   // demangled forward handler, for profiles and diagnostics
+};
+
+// Emitted by the reverse-pass: each module's entries go into the fracture_undo
+// section, which the linker delimits with these symbols. Weak so a program
+// built without the pass still links.
+extern "C" {
+    extern const UndoEntry __start_fracture_undo[] __attribute__((weak));
+    extern const UndoEntry __stop_fracture_undo[] __attribute__((weak));
+}
+
+// Look up the undo handler of a forward handler in the registry
+inline void* findUndoHandler(void* forward) {
+    for (const UndoEntry* entry = __start_fracture_undo; entry != __stop_fracture_undo; ++entry) {
+        if (entry->forward == forward)
+            return entry->undo;
+    }
+    return nullptr;
+}
+
+// Name of a registered forward handler, or nullptr
+inline const char* findHandlerName(void* forward) {
+    for (const UndoEntry* entry = __start_fracture_undo; entry != __stop_fracture_undo; ++entry) {
+        if (entry->forward == forward)
+            return entry->name;
+    }
+    return nullptr;
+}
+
+// The reverse-pass replaces every call whose argument is a known function with the
+// address of its undo handler; this body only runs for runtime function pointers
+extern "C" __attribute__((noinline)) inline void* __fracture_undo_of(void* forward) {
+    return findUndoHandler(forward);
+}
+
+// Events created without an undo handler; they cannot be rolled back
+inline std::atomic<std::uint64_t> missingUndoEvents{0};
+
+// Reported even without tracing: the first event on stderr, every one in
+// missingUndoEvents. Out of line and reverse_ignore like traceWrite, since
+// handlers create events.
+__attribute__((cold, noinline, annotate("reverse_ignore"))) inline void reportMissingUndo(double timestamp,
+                                                                                          HandlerPtr forward) {
+    if (missingUndoEvents.fetch_add(1, std::memory_order_relaxed) == 0) {
+        const char* name = findHandlerName(reinterpret_cast<void*>(forward));
+        std::fprintf(stderr, "Could not find reverse handler for event at time %g (%s); "
+                             "further events without one are counted in missingUndoEvents\n",
+                     timestamp, name ? name : "handler not annotated \"reverse\"");
+    }
+    trace<TraceKind::MissingUndo>(timestamp, forward);
+}
+
+// Undo handler of F, resolved when the reverse-pass runs
+template <auto F>
+inline decltype(F) undoOf() {
+    return reinterpret_cast<decltype(F)>(__fracture_undo_of(reinterpret_cast<void*>(F)));
+}
+
+// Entry of the table of batched variants the reverse-pass emits for handlers
+// annotated "reverse,batch": each variant runs a group of events with the same
+// handler as one loop over columns of their arguments,
+//   void batchForward(std::uint64_t n, std::uint64_t* marks, column0, column1, ...)
+// where column k is an array with parameter k of every event (a pointer for a
+// reference). The forward variant stores the reverse log position after event i
+// in marks[i] when the handler records anything; the undo variant undoes
+// events n-1..0 and rewinds the log to marks[i] before undoing event i.
+struct BatchEntry {
+    void* forward;
+    void* batchForward;
+    void* batchUndo;
+    std::uint64_t parameters;
+};
+
+extern "C" {
+    extern const BatchEntry __start_fracture_batch[] __attribute__((weak));
+    extern const BatchEntry __stop_fracture_batch[] __attribute__((weak));
+}
+
+// Gathers the arguments of `n` events, `stride` bytes apart, into columns and
+// calls a batched variant with them; one instantiation per trampoline
+using BatchInvoker = void (*)(void* variant, const Event* first, std::size_t stride, std::size_t n,
+                              std::uint64_t* marks);
+
+// Column element of a handler parameter: what the variant loads per event
+template <typename P>
+using BatchColumn = std::conditional_t<std::is_reference_v<P>, std::remove_reference_t<P>*, P>;
+
+// Parameters the reverse-pass passes as one scalar; a handler with any other
+// parameter (a struct by value, long double) runs one event at a time
+template <typename P>
+inline constexpr bool kBatchableParameter =
+    std::is_reference_v<P> || std::is_pointer_v<P> || std::is_enum_v<P> ||
+    (std::is_arithmetic_v<P> && sizeof(P) <= sizeof(std::uint64_t) && !std::is_same_v<P, long double>);
+
+template <typename FuncType, typename Pack>
+struct BatchInvoke {
+    static constexpr bool supported = false;
+};
+
+template <typename R, typename... P, std::size_t... I, typename... Ts>
+struct BatchInvoke<R (*)(P...), ArgPackImpl<std::index_sequence<I...>, Ts...>> {
+    using Pack = ArgPackImpl<std::index_sequence<I...>, Ts...>;
+    static constexpr bool supported = sizeof...(P) == sizeof...(Ts) && (kBatchableParameter<P> && ...);
+
+    template <typename Param, typename T>
+    static BatchColumn<Param> element(const T& value) {
+        if constexpr (std::is_reference_v<Param>)
+            return &static_cast<Param>(const_cast<T&>(value));
+        else
+            return static_cast<Param>(value);
+    }
+
+    static void invoke(void* variant, const Event* first, std::size_t stride, std::size_t n, std::uint64_t* marks) {
+        // Column k starts at word k * n; elements are packed at their own size
+        static thread_local std::vector<std::uint64_t> columns;
+        if (columns.size() < n * sizeof...(P))
+            columns.resize(n * sizeof...(P));
+        const auto* bytes = reinterpret_cast<const unsigned char*>(first);
+        for (std::size_t i = 0; i < n; ++i) {
+            const Pack* pack = std::launder(reinterpret_cast<const Pack*>(
+                reinterpret_cast<const Event*>(bytes + i * stride)->args));
+            ((::new (static_cast<void*>(reinterpret_cast<BatchColumn<P>*>(&columns[I * n]) + i))
+                  BatchColumn<P>(element<P>(static_cast<const ArgSlot<I, Ts>&>(*pack).value))),
+             ...);
+        }
+        using Variant = void (*)(std::uint64_t, std::uint64_t*, BatchColumn<P>*...);
+        reinterpret_cast<Variant>(variant)(n, marks,
+                                           std::launder(reinterpret_cast<BatchColumn<P>*>(&columns[I * n]))...);
+    }
+};
+
+template <typename R, typename... P, typename Pack>
+struct BatchInvoke<R (*)(P...) noexcept, Pack> : BatchInvoke<R (*)(P...), Pack> {};
+
+// Trampolines whose argument packs can be gathered into columns. Each one is
+// registered by the dynamic initializer of kBatchInvokerRegistered, which runs
+// at program start for every signature makeEvent is instantiated with, not when
+// the first event is built; findBatchRoute may miss it before main()
+struct BatchInvokerEntry {
+    EventTrampoline trampoline;
+    BatchInvoker invoke;
+    std::size_t arity;
+};
+
+inline std::vector<BatchInvokerEntry>& batchInvokers() {
+    static std::vector<BatchInvokerEntry> invokers;
+    return invokers;
+}
+
+template <typename FuncType, typename Pack, std::size_t Arity>
+inline const bool kBatchInvokerRegistered = [] {
+    if constexpr (BatchInvoke<FuncType, Pack>::supported) {
+        batchInvokers().push_back({&invokeHandler<FuncType, Pack>, &BatchInvoke<FuncType, Pack>::invoke, Arity});
+        return true;
+    }
+    return false;
+}();
+
+// How a group of events with the same handler and trampoline runs batched;
+// empty when the handler has no batched variants or its arguments cannot be gathered
+struct BatchRoute {
+    const BatchEntry* entry = nullptr;
+    BatchInvoker invoke = nullptr;
+
+    explicit operator bool() const { return entry != nullptr; }
+
+    void forward(const Event* first, std::size_t stride, std::size_t n, std::uint64_t* marks) const {
+        invoke(entry->batchForward, first, stride, n, marks);
+    }
+
+    void undo(const Event* first, std::size_t stride, std::size_t n, std::uint64_t* marks) const {
+        invoke(entry->batchUndo, first, stride, n, marks);
+    }
+};
+
+inline BatchRoute findBatchRoute(HandlerPtr forward, EventTrampoline trampoline) {
+    for (const BatchEntry* entry = __start_fracture_batch; entry != __stop_fracture_batch; ++entry) {
+        if (entry->forward != reinterpret_cast<void*>(forward))
+            continue;
+        for (const BatchInvokerEntry& invoker : batchInvokers()) {
+            if (invoker.trampoline == trampoline && invoker.arity == entry->parameters)
+                return {entry, invoker.invoke};
+        }
+        break;
+    }
+    return {};
+}
+
+template <typename FuncType, typename... Args>
+Event makeEvent(double timestamp, FuncType func, FuncType undoFunc, Args&&... args) {
+    using Pack = ArgPack<BoundArg<Args>...>;
+    static_assert(sizeof(Pack) <= Event::kArgCapacity,
+                  "event arguments do not fit in the 32-byte inline buffer; pass large state by reference");
+    static_assert(alignof(Pack) <= Event::kArgAlignment, "event arguments are over-aligned");
+    static_assert(std::is_trivially_copyable_v<Pack>, "event arguments must be trivially copyable");
+    (void)kBatchInvokerRegistered<FuncType, Pack, sizeof...(Args)>;
+
+    Event event;
+    event.key.setTimestamp(timestamp);
+    event.setHandlers(reinterpret_cast<HandlerPtr>(func), reinterpret_cast<HandlerPtr>(undoFunc),
+                      &invokeHandler<FuncType, Pack>);
+    ::new (static_cast<void*>(event.args)) Pack{{wrapArgument(std::forward<Args>(args))}...};
+
+    if (!undoFunc)
+        reportMissingUndo(timestamp, event.forward);
+
+    return event;
+}
+
+// Member functions and stateless lambdas are bound through a thunk per handler,
+// so events still store plain function pointers and the handler is a direct
+// call inside the thunk. The thunks are annotated "reverse_bind": the
+// reverse-pass gives a thunk an undo handler that calls the undo handler of
+// what it wraps, when that is annotated "reverse". The call stays out of line
+// until the pass has seen it; the pass then drops the noinline, so the final
+// compile inlines the handler into its thunk.
+#if defined(__clang__)
+#define FRACTURE_BOUND_CALL [[clang::noinline]]
+#else
+#define FRACTURE_BOUND_CALL
+#endif
+
+template <auto F, typename C, typename... A>
+__attribute__((annotate("reverse_bind"))) void memberThunk(C& self, A... args) {
+    FRACTURE_BOUND_CALL (self.*F)(static_cast<A&&>(args)...);
+}
+
+template <auto F, typename... A>
+__attribute__((annotate("reverse_bind"))) void lambdaThunk(A... args) {
+    FRACTURE_BOUND_CALL F(static_cast<A&&>(args)...);
+}
+
+// The function pointer an event stores for handler F: F itself for a free
+// function, a thunk for a member function pointer (called as
+// CreateEvent<&Lp::handler>(ts, lp, args...)) or a stateless lambda
+template <auto F, typename Type = decltype(F), typename = void>
+struct HandlerBinding {
+    static constexpr auto handler = F;
+};
+
+template <auto F, typename C, typename R, typename... A>
+struct HandlerBinding<F, R (C::*)(A...)> {
+    static constexpr auto handler = &memberThunk<F, C, A...>;
+};
+
+template <auto F, typename C, typename R, typename... A>
+struct HandlerBinding<F, R (C::*)(A...) noexcept> : HandlerBinding<F, R (C::*)(A...)> {};
+
+template <auto F, typename Call>
+struct LambdaBinding;
+
+template <auto F, typename Closure, typename R, typename... A>
+struct LambdaBinding<F, R (Closure::*)(A...) const> {
+    static constexpr auto handler = &lambdaThunk<F, A...>;
+};
+
+template <auto F, typename Closure, typename R, typename... A>
+struct LambdaBinding<F, R (Closure::*)(A...) const noexcept> : LambdaBinding<F, R (Closure::*)(A...) const> {};
+
+template <auto F, typename Type>
+struct HandlerBinding<F, Type, std::enable_if_t<std::is_class_v<Type>>>
+    : LambdaBinding<F, decltype(&Type::operator())> {};
+
+// CreateEvent with the handler bound at compile time: CreateEvent<handler>(ts, args...)
+template <auto F, typename... Args>
+Event CreateEvent(double timestamp, Args&&... args) {
+    constexpr auto handler = HandlerBinding<F>::handler;
+    return makeEvent(timestamp, handler, undoOf<handler>(), std::forward<Args>(args)...);
+}
+
+// CreateEvent for a handler only known at runtime; the undo handler comes from the registry
+template <typename FuncType, typename... Args>
+Event CreateEvent(double timestamp, FuncType func, Args&&... args) {
+    auto undoFunc = reinterpret_cast<FuncType>(findUndoHandler(reinterpret_cast<void*>(func)));
+    return makeEvent(timestamp, func, undoFunc, std::forward<Args>(args)...);
+}
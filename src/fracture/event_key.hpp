@@ -0,0 +1,85 @@
+#pragma once
+
+#include <bit>
+#include <cmath>
+#include <cstdint>
+
+// Simulated time inside event keys: a double by default, or fixed point with
+// FRACTURE_TIME_TICKS ticks per time unit. Fixed-point timestamps are rounded to
+// the nearest tick when an event is created, so models whose delays are exact
+// multiples of a tick see exact, platform-independent time arithmetic.
+#ifndef FRACTURE_TIME_TICKS
+#define FRACTURE_TIME_TICKS 0
+#endif
+
+using LpId = std::uint32_t;
+
+// Total order on events: timestamp, then priority (lower first), then the LP that
+// scheduled the event, then that LP's scheduling counter. The fields are packed
+// into two words that compare as one unsigned 128-bit integer, so ordering two
+// events needs no floating-point compare and no tie-breaking branches, and equal
+// timestamps come out in the same order for every pending-event set, thread count
+// and execution mode.
+//
+//   time:  the timestamp mapped to an order-preserving unsigned integer
+//   tie:   priority (8 bits) | source LP (24 bits) | sequence number (32 bits)
+struct EventKey {
+    static constexpr unsigned kPriorityShift = 56;
+    static constexpr unsigned kSourceShift = 32;
+    static constexpr std::uint64_t kMaxSources = 1ULL << (kPriorityShift - kSourceShift);
+    static constexpr std::uint64_t kTicks = FRACTURE_TIME_TICKS;
+
+    std::uint64_t tie = 0;
+    std::uint64_t time = 0;
+
+    static std::uint64_t encodeTime(double timestamp) {
+        if constexpr (kTicks != 0) {
+            // Offset binary: the sign bit flipped makes signed ticks compare unsigned
+            double ticks = timestamp * static_cast<double>(kTicks);
+            if (!(ticks >= -0x1p63))
+                return 0;
+            if (!(ticks < 0x1p63))
+                return ~0ULL;
+            return static_cast<std::uint64_t>(static_cast<std::int64_t>(std::llround(ticks))) ^ (1ULL << 63);
+        } else {
+            // IEEE order: flip every bit of negatives, only the sign bit of positives.
+            // Adding 0.0 folds -0.0 into +0.0.
+            std::uint64_t bits = std::bit_cast<std::uint64_t>(timestamp + 0.0);
+            return bits ^ (static_cast<std::uint64_t>(static_cast<std::int64_t>(bits) >> 63) | (1ULL << 63));
+        }
+    }
+
+    static double decodeTime(std::uint64_t time) {
+        if constexpr (kTicks != 0) {
+            // The clamped ends stand for the infinities
+            if (time == 0 || time == ~0ULL)
+                return time ? HUGE_VAL : -HUGE_VAL;
+            return static_cast<double>(static_cast<std::int64_t>(time ^ (1ULL << 63))) / static_cast<double>(kTicks);
+        } else {
+            std::uint64_t bits = time ^ ((time >> 63) ? 1ULL << 63 : ~0ULL);
+            return std::bit_cast<double>(bits);
+        }
+    }
+
+    double timestamp() const { return decodeTime(time); }
+    std::uint8_t priority() const { return static_cast<std::uint8_t>(tie >> kPriorityShift); }
+    LpId source() const { return static_cast<LpId>((tie >> kSourceShift) & (kMaxSources - 1)); }
+    std::uint32_t sequence() const { return static_cast<std::uint32_t>(tie); }
+
+    void setTimestamp(double timestamp) { time = encodeTime(timestamp); }
+
+    void setPriority(std::uint8_t priority) {
+        tie = (tie & ~(0xffULL << kPriorityShift)) | static_cast<std::uint64_t>(priority) << kPriorityShift;
+    }
+
+    // Stamp the scheduling LP and its counter; the priority is kept
+    void setOrigin(LpId source, std::uint32_t sequence) {
+        tie = (tie & (0xffULL << kPriorityShift)) |
+              (static_cast<std::uint64_t>(source) & (kMaxSources - 1)) << kSourceShift | sequence;
+    }
+
+    unsigned __int128 packed() const { return static_cast<unsigned __int128>(time) << 64 | tie; }
+
+    bool operator<(const EventKey& other) const { return packed() < other.packed(); }
+    bool operator==(const EventKey& other) const { return time == other.time && tie == other.tie; }
+};
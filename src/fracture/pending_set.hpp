@@ -0,0 +1,298 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <queue>
+#include <vector>
+#include "event.hpp"
+
+// Pending-event sets for the Simulator. Every implementation exposes the same
+// interface so it can be passed as the Simulator's PendingSet policy:
+//
+//   bool empty() const;
+//   std::size_t size() const;
+//   void push(const Event& event);
+//   const Event& top();     // earliest pending event
+//   void pop();             // remove the earliest pending event
+
+// Orders events by key (see event_key.hpp); keys are unique once the kernel has
+// stamped them, so every set pops events in exactly the same order
+struct EventCompare {
+    bool operator()(const Event& lhs, const Event& rhs) const {
+        return rhs.key < lhs.key;
+    }
+};
+
+// Binary heap over a contiguous vector: O(log n) push and pop
+class BinaryHeap {
+    std::priority_queue<Event, std::vector<Event>, EventCompare> heap;
+
+public:
+    bool empty() const { return heap.empty(); }
+    std::size_t size() const { return heap.size(); }
+    void push(const Event& event) { heap.push(event); }
+    const Event& top() { return heap.top(); }
+    void pop() { heap.pop(); }
+};
+
+// Pairing heap: O(1) push, amortized O(log n) pop. Nodes live in index-linked
+// arrays with a free list, so there is no per-event allocation once warmed up,
+// and keys are kept apart from the events so the merges stay in cache.
+class PairingHeap {
+    static constexpr std::uint32_t kNil = UINT32_MAX;
+
+    std::vector<Event> events;
+    std::vector<EventKey> keys;
+    std::vector<std::uint32_t> child;
+    std::vector<std::uint32_t> sibling;
+    std::vector<std::uint32_t> freeNodes;
+    std::vector<std::uint32_t> scratch;
+    std::uint32_t root = kNil;
+    std::size_t count = 0;
+
+    std::uint32_t allocateNode(const Event& event) {
+        std::uint32_t node;
+        if (!freeNodes.empty()) {
+            node = freeNodes.back();
+            freeNodes.pop_back();
+            events[node] = event;
+            keys[node] = event.key;
+        } else {
+            node = static_cast<std::uint32_t>(events.size());
+            events.push_back(event);
+            keys.push_back(event.key);
+            child.push_back(kNil);
+            sibling.push_back(kNil);
+        }
+        child[node] = kNil;
+        sibling[node] = kNil;
+        return node;
+    }
+
+    // Link two roots; the later one becomes the first child of the earlier one
+    std::uint32_t meld(std::uint32_t a, std::uint32_t b) {
+        if (a == kNil)
+            return b;
+        if (b == kNil)
+            return a;
+        if (keys[b] < keys[a])
+            std::swap(a, b);
+        sibling[b] = child[a];
+        child[a] = b;
+        return a;
+    }
+
+public:
+    bool empty() const { return count == 0; }
+    std::size_t size() const { return count; }
+
+    void push(const Event& event) {
+        root = meld(root, allocateNode(event));
+        ++count;
+    }
+
+    const Event& top() { return events[root]; }
+
+    void pop() {
+        std::uint32_t oldRoot = root;
+
+        // Two-pass merge: pair up the children left to right, then fold right to left
+        scratch.clear();
+        for (std::uint32_t c = child[oldRoot]; c != kNil;) {
+            std::uint32_t a = c;
+            std::uint32_t b = sibling[a];
+            c = b == kNil ? kNil : sibling[b];
+            sibling[a] = kNil;
+            if (b != kNil)
+                sibling[b] = kNil;
+            scratch.push_back(meld(a, b));
+        }
+
+        root = kNil;
+        for (auto it = scratch.rbegin(); it != scratch.rend(); ++it)
+            root = meld(*it, root);
+
+        freeNodes.push_back(oldRoot);
+        --count;
+    }
+};
+
+// Calendar queue (R. Brown, CACM 1988): an array of day buckets, each holding the
+// events of one `width`-wide slice of time in key order, earliest at the head.
+// The bucket count doubles or halves with the population and the width is
+// re-estimated from the spacing of the earliest events, which gives amortized O(1)
+// push and pop for the stationary distributions DES models produce. Ties are
+// scheduled with increasing keys, so they append at the back in O(1).
+class CalendarQueue {
+    static constexpr std::size_t kMinBuckets = 2;
+    static constexpr std::size_t kWidthSamples = 25;
+    static constexpr std::size_t kMinCompact = 32;
+    // Days from here on, infinity included, all fall on this one
+    static constexpr double kLastDay = 0x1p63;
+
+    // Popped events stay before `head` until they are half the bucket
+    struct Bucket {
+        std::vector<Event> events;
+        std::size_t head = 0;
+
+        bool empty() const { return head == events.size(); }
+        const Event& front() const { return events[head]; }
+    };
+
+    std::vector<Bucket> buckets = std::vector<Bucket>(kMinBuckets);
+    double width = 1.0;
+    std::size_t mask = kMinBuckets - 1;
+    std::uint64_t currentDay = 0;   // virtual bucket the dequeue scan resumes from
+    std::size_t count = 0;
+    std::size_t topBucket = SIZE_MAX;
+
+    std::uint64_t dayOf(double timestamp) const {
+        double day = timestamp / width;
+        if (!(day > 0.0))
+            return 0;
+        return static_cast<std::uint64_t>(std::min(day, kLastDay));
+    }
+
+    static void insertSorted(Bucket& bucket, const Event& event) {
+        std::vector<Event>& events = bucket.events;
+        if (bucket.empty()) {
+            events.clear();
+            bucket.head = 0;
+            events.push_back(event);
+        } else if (!(event.key < events.back().key)) {
+            events.push_back(event);
+        } else if (bucket.head > 0 && event.key < bucket.front().key) {
+            events[--bucket.head] = event;
+        } else {
+            auto pos = std::upper_bound(events.begin() + static_cast<std::ptrdiff_t>(bucket.head), events.end(), event,
+                [](const Event& lhs, const Event& rhs) { return lhs.key < rhs.key; });
+            events.insert(pos, event);
+        }
+    }
+
+    static void popFront(Bucket& bucket) {
+        if (++bucket.head == bucket.events.size()) {
+            bucket.events.clear();
+            bucket.head = 0;
+        } else if (bucket.head >= kMinCompact && 2 * bucket.head >= bucket.events.size()) {
+            bucket.events.erase(bucket.events.begin(), bucket.events.begin() + static_cast<std::ptrdiff_t>(bucket.head));
+            bucket.head = 0;
+        }
+    }
+
+    // Locate the bucket holding the earliest event
+    std::size_t findTop() {
+        std::uint64_t day = currentDay;
+        for (std::size_t n = 0; n <= mask; ++n, ++day) {
+            const Bucket& bucket = buckets[day & mask];
+            if (!bucket.empty() && dayOf(bucket.front().timestamp()) <= day) {
+                currentDay = day;
+                return day & mask;
+            }
+        }
+
+        // Nothing within a year of the cursor: direct search over the bucket minima
+        std::size_t best = SIZE_MAX;
+        for (std::size_t i = 0; i <= mask; ++i) {
+            if (!buckets[i].empty() &&
+                (best == SIZE_MAX || buckets[i].front().key < buckets[best].front().key))
+                best = i;
+        }
+        currentDay = dayOf(buckets[best].front().timestamp());
+        return best;
+    }
+
+    // Estimate a bucket width of ~3x the average gap between the earliest events
+    double estimateWidth(const std::vector<Event>& all) const {
+        std::size_t samples = std::min(all.size(), kWidthSamples);
+        if (samples < 2)
+            return width;
+
+        std::vector<double> times;
+        times.reserve(all.size());
+        for (const Event& e : all)
+            times.push_back(e.timestamp());
+        std::partial_sort(times.begin(), times.begin() + samples, times.end());
+
+        double average = (times[samples - 1] - times[0]) / (samples - 1);
+        double total = 0.0;
+        std::size_t gaps = 0;
+        for (std::size_t i = 1; i < samples; ++i) {
+            double gap = times[i] - times[i - 1];
+            if (gap <= 2.0 * average) {
+                total += gap;
+                ++gaps;
+            }
+        }
+
+        double estimate = gaps ? 3.0 * total / gaps : 0.0;
+        if (estimate > 0.0 && std::isfinite(estimate))
+            return estimate;
+
+        // The earliest events share a timestamp: size buckets from the spread of
+        // the whole population instead, so each timestamp gets its own bucket and
+        // its ties append in O(1) rather than landing among later timestamps
+        double latest = times[0];
+        for (double time : times) {
+            if (std::isfinite(time))
+                latest = std::max(latest, time);
+        }
+        estimate = 3.0 * (latest - times[0]) / (times.size() - 1);
+        return estimate > 0.0 && std::isfinite(estimate) ? estimate : width;
+    }
+
+    void resize(std::size_t bucketCount) {
+        std::vector<Event> all;
+        all.reserve(count);
+        for (const Bucket& bucket : buckets)
+            all.insert(all.end(), bucket.events.begin() + static_cast<std::ptrdiff_t>(bucket.head), bucket.events.end());
+
+        width = estimateWidth(all);
+        buckets.assign(bucketCount, {});
+        mask = bucketCount - 1;
+        topBucket = SIZE_MAX;
+
+        double earliest = all.empty() ? 0.0 : all.front().timestamp();
+        for (const Event& e : all) {
+            earliest = std::min(earliest, e.timestamp());
+            insertSorted(buckets[dayOf(e.timestamp()) & mask], e);
+        }
+        currentDay = dayOf(earliest);
+    }
+
+public:
+    bool empty() const { return count == 0; }
+    std::size_t size() const { return count; }
+
+    void push(const Event& event) {
+        std::uint64_t day = dayOf(event.timestamp());
+        insertSorted(buckets[day & mask], event);
+        ++count;
+
+        // An event earlier than the scan cursor moves the cursor back
+        if (day < currentDay)
+            currentDay = day;
+        topBucket = SIZE_MAX;
+
+        if (count > 2 * buckets.size())
+            resize(2 * buckets.size());
+    }
+
+    const Event& top() {
+        if (topBucket == SIZE_MAX)
+            topBucket = findTop();
+        return buckets[topBucket].front();
+    }
+
+    void pop() {
+        if (topBucket == SIZE_MAX)
+            topBucket = findTop();
+        popFront(buckets[topBucket]);
+        topBucket = SIZE_MAX;
+        --count;
+
+        if (buckets.size() > kMinBuckets && count < buckets.size() / 2)
+            resize(buckets.size() / 2);
+    }
+};
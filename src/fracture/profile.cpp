@@ -0,0 +1,205 @@
+#include "profile.hpp"
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+std::atomic<bool> profileSampling{false};
+
+namespace {
+    // One per thread, padded so no two threads' hot counters share a line.
+    // Profiles outlive their threads, so a report after a run still sees every
+    // worker, and are handed to the next new thread once released.
+    struct alignas(64) ThreadProfile {
+        ProfileCounters total;
+        std::vector<ProfileCounters> lps;
+        std::unordered_map<HandlerPtr, ProfileCounters> handlers;
+        HandlerPtr lastHandler = nullptr;          // the events of one handler tend to come in runs
+        ProfileCounters* lastCounters = nullptr;
+        std::atomic<bool> owned{true};
+
+        void clear() {
+            total = ProfileCounters{};
+            lps.clear();
+            handlers.clear();
+            lastHandler = nullptr;
+            lastCounters = nullptr;
+        }
+    };
+
+    struct ProfileRegistry {
+        std::mutex lock;
+        std::vector<std::unique_ptr<ThreadProfile>> profiles;
+
+        ThreadProfile* registerThread() {
+            std::lock_guard<std::mutex> guard(lock);
+            for (const auto& profile : profiles) {
+                bool released = false;
+                if (profile->owned.compare_exchange_strong(released, true, std::memory_order_acquire))
+                    return profile.get();
+            }
+            profiles.push_back(std::make_unique<ThreadProfile>());
+            return profiles.back().get();
+        }
+    };
+
+    ProfileRegistry& profileRegistry() {
+        static ProfileRegistry registry;
+        return registry;
+    }
+
+    // Releases the thread's profile when the thread exits
+    struct ProfileLease {
+        ThreadProfile* profile = nullptr;
+
+        ~ProfileLease() {
+            if (profile)
+                profile->owned.store(false, std::memory_order_release);
+        }
+    };
+
+    thread_local ProfileLease threadProfile;
+
+    void addSample(ProfileCounters& counters, ProfilePhase phase, std::uint64_t cycles, std::uint64_t logWords) {
+        ProfileCounter& counter = counters[phase];
+        ++counter.count;
+        counter.cycles += cycles;
+        counter.logWords += logWords;
+    }
+
+    std::uint64_t totalCycles(const ProfileCounters& counters) {
+        std::uint64_t cycles = 0;
+        for (const ProfileCounter& counter : counters.phases)
+            cycles += counter.cycles;
+        return cycles;
+    }
+
+    std::string handlerName(HandlerPtr forward) {
+        if (const char* name = findHandlerName(reinterpret_cast<void*>(forward)))
+            return name;
+        char address[2 * sizeof(void*) + 3];
+        std::snprintf(address, sizeof(address), "%p", reinterpret_cast<void*>(forward));
+        return address;
+    }
+}
+
+void ProfileCounters::add(const ProfileCounters& other) {
+    for (std::size_t i = 0; i < kProfilePhases; ++i) {
+        phases[i].count += other.phases[i].count;
+        phases[i].cycles += other.phases[i].cycles;
+        phases[i].logWords += other.phases[i].logWords;
+    }
+}
+
+void profileRecord(ProfilePhase phase, std::uint64_t cycles, LpId lp, HandlerPtr handler, std::uint64_t logWords) {
+    ThreadProfile* profile = threadProfile.profile;
+    if (!profile)
+        profile = threadProfile.profile = profileRegistry().registerThread();
+
+    addSample(profile->total, phase, cycles, logWords);
+    if (lp != kProfileNoLp) {
+        if (lp >= profile->lps.size())
+            profile->lps.resize(static_cast<std::size_t>(lp) + 1);
+        addSample(profile->lps[lp], phase, cycles, logWords);
+    }
+    if (handler) {
+        if (handler != profile->lastHandler) {
+            profile->lastCounters = &profile->handlers[handler];
+            profile->lastHandler = handler;
+        }
+        addSample(*profile->lastCounters, phase, cycles, logWords);
+    }
+}
+
+void profileStart() {
+    profileSampling.store(true, std::memory_order_relaxed);
+}
+
+void profileStop() {
+    profileSampling.store(false, std::memory_order_relaxed);
+}
+
+void profileReset() {
+    ProfileRegistry& registry = profileRegistry();
+    std::lock_guard<std::mutex> guard(registry.lock);
+    for (const auto& profile : registry.profiles)
+        profile->clear();
+}
+
+ProfileReport profileReport() {
+    ProfileRegistry& registry = profileRegistry();
+    std::lock_guard<std::mutex> guard(registry.lock);
+
+    ProfileReport report;
+    std::unordered_map<HandlerPtr, std::size_t> handlerIndex;
+    for (const auto& profile : registry.profiles) {
+        report.total.add(profile->total);
+        report.threads.push_back(profile->total);
+
+        if (profile->lps.size() > report.lps.size())
+            report.lps.resize(profile->lps.size());
+        for (std::size_t lp = 0; lp < profile->lps.size(); ++lp)
+            report.lps[lp].add(profile->lps[lp]);
+
+        for (const auto& [forward, counters] : profile->handlers) {
+            auto [it, inserted] = handlerIndex.emplace(forward, report.handlers.size());
+            if (inserted)
+                report.handlers.push_back({forward, handlerName(forward), {}});
+            report.handlers[it->second].counters.add(counters);
+        }
+    }
+
+    std::sort(report.handlers.begin(), report.handlers.end(), [](const ProfileHandler& lhs, const ProfileHandler& rhs) {
+        return totalCycles(lhs.counters) > totalCycles(rhs.counters);
+    });
+    return report;
+}
+
+void profileDump(std::FILE* out, std::size_t topLps) {
+    ProfileReport report = profileReport();
+    std::uint64_t cycles = totalCycles(report.total);
+
+    std::fprintf(out, "%-10s %14s %16s %12s %8s\n", "phase", "count", "cycles", "cycles/op", "share");
+    for (std::size_t i = 0; i < kProfilePhases; ++i) {
+        const ProfileCounter& counter = report.total.phases[i];
+        std::fprintf(out, "%-10s %14llu %16llu %12.1f %7.1f%%\n", kProfilePhaseNames[i],
+                     static_cast<unsigned long long>(counter.count), static_cast<unsigned long long>(counter.cycles),
+                     counter.count ? static_cast<double>(counter.cycles) / counter.count : 0.0,
+                     cycles ? 100.0 * counter.cycles / cycles : 0.0);
+    }
+
+    std::vector<std::size_t> lps;
+    for (std::size_t lp = 0; lp < report.lps.size(); ++lp)
+        if (totalCycles(report.lps[lp]) != 0)
+            lps.push_back(lp);
+    std::size_t shown = std::min(topLps, lps.size());
+    std::partial_sort(lps.begin(), lps.begin() + shown, lps.end(), [&](std::size_t lhs, std::size_t rhs) {
+        return totalCycles(report.lps[lhs]) > totalCycles(report.lps[rhs]);
+    });
+    if (shown) {
+        std::fprintf(out, "\n%-10s %14s %14s %16s\n", "lp", "forward", "reverse", "cycles");
+        for (std::size_t i = 0; i < shown; ++i) {
+            const ProfileCounters& counters = report.lps[lps[i]];
+            std::fprintf(out, "%-10zu %14llu %14llu %16llu\n", lps[i],
+                         static_cast<unsigned long long>(counters[ProfilePhase::Forward].count),
+                         static_cast<unsigned long long>(counters[ProfilePhase::Reverse].count),
+                         static_cast<unsigned long long>(totalCycles(counters)));
+        }
+    }
+
+    if (!report.handlers.empty()) {
+        std::fprintf(out, "\n%14s %12s %14s %12s %12s  %s\n", "forward", "cycles/op", "reverse", "cycles/op",
+                     "saved/op", "handler");
+        for (const ProfileHandler& handler : report.handlers) {
+            const ProfileCounter& forward = handler.counters[ProfilePhase::Forward];
+            const ProfileCounter& reverse = handler.counters[ProfilePhase::Reverse];
+            std::fprintf(out, "%14llu %12.1f %14llu %12.1f %12.2f  %s\n", static_cast<unsigned long long>(forward.count),
+                         forward.count ? static_cast<double>(forward.cycles) / forward.count : 0.0,
+                         static_cast<unsigned long long>(reverse.count),
+                         reverse.count ? static_cast<double>(reverse.cycles) / reverse.count : 0.0,
+                         forward.count ? static_cast<double>(forward.logWords) / forward.count : 0.0,
+                         handler.name.c_str());
+        }
+    }
+}
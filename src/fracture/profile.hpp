@@ -0,0 +1,119 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "event.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+
+// Hot-path profiling. With FRACTURE_PROFILE=1 every engine phase is bracketed
+// by profileBegin()/profileEnd(); with the default 0 both are empty and compile
+// away. Compiled-in probes cost one relaxed load and a branch until sampling is
+// switched on with profileStart(), so profiled builds can stay in production.
+//
+// While sampling, each phase adds its count and elapsed cycles (rdtsc) to
+// counters owned by the calling thread, aggregated three ways: per thread, per
+// LP and per handler. Handlers are named from the undo registry the
+// reverse-pass emits. Query with profileReport() or print with profileDump()
+// once the threads that recorded have finished their run.
+
+#ifndef FRACTURE_PROFILE
+#define FRACTURE_PROFILE 0
+#endif
+
+enum class ProfilePhase : std::uint8_t {
+    Enqueue,     // inserting into a pending-event set
+    Dequeue,     // finding and removing the next event
+    Forward,     // forward handler, including the state it saves
+    Reverse,     // undo handler
+    Commit,      // fossil collection
+    Gvt,         // GVT rounds and conservative window barriers
+    Count
+};
+
+inline constexpr std::size_t kProfilePhases = static_cast<std::size_t>(ProfilePhase::Count);
+inline constexpr const char* kProfilePhaseNames[] = {"enqueue", "dequeue", "forward", "reverse", "commit", "gvt"};
+static_assert(sizeof(kProfilePhaseNames) / sizeof(kProfilePhaseNames[0]) == kProfilePhases);
+
+// Probes without an LP (the sequential kernel) or without a handler
+inline constexpr LpId kProfileNoLp = ~LpId{0};
+
+struct ProfileCounter {
+    std::uint64_t count = 0;
+    std::uint64_t cycles = 0;
+    std::uint64_t logWords = 0;   // forward: reverse log words saved; reverse: words restored
+};
+
+struct ProfileCounters {
+    ProfileCounter phases[kProfilePhases];
+
+    ProfileCounter& operator[](ProfilePhase phase) { return phases[static_cast<std::size_t>(phase)]; }
+    const ProfileCounter& operator[](ProfilePhase phase) const { return phases[static_cast<std::size_t>(phase)]; }
+    void add(const ProfileCounters& other);
+};
+
+struct ProfileHandler {
+    HandlerPtr forward;
+    std::string name;            // demangled forward handler, or its address when unregistered
+    ProfileCounters counters;
+};
+
+struct ProfileReport {
+    ProfileCounters total;
+    std::vector<ProfileCounters> threads;     // in order of each thread's first probe
+    std::vector<ProfileCounters> lps;         // by LP id; LPs never probed stay zero
+    std::vector<ProfileHandler> handlers;     // by total cycles, highest first
+};
+
+extern std::atomic<bool> profileSampling;
+
+// Sampling switch; counters are kept until profileReset()
+void profileStart();
+void profileStop();
+
+// Threads write their counters without a lock, so only call this while none
+// is sampling: after profileStop() and once the threads that were recording
+// have finished (a kernel's run() has returned). It is not a way to restart
+// the counters in the middle of a run.
+void profileReset();
+
+// Exact under the same condition; read during a run it may miss probes in flight
+ProfileReport profileReport();
+
+// Per-phase, top-LP and per-handler tables
+void profileDump(std::FILE* out = stderr, std::size_t topLps = 10);
+
+__attribute__((noinline)) void profileRecord(ProfilePhase phase, std::uint64_t cycles, LpId lp, HandlerPtr handler,
+                                             std::uint64_t logWords);
+
+inline std::uint64_t profileCycles() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return static_cast<std::uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+}
+
+// Start of a probe: zero when profiling is compiled out or not sampling
+inline std::uint64_t profileBegin() {
+    if constexpr (FRACTURE_PROFILE != 0) {
+        if (profileSampling.load(std::memory_order_relaxed))
+            return profileCycles();
+    }
+    return 0;
+}
+
+inline void profileEnd(ProfilePhase phase, std::uint64_t start, LpId lp = kProfileNoLp, HandlerPtr handler = nullptr,
+                       std::uint64_t logWords = 0) {
+    if constexpr (FRACTURE_PROFILE != 0) {
+        if (start)
+            profileRecord(phase, profileCycles() - start, lp, handler, logWords);
+    }
+}
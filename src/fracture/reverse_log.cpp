@@ -0,0 +1,34 @@
+#include "reverse_log.hpp"
+
+thread_local ReverseLog* activeReverseLog = nullptr;
+
+ReverseLog& defaultReverseLog() {
+    thread_local ReverseLog log;
+    return log;
+}
+
+extern "C" void __fracture_path_push(std::uint64_t value, std::uint32_t bits) {
+    currentReverseLog().pushBits(value, bits);
+}
+
+extern "C" std::uint64_t __fracture_path_pop(std::uint32_t bits) {
+    return currentReverseLog().popBits(bits);
+}
+
+extern "C" void __fracture_log_push(std::uint64_t value) {
+    currentReverseLog().push(value);
+}
+
+extern "C" std::uint64_t __fracture_log_pop() {
+    return currentReverseLog().pop();
+}
+
+extern "C" std::uint64_t __fracture_event_end() {
+    ReverseLog& log = currentReverseLog();
+    log.endForward();
+    return log.position();
+}
+
+extern "C" void __fracture_event_rewind(std::uint64_t end) {
+    currentReverseLog().truncate(end);
+}
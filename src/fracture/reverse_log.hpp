@@ -0,0 +1,162 @@
+#pragma once
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Reverse log: what a generated undo handler cannot recompute from the state it
+// is given. Forward handlers instrumented by the reverse-pass push
+//  - path bits: which predecessor each merge point was entered from, packed
+//    into 64-bit words, and
+//  - whole words: loop trip counts and values overwritten by destructive
+//    operations,
+// and the matching undo handler pops them in reverse order.
+//
+// A log is strictly LIFO per owner: the thread's default log, a Simulator, or a
+// single Time Warp LP. Owners remember log positions per event so a rollback can
+// truncate to an event's start and fossil collection can release committed
+// prefixes in bulk.
+class ReverseLog {
+    std::vector<std::uint64_t> words;
+    std::size_t head = 0;          // first live word; everything before it is released
+    std::uint64_t offset = 0;      // absolute position of words[0]
+
+    // Bits are shifted in below a sentinel 1, so a word's fill level is implicit
+    std::uint64_t pathWord = 1;    // forward: bits not yet flushed
+    std::uint64_t readWord = 1;    // undo: bits not yet consumed
+
+    static constexpr unsigned used(std::uint64_t word) {
+        return 63 - std::countl_zero(word);
+    }
+
+    static constexpr std::uint64_t mask(unsigned bits) {
+        return bits >= 64 ? ~0ULL : (1ULL << bits) - 1;
+    }
+
+    void flushPath() {
+        if (pathWord != 1) {
+            words.push_back(pathWord);
+            pathWord = 1;
+        }
+    }
+
+    std::uint64_t popWord() {
+        std::uint64_t word = words.back();
+        words.pop_back();
+        return word;
+    }
+
+public:
+    // Absolute position of the end of the log
+    std::uint64_t position() const { return offset + words.size(); }
+    std::size_t liveWords() const { return words.size() - head; }
+
+    void push(std::uint64_t value) {
+        flushPath();
+        words.push_back(value);
+    }
+
+    std::uint64_t pop() { return popWord(); }
+
+    // Record the low `bits` bits of `value` (bits <= 32)
+    void pushBits(std::uint64_t value, unsigned bits) {
+        unsigned room = 63 - used(pathWord);
+        if (bits > room) {
+            // The top of the value completes this word, the rest starts the next one
+            unsigned rest = bits - room;
+            pathWord = (pathWord << room) | (value >> rest);
+            words.push_back(pathWord);
+            pathWord = 1;
+            value &= mask(rest);
+            bits = rest;
+        }
+        pathWord = (pathWord << bits) | value;
+    }
+
+    std::uint64_t popBits(unsigned bits) {
+        if (readWord == 1)
+            readWord = popWord();
+
+        unsigned available = used(readWord);
+        if (bits <= available) {
+            std::uint64_t value = readWord & mask(bits);
+            readWord >>= bits;
+            return value;
+        }
+
+        // Low part in this word, high part at the bottom of the previous one
+        std::uint64_t low = readWord & mask(available);
+        unsigned rest = bits - available;
+        readWord = popWord();
+        std::uint64_t high = readWord & mask(rest);
+        readWord >>= rest;
+        return (high << available) | low;
+    }
+
+    // Event boundaries: an event's records never share a word with the next event's
+    void endForward() { flushPath(); }
+    void beginUndo() { readWord = 1; }
+
+    // Drop everything after `pos`, e.g. whatever an undone event left behind
+    void truncate(std::uint64_t pos) {
+        if (pos < position())
+            words.resize(static_cast<std::size_t>(pos - offset));
+        readWord = 1;
+    }
+
+    // An event's records are whole words (see endForward), so they can be set
+    // aside and put back on top of the log, e.g. to undo an event below them
+    void copyFrom(std::uint64_t pos, std::vector<std::uint64_t>& out) const {
+        out.insert(out.end(), words.begin() + static_cast<std::ptrdiff_t>(pos - offset), words.end());
+    }
+
+    void append(const std::uint64_t* data, std::size_t count) {
+        flushPath();
+        words.insert(words.end(), data, data + count);
+    }
+
+    // Release everything before `pos`; storage is compacted once most of it is dead
+    void release(std::uint64_t pos) {
+        head = static_cast<std::size_t>(pos - offset);
+        if (head > 1024 && head * 2 > words.size()) {
+            words.erase(words.begin(), words.begin() + static_cast<std::ptrdiff_t>(head));
+            offset += head;
+            head = 0;
+        }
+    }
+};
+
+// The log instrumented handlers record into on this thread
+extern thread_local ReverseLog* activeReverseLog;
+ReverseLog& defaultReverseLog();
+
+inline ReverseLog& currentReverseLog() {
+    return activeReverseLog ? *activeReverseLog : defaultReverseLog();
+}
+
+// Makes `log` the active log for the lifetime of the scope
+class ReverseLogScope {
+    ReverseLog* saved;
+
+public:
+    explicit ReverseLogScope(ReverseLog& log) : saved(activeReverseLog) { activeReverseLog = &log; }
+    ~ReverseLogScope() { activeReverseLog = saved; }
+
+    ReverseLogScope(const ReverseLogScope&) = delete;
+    ReverseLogScope& operator=(const ReverseLogScope&) = delete;
+};
+
+// Entry points called by code the reverse-pass generates
+extern "C" {
+    void __fracture_path_push(std::uint64_t value, std::uint32_t bits);
+    std::uint64_t __fracture_path_pop(std::uint32_t bits);
+    void __fracture_log_push(std::uint64_t value);
+    std::uint64_t __fracture_log_pop();
+
+    // Event boundaries inside the batched variants of a handler: ends an
+    // event's records and returns the log position after them, and rewinds to
+    // such a position before an event is undone
+    std::uint64_t __fracture_event_end();
+    void __fracture_event_rewind(std::uint64_t end);
+}
@@ -0,0 +1,249 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+// Region allocation for the kernel's per-event bookkeeping. Histories, sent logs
+// and local message queues grow at the back and are consumed from the front in
+// timestamp order, so instead of a general-purpose heap they are built from
+// fixed-size segments carved out of large slabs. Each worker thread owns one
+// pool: segments are recycled through a free list without any synchronisation,
+// slabs are only returned to the system when the pool is destroyed, and a
+// committed prefix is handed back one whole segment at a time.
+
+struct SegmentPoolStats {
+    std::uint64_t slabs = 0;            // slabs obtained from the system allocator
+    std::uint64_t liveSegments = 0;     // segments currently held by queues
+    std::uint64_t peakSegments = 0;     // high-water mark of liveSegments
+    std::uint64_t acquired = 0;         // segment hand-outs, including recycled ones
+
+    std::uint64_t reservedBytes() const;
+    std::uint64_t peakBytes() const;
+};
+
+class SegmentPool {
+    struct FreeSegment {
+        FreeSegment* next;
+    };
+
+    std::vector<void*> slabs;
+    FreeSegment* freeList = nullptr;
+    SegmentPoolStats counters;
+
+    void refill() {
+        auto* slab = static_cast<unsigned char*>(
+            ::operator new(kSlabBytes, std::align_val_t{kSegmentAlignment}));
+        slabs.push_back(slab);
+        ++counters.slabs;
+        for (std::size_t i = kSegmentsPerSlab; i-- > 0;)
+            release(slab + i * kSegmentBytes, /*live=*/false);
+    }
+
+    void release(void* segment, bool live) {
+        auto* node = static_cast<FreeSegment*>(segment);
+        node->next = freeList;
+        freeList = node;
+        if (live)
+            --counters.liveSegments;
+    }
+
+public:
+    static constexpr std::size_t kSegmentBytes = 1024;
+    static constexpr std::size_t kSegmentAlignment = 64;
+    static constexpr std::size_t kSegmentsPerSlab = 256;
+    static constexpr std::size_t kSlabBytes = kSegmentBytes * kSegmentsPerSlab;
+
+    SegmentPool() = default;
+    SegmentPool(const SegmentPool&) = delete;
+    SegmentPool& operator=(const SegmentPool&) = delete;
+
+    ~SegmentPool() {
+        for (void* slab : slabs)
+            ::operator delete(slab, std::align_val_t{kSegmentAlignment});
+    }
+
+    void* acquire() {
+        if (!freeList)
+            refill();
+        FreeSegment* segment = freeList;
+        freeList = segment->next;
+        ++counters.acquired;
+        counters.peakSegments = std::max(counters.peakSegments, ++counters.liveSegments);
+        return segment;
+    }
+
+    void release(void* segment) { release(segment, /*live=*/true); }
+
+    const SegmentPoolStats& stats() const { return counters; }
+};
+
+inline std::uint64_t SegmentPoolStats::reservedBytes() const {
+    return slabs * SegmentPool::kSlabBytes;
+}
+
+inline std::uint64_t SegmentPoolStats::peakBytes() const {
+    return peakSegments * SegmentPool::kSegmentBytes;
+}
+
+// FIFO/LIFO queue of trivially copyable records stored in pool segments: push at
+// the back, pop at either end, and index from the front. Segments belong to the
+// pool, so a queue must not be used after its pool is gone; memory still held
+// by a queue when it is destroyed is reclaimed with the pool.
+template <typename T>
+class SegmentQueue {
+    static_assert(std::is_trivially_copyable_v<T>, "SegmentQueue stores records by memcpy");
+
+    struct Segment {
+        Segment* next;
+        Segment* prev;
+    };
+
+    static constexpr std::size_t kHeaderBytes =
+        (sizeof(Segment) + alignof(T) - 1) / alignof(T) * alignof(T);
+    static_assert(alignof(T) <= SegmentPool::kSegmentAlignment, "record alignment exceeds the segment alignment");
+
+public:
+    static constexpr std::size_t kCapacity = (SegmentPool::kSegmentBytes - kHeaderBytes) / sizeof(T);
+    static_assert(kCapacity > 0, "record does not fit in a segment");
+
+    SegmentQueue() = default;
+    SegmentQueue(const SegmentQueue&) = delete;
+    SegmentQueue& operator=(const SegmentQueue&) = delete;
+
+    void attach(SegmentPool& owner) { pool = &owner; }
+
+    bool empty() const { return count == 0; }
+    std::size_t size() const { return count; }
+
+    T& front() { return items(head)[headIndex]; }
+    const T& front() const { return items(head)[headIndex]; }
+    T& back() { return items(tail)[tailIndex - 1]; }
+    const T& back() const { return items(tail)[tailIndex - 1]; }
+
+    T& operator[](std::size_t i) {
+        // Callers mostly look near the back (recent records), so walk from the closer end
+        if (i >= count / 2) {
+            std::size_t fromBack = count - 1 - i;
+            Segment* segment = tail;
+            std::size_t index = tailIndex;
+            while (fromBack >= index) {
+                fromBack -= index;
+                segment = segment->prev;
+                index = kCapacity;
+            }
+            return items(segment)[index - 1 - fromBack];
+        }
+
+        std::size_t position = headIndex + i;
+        Segment* segment = head;
+        while (position >= kCapacity) {
+            position -= kCapacity;
+            segment = segment->next;
+        }
+        return items(segment)[position];
+    }
+
+    void push_back(const T& value) {
+        if (!tail || tailIndex == kCapacity)
+            grow();
+        items(tail)[tailIndex++] = value;
+        ++count;
+    }
+
+    // Bulk push_back: copies whole runs into each segment
+    void append(const T* values, std::size_t n) {
+        while (n > 0) {
+            if (!tail || tailIndex == kCapacity)
+                grow();
+            std::size_t run = std::min(n, kCapacity - tailIndex);
+            std::memcpy(static_cast<void*>(items(tail) + tailIndex), values, run * sizeof(T));
+            tailIndex += run;
+            count += run;
+            values += run;
+            n -= run;
+        }
+    }
+
+    void pop_back() {
+        --tailIndex;
+        if (--count == 0) {
+            clear();
+        } else if (tailIndex == 0) {
+            Segment* segment = tail;
+            tail = segment->prev;
+            tail->next = nullptr;
+            pool->release(segment);
+            tailIndex = kCapacity;
+        }
+    }
+
+    void pop_front() { pop_front(1); }
+
+    // Drop the `n` oldest records, returning every segment they emptied to the pool
+    void pop_front(std::size_t n) {
+        if (n == 0)
+            return;
+        count -= n;
+        if (count == 0) {
+            clear();
+            return;
+        }
+        headIndex += n;
+        while (headIndex >= kCapacity) {
+            Segment* segment = head;
+            head = segment->next;
+            head->prev = nullptr;
+            pool->release(segment);
+            headIndex -= kCapacity;
+        }
+    }
+
+    // Keep only the `n` oldest records
+    void truncate(std::size_t n) {
+        while (count > n)
+            pop_back();
+    }
+
+    void clear() {
+        while (head) {
+            Segment* next = head->next;
+            pool->release(head);
+            head = next;
+        }
+        tail = nullptr;
+        headIndex = tailIndex = count = 0;
+    }
+
+private:
+    static T* items(Segment* segment) {
+        return reinterpret_cast<T*>(reinterpret_cast<unsigned char*>(segment) + kHeaderBytes);
+    }
+
+    static const T* items(const Segment* segment) {
+        return reinterpret_cast<const T*>(reinterpret_cast<const unsigned char*>(segment) + kHeaderBytes);
+    }
+
+    void grow() {
+        auto* segment = static_cast<Segment*>(pool->acquire());
+        segment->next = nullptr;
+        segment->prev = tail;
+        if (tail)
+            tail->next = segment;
+        else
+            head = segment;
+        tail = segment;
+        tailIndex = 0;
+    }
+
+    SegmentPool* pool = nullptr;
+    Segment* head = nullptr;
+    Segment* tail = nullptr;
+    std::size_t headIndex = 0;      // first live record in head
+    std::size_t tailIndex = 0;      // one past the last live record in tail
+    std::size_t count = 0;
+};
@@ -1,78 +1,277 @@
 #include "simulator.hpp"
 
-#include <iostream>
-#include <cstring>
-#include <dlfcn.h>  // For dynamic loading
-/*
-void* Simulator::loadReverseHandler(const char* handlerName, const char* libPath) {
-    // Load the shared library
-    void *handle = dlopen(libPath, RTLD_NOW);
-    if (!handle) {
-        std::cerr << "Error: Could not load library: " << dlerror() << std::endl;
-        return nullptr;
-    }
-
-    // Construct the reverse handler name by prefixing "__undo_"
-    std::string reverseHandlerName = std::string("__undo_") + handlerName;
+#include <algorithm>
+#include <cstdio>
+#include <limits>
+#include "profile.hpp"
+#include "trace.hpp"
 
-    // Find the reverse handler function
-    void* reverseHandler = dlsym(handle, reverseHandlerName.c_str());
-    if (!reverseHandler) {
-        std::cerr << "Error: Could not find reverse handler for " << handlerName << ": " << dlerror() << std::endl;
+template <typename PendingSet>
+void Simulator<PendingSet>::scheduleEvent(const Event& event) {
+    // A model bug, so reported even without tracing: the first one, and every one in pastEventCount()
+    if (event.timestamp() < currentTime) {
+        if (pastEvents++ == 0)
+            std::fprintf(stderr, "Event at time %g is in the past (now %g), dropping it "
+                                 "(further ones are counted in Simulator::pastEventCount)\n",
+                         event.timestamp(), currentTime);
+        trace<TraceKind::PastEvent>(currentTime, event.forward);
+        return;
     }
 
-    return reverseHandler;
+    // The sequential kernel has no LPs: its scheduling counter fills both the
+    // source and sequence fields, so ties run in scheduling order
+    Event stamped = event;
+    stamped.key.setOrigin(static_cast<LpId>(nextSequence >> 32), static_cast<std::uint32_t>(nextSequence));
+    ++nextSequence;
+
+    trace<TraceKind::Schedule>(stamped.timestamp(), stamped.forward);
+    std::uint64_t probe = profileBegin();
+    eventQueue.push(stamped);
+    profileEnd(ProfilePhase::Enqueue, probe, kProfileNoLp, stamped.forward);
 }
 
-void* findGeneratedReverseHandler(const std::string& reverseFunctionName) {
-    std::string mangledName = "__undo_" + reverseFunctionName;
-    void *handler = dlsym(RTLD_DEFAULT, mangledName.c_str());
-    if (!handler) {
-        std::cerr << "Could not find reverse handler: " << mangledName << std::endl;
-    } else {
-        std::cout << "Reverse handler found: " << mangledName << std::endl;
+template <typename PendingSet>
+void Simulator<PendingSet>::run(double endTime) {
+    ReverseLogScope scope(reverseLog);
+    while (!eventQueue.empty() && eventQueue.top().timestamp() <= endTime) {
+        std::uint64_t probe = profileBegin();
+        Event event = eventQueue.top();
+        eventQueue.pop();
+        profileEnd(ProfilePhase::Dequeue, probe, kProfileNoLp, event.forward);
+
+        currentTime = event.timestamp();
+        std::uint64_t logStart = reverseLog.position();
+        trace<TraceKind::EventBegin>(currentTime, event.forward);
+        probe = profileBegin();
+        event.call(reverseLog);
+        profileEnd(ProfilePhase::Forward, probe, kProfileNoLp, event.forward, reverseLog.position() - logStart);
+        trace<TraceKind::EventEnd>(currentTime, event.forward);
+        executedEvents.push_back({event, logStart, currentTime});
     }
-    return handler;
 }
 
+// Stable counting sort of the batch by forward handler: a model has a handful of
+// handlers, so each event finds its group with a short scan and the batch is
+// regrouped in linear time, keeping every group in timestamp order
+template <typename PendingSet>
+void Simulator<PendingSet>::groupBatch() {
+    batchHandlers.clear();
+    groupStart.clear();
+    batchGroup.resize(batch.size());
+    for (std::size_t i = 0; i < batch.size(); ++i) {
+        HandlerPtr forward = batch[i].event.forward;
+        std::size_t group = 0;
+        while (group < batchHandlers.size() && batchHandlers[group] != forward)
+            ++group;
+        if (group == batchHandlers.size()) {
+            batchHandlers.push_back(forward);
+            groupStart.push_back(0);
+        }
+        ++groupStart[group];
+        batchGroup[i] = static_cast<std::uint32_t>(group);
+    }
+    if (batchHandlers.size() == 1)
+        return;
+
+    std::uint32_t offset = 0;
+    for (std::uint32_t& start : groupStart)
+        offset += std::exchange(start, offset);
 
-void Simulator::scheduleEvent(double timestamp, void (*handler)(void*), const std::string &reverseFunctionName, void *data) {
-    // Debugging: Print reverse function name
-    std::cout << "Scheduling event: " << reverseFunctionName << std::endl;
+    grouped.resize(batch.size());
+    for (std::size_t i = 0; i < batch.size(); ++i)
+        grouped[groupStart[batchGroup[i]]++] = batch[i];
+    batch.swap(grouped);
+}
 
-    // Find the reverse handler generated by the LLVM pass
-    auto reverseHandler = reinterpret_cast<void(*)(void*)>(findGeneratedReverseHandler(reverseFunctionName));
-    if (!reverseHandler) {
-        std::cerr << "Reverse handler not found!" << std::endl;
+// A run through its batched variant when the handler has one, otherwise one event at a time
+template <typename PendingSet>
+void Simulator<PendingSet>::executeRun(ExecutedEvent* run, std::size_t n, bool useBatchVariants) {
+    BatchRoute route = useBatchVariants && n > 1 ? findBatchRoute(run->event.forward, run->event.trampoline())
+                                                 : BatchRoute{};
+    if (!route) {
+        for (std::size_t i = 0; i < n; ++i) {
+            ExecutedEvent& executed = run[i];
+            currentTime = executed.event.timestamp();
+            executed.logStart = reverseLog.position();
+            trace<TraceKind::EventBegin>(currentTime, executed.event.forward);
+            std::uint64_t probe = profileBegin();
+            executed.event.call(reverseLog);
+            profileEnd(ProfilePhase::Forward, probe, kProfileNoLp, executed.event.forward,
+                       reverseLog.position() - executed.logStart);
+            trace<TraceKind::EventEnd>(currentTime, executed.event.forward);
+        }
         return;
     }
 
-    Event event = {timestamp, handler, reverseHandler, data};
-    eventQueue.push(event);
+    // A handler that records nothing leaves marks alone: every event then starts where the run did
+    std::uint64_t start = reverseLog.position();
+    batchMarks.assign(n, start);
+    currentTime = run->event.timestamp();
+    trace<TraceKind::EventBegin>(currentTime, run->event.forward);
+    std::uint64_t probe = profileBegin();
+    route.forward(&run->event, sizeof(ExecutedEvent), n, batchMarks.data());
+    profileEnd(ProfilePhase::Forward, probe, kProfileNoLp, run->event.forward, reverseLog.position() - start);
+    trace<TraceKind::EventEnd>(currentTime, run->event.forward);
+
+    run[0].logStart = start;
+    for (std::size_t i = 1; i < n; ++i)
+        run[i].logStart = batchMarks[i - 1];
 }
 
-void Simulator::run(double endTime) {
-    while (!eventQueue.empty() && eventQueue.top().timestamp <= endTime) {
-        Event event = eventQueue.top();
-        eventQueue.pop();
+template <typename PendingSet>
+std::size_t Simulator<PendingSet>::runBatched(double endTime, const BatchConfig& config) {
+    ReverseLogScope scope(reverseLog);
+    std::size_t batches = 0;
+
+    while (!eventQueue.empty() && eventQueue.top().timestamp() <= endTime) {
+        double limit = std::min(endTime, eventQueue.top().timestamp() + config.window);
+        batch.clear();
+        std::uint64_t probe = profileBegin();
+        do {
+            batch.push_back({eventQueue.top(), 0, 0.0});
+            eventQueue.pop();
+        } while (batch.size() < config.maxBatch && !eventQueue.empty() && eventQueue.top().timestamp() <= limit);
+        profileEnd(ProfilePhase::Dequeue, probe);
+
+        if (config.groupByHandler && batch.size() > 1)
+            groupBatch();
 
-        // Execute the forward event
-        std::cout << "Executing handler at time: " << event.timestamp << std::endl;
-        event.handler(event.data);
-        executedEvents.push(event);
+        // Runs of consecutive events with the same handler, argument types and
+        // timestamp, so now() is exact inside a batched variant call
+        double latest = currentTime;
+        for (std::size_t first = 0; first < batch.size();) {
+            const Event& head = batch[first].event;
+            std::size_t last = first + 1;
+            while (last < batch.size() && batch[last].event.forward == head.forward &&
+                   batch[last].event.trampoline() == head.trampoline() &&
+                   batch[last].event.timestamp() == head.timestamp())
+                ++last;
+            executeRun(&batch[first], last - first, config.useBatchVariants);
+            for (std::size_t i = first; i < last; ++i)
+                latest = std::max(latest, batch[i].event.timestamp());
+            first = last;
+        }
+        currentTime = latest;
+
+        // History stays in execution order, which grouping makes differ from
+        // timestamp order inside a batch; rollback finds the batch by its latest timestamp
+        for (ExecutedEvent& executed : batch)
+            executed.batchLatest = latest;
+        executedEvents.append(batch.data(), batch.size());
+        ++batches;
     }
+    return batches;
 }
 
-void Simulator::rollback(double rollbackTime) {
-    while (!executedEvents.empty() && executedEvents.top().timestamp > rollbackTime) {
-        Event event = executedEvents.top();
-        executedEvents.pop();
+// Grouping runs a batch out of timestamp order, so an event after the target
+// may have run before events at or before it. History is taken back to the
+// last batch that ended at or before the target; going through it newest
+// first, later events are undone, and the events that stay have their log
+// records set aside so the ones below can be undone. The kept events then go
+// back on top of history, their records on top of the log.
+template <typename PendingSet>
+void Simulator<PendingSet>::rollback(double rollbackTime) {
+    ReverseLogScope scope(reverseLog);
+    trace<TraceKind::Rollback>(rollbackTime);
 
-        // Execute the reverse event to undo the changes
-        if (event.reverseHandler) {
-            std::cout << "Executing reverse handler at time: " << event.timestamp << std::endl;
-            event.reverseHandler(event.data);
+    suffix.clear();
+    while (!executedEvents.empty() && executedEvents.back().batchLatest > rollbackTime) {
+        suffix.push_back(executedEvents.back());
+        executedEvents.pop_back();
+    }
+
+    kept.clear();
+    keptWords.clear();
+    for (std::size_t first = 0; first < suffix.size();) {
+        const ExecutedEvent& executed = suffix[first];
+        if (executed.event.timestamp() <= rollbackTime) {
+            std::size_t begin = keptWords.size();
+            reverseLog.copyFrom(executed.logStart, keptWords);
+            reverseLog.truncate(executed.logStart);
+            kept.push_back({executed, begin, keptWords.size()});
+            ++first;
+            continue;
         }
+
+        // A run of undone events with the same handler goes through the batched undo variant together
+        std::size_t last = first + 1;
+        while (last < suffix.size() && suffix[last].event.timestamp() > rollbackTime &&
+               suffix[last].event.forward == executed.event.forward &&
+               suffix[last].event.trampoline() == executed.event.trampoline())
+            ++last;
+        BatchRoute route = last - first > 1 ? findBatchRoute(executed.event.forward, executed.event.trampoline())
+                                            : BatchRoute{};
+        if (route) {
+            undoRun(&suffix[first], last - first, route);
+        } else {
+            for (std::size_t i = first; i < last; ++i)
+                undoEvent(suffix[i]);
+        }
+        first = last;
+    }
+
+    double keptLatest = -std::numeric_limits<double>::infinity();
+    for (const KeptEvent& event : kept)
+        keptLatest = std::max(keptLatest, event.executed.event.timestamp());
+    for (auto it = kept.rbegin(); it != kept.rend(); ++it) {
+        ExecutedEvent executed = it->executed;
+        executed.logStart = reverseLog.position();
+        executed.batchLatest = keptLatest;
+        reverseLog.append(keptWords.data() + it->wordsBegin, it->wordsEnd - it->wordsBegin);
+        executedEvents.push_back(executed);
+    }
+
+    currentTime = executedEvents.empty() ? std::min(currentTime, rollbackTime) : executedEvents.back().batchLatest;
+}
+
+template <typename PendingSet>
+void Simulator<PendingSet>::undoEvent(const ExecutedEvent& executed) {
+    trace<TraceKind::UndoBegin>(executed.event.timestamp(), executed.event.forward);
+    std::uint64_t logEnd = reverseLog.position();
+    std::uint64_t probe = profileBegin();
+    Event event = executed.event;
+    event.callUndo(reverseLog);
+    profileEnd(ProfilePhase::Reverse, probe, kProfileNoLp, event.forward, logEnd - executed.logStart);
+    trace<TraceKind::UndoEnd>(event.timestamp(), event.forward);
+    reverseLog.truncate(executed.logStart);
+}
+
+// Undoes a run of events with the same handler, given newest first, with one
+// call: the variant rewinds the log to the end of each event's records before undoing it
+template <typename PendingSet>
+void Simulator<PendingSet>::undoRun(const ExecutedEvent* newestFirst, std::size_t n, const BatchRoute& route) {
+    undone.assign(newestFirst, newestFirst + n);
+    std::reverse(undone.begin(), undone.end());
+    batchMarks.resize(n);
+    for (std::size_t i = 0; i + 1 < n; ++i)
+        batchMarks[i] = undone[i + 1].logStart;
+    batchMarks[n - 1] = reverseLog.position();
+
+    const Event& last = undone.back().event;
+    trace<TraceKind::UndoBegin>(last.timestamp(), last.forward);
+    std::uint64_t probe = profileBegin();
+    route.undo(&undone.front().event, sizeof(ExecutedEvent), n, batchMarks.data());
+    profileEnd(ProfilePhase::Reverse, probe, kProfileNoLp, last.forward, batchMarks[n - 1] - undone.front().logStart);
+    trace<TraceKind::UndoEnd>(undone.front().event.timestamp(), last.forward);
+    reverseLog.truncate(undone.front().logStart);
+}
+
+template <typename PendingSet>
+std::size_t Simulator<PendingSet>::fossilCollect(double horizon) {
+    // History is in execution order, so the collectable events form a prefix;
+    // an event a grouped batch ran ahead of earlier ones waits for a later call
+    std::uint64_t probe = profileBegin();
+    std::size_t collected = 0;
+    while (!executedEvents.empty() && executedEvents.front().event.timestamp() < horizon) {
+        executedEvents.pop_front();
+        ++collected;
     }
+    reverseLog.release(executedEvents.empty() ? reverseLog.position() : executedEvents.front().logStart);
+    profileEnd(ProfilePhase::Commit, probe);
+    trace<TraceKind::FossilCollect>(horizon, collected);
+    return collected;
 }
-*/
\ No newline at end of file
+
+template class Simulator<BinaryHeap>;
+template class Simulator<PairingHeap>;
+template class Simulator<CalendarQueue>;
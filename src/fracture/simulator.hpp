@@ -1,35 +1,110 @@
 #pragma once
 
-#include <queue>
-#include <stack>
-#include <string>
-#include <functional>
-
-struct Event {
-    double timestamp;
-    void (*handler)(void*);      // Forward event handler
-    void (*reverseHandler)(void*); // Reverse event handler
-    void *data;                  // Event-specific data
-};
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "event.hpp"
+#include "pending_set.hpp"
+#include "reverse_log.hpp"
+#include "segment_pool.hpp"
 
-// Comparator for Event based on timestamp
-struct EventCompare {
-    bool operator()(const Event& lhs, const Event& rhs) const {
-        return lhs.timestamp > rhs.timestamp;
-    }
+// Batched execution (Simulator::runBatched). Every pending event within `window`
+// of the earliest one is dequeued as one batch. Keep `window` no larger than the
+// model's lookahead, so nothing a batch executes can schedule into it, and use a
+// non-zero window only when events within one window commute. With window = 0
+// only simultaneous events are batched and, without grouping, they run in the
+// same order as with run().
+//
+// groupByHandler sorts each batch by handler so each group runs as a tight
+// loop over a single call target. It reorders events inside a batch, also
+// simultaneous ones, overriding the priority and scheduling order that break
+// ties in the event key: turn it on only when events within one batch
+// commute, including ties at the same timestamp.
+//
+// With useBatchVariants, a run of consecutive events with the same timestamp
+// and a handler annotated "reverse,batch" is handed to the handler's batched
+// variant in one call (see BatchEntry in event.hpp), so now() is every event's
+// own timestamp, and rolled back through its batched undo variant.
+struct BatchConfig {
+    double window = 0.0;
+    std::size_t maxBatch = 1024;
+    bool groupByHandler = false;
+    bool useBatchVariants = true;
 };
-/*
+
+// Sequential simulation engine. PendingSet is the pending-event set policy:
+// BinaryHeap, PairingHeap or CalendarQueue (see pending_set.hpp).
+template <typename PendingSet = BinaryHeap>
 class Simulator {
-    std::priority_queue<Event, std::vector<Event>, EventCompare> eventQueue;
-    std::stack<Event> executedEvents;
+    struct ExecutedEvent {
+        Event event;
+        std::uint64_t logStart;         // reverse log position before the forward ran
+        double batchLatest;             // latest timestamp of the batch it ran in
+    };
+
+    // rollback: an event that stays, with its log records set aside in keptWords
+    struct KeptEvent {
+        ExecutedEvent executed;
+        std::size_t wordsBegin;
+        std::size_t wordsEnd;
+    };
+
+    SegmentPool historyPool;
+    PendingSet eventQueue;
+    SegmentQueue<ExecutedEvent> executedEvents;   // rollback history, oldest first
+    ReverseLog reverseLog;
+    double currentTime = 0.0;
+    std::uint64_t nextSequence = 0;             // tie-breaker stamped into each scheduled event's key
+    std::uint64_t pastEvents = 0;               // scheduled before now() and dropped: a model bug
+
+    // runBatched scratch, reused across batches
+    std::vector<ExecutedEvent> batch;
+    std::vector<ExecutedEvent> grouped;
+    std::vector<HandlerPtr> batchHandlers;      // distinct handlers in the batch
+    std::vector<std::uint32_t> groupStart;      // per handler: size, then write cursor
+    std::vector<std::uint32_t> batchGroup;      // per event: index into batchHandlers
+    std::vector<std::uint64_t> batchMarks;      // log position after each event of a batched variant call
+    std::vector<ExecutedEvent> undone;          // rollback: a run undone by one batched variant call
+
+    // rollback scratch
+    std::vector<ExecutedEvent> suffix;          // history after the last batch that ended by the target, newest first
+    std::vector<KeptEvent> kept;
+    std::vector<std::uint64_t> keptWords;
+
+    void groupBatch();
+    void executeRun(ExecutedEvent* run, std::size_t n, bool useBatchVariants);
+    void undoEvent(const ExecutedEvent& executed);
+    void undoRun(const ExecutedEvent* newestFirst, std::size_t n, const BatchRoute& route);
 
 public:
-    void scheduleEvent(double timestamp, void (*handler)(void*), const std::string &reverseFunctionName, void *data);
+    Simulator() { executedEvents.attach(historyPool); }
+
+    void scheduleEvent(const Event& event);
+
+    // Schedule handler F with its undo handler bound at compile time
+    template <auto F, typename... Args>
+    void scheduleEvent(double timestamp, Args&&... args) {
+        scheduleEvent(CreateEvent<F>(timestamp, std::forward<Args>(args)...));
+    }
 
     void run(double endTime);
+
+    // Like run(), one batch at a time (see BatchConfig); returns the number of batches
+    std::size_t runBatched(double endTime, const BatchConfig& config = {});
+
     void rollback(double rollbackTime);
 
-private:
-    void* loadReverseHandler(const char* handlerName, const char* libPath);    
+    // Drop the history of events before `horizon`; they can no longer be rolled back
+    std::size_t fossilCollect(double horizon);
+
+    double now() const { return currentTime; }
+    std::size_t pendingEvents() const { return eventQueue.size(); }
+    std::size_t executedEventCount() const { return executedEvents.size(); }
+    std::uint64_t pastEventCount() const { return pastEvents; }
+    const SegmentPoolStats& historyStats() const { return historyPool.stats(); }
 };
-*/
+
+extern template class Simulator<BinaryHeap>;
+extern template class Simulator<PairingHeap>;
+extern template class Simulator<CalendarQueue>;
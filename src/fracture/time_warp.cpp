@@ -0,0 +1,1158 @@
+#include "time_warp.hpp"
+
+#include <algorithm>
+#include <barrier>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include "checkpoint.hpp"
+#include "profile.hpp"
+#include "segment_pool.hpp"
+#include "trace.hpp"
+#include "transport.hpp"
+
+namespace {
+    constexpr double kInfinity = std::numeric_limits<double>::infinity();
+    constexpr EventKey kMinKey{};
+
+    struct EventKeyHash {
+        std::size_t operator()(const EventKey& key) const {
+            return std::hash<std::uint64_t>()(key.tie * 0x9e3779b97f4a7c15ULL ^ key.time);
+        }
+    };
+
+    // Heap comparators: std::*_heap keep the largest element on top
+    struct LaterMessage {
+        bool operator()(const TwMessage& lhs, const TwMessage& rhs) const {
+            return rhs.key() < lhs.key();
+        }
+    };
+
+    // What a processed event sent, so a rollback can cancel it
+    struct SentRecord {
+        LpId dst;
+        EventKey key;
+    };
+
+    struct ProcessedEvent {
+        TwMessage message;
+        std::uint64_t sentBegin;   // absolute index of this event's first send in the LP's sent log
+        std::uint64_t logBegin;    // LP reverse log position before the forward ran
+    };
+
+    // Candidate for a worker's next event: the head of one LP's input queue.
+    // Entries go stale when the LP's head changes and are dropped when popped.
+    struct ReadyEntry {
+        EventKey key;
+        LpId lp;
+    };
+
+    struct LaterReady {
+        bool operator()(const ReadyEntry& lhs, const ReadyEntry& rhs) const {
+            return rhs.key < lhs.key;
+        }
+    };
+
+    struct HandlerContext {
+        TimeWarp::LogicalProcess* lp = nullptr;
+        std::vector<std::pair<LpId, Event>>* sends = nullptr;
+        TimeWarpStats* stats = nullptr;
+        double now = 0.0;
+        double earliestSend = 0.0;   // now plus the LP's lookahead in conservative mode
+        bool reversing = false;
+    };
+
+    thread_local HandlerContext context;
+
+    // What travels between ranks. Every transport message starts with a
+    // WireHeader; an Events batch follows it with a WireMessage and then the
+    // Event (or only the EventKey of an anti-message) for each message.
+    enum class WireKind : std::uint32_t {
+        Events,
+        Request,   // to rank 0: a worker wants a GVT round
+        Cut,       // from rank 0: pass the cut of round `epoch`
+        Counts,    // to rank 0: messages sent to each rank before the cut
+        Expect,    // from rank 0: white messages to wait for
+        Report,    // to rank 0: this rank's GVT report
+        Gvt,       // from rank 0: the new GVT
+        Start,     // before the run: each rank's earliest seeded event
+        Final,     // after the run: each rank's stats, and the last message on its links
+    };
+
+    struct WireHeader {
+        WireKind kind;
+        std::uint32_t epoch;   // round of the sender's last cut
+    };
+
+    struct WireMessage {
+        LpId dst;
+        std::uint32_t anti;
+    };
+
+    template <typename T>
+    void appendWire(std::vector<unsigned char>& out, const T& value) {
+        const auto* bytes = reinterpret_cast<const unsigned char*>(&value);
+        out.insert(out.end(), bytes, bytes + sizeof(T));
+    }
+
+    template <typename T>
+    T peekWire(const unsigned char* bytes) {
+        T value;
+        std::memcpy(&value, bytes, sizeof(T));
+        return value;
+    }
+
+    template <typename T>
+    T readWire(const unsigned char*& cursor) {
+        T value = peekWire<T>(cursor);
+        cursor += sizeof(T);
+        return value;
+    }
+}
+
+struct TimeWarp::LogicalProcess {
+    LpId id = 0;
+    std::size_t worker = 0;
+    std::vector<TwMessage> inputQueue;                  // min-heap on key()
+    std::unordered_set<EventKey, EventKeyHash> cancelled;     // pending events annihilated by anti-messages
+    // History since the last fossil collection; committed prefixes are popped off
+    // the front, so sent-log positions are absolute indices. Both live in the
+    // owning worker's segment pool.
+    SegmentQueue<ProcessedEvent> processed;             // in execution order
+    SegmentQueue<SentRecord> sentLog;
+    std::uint64_t sentBase = 0;                         // absolute index of sentLog.front()
+    ReverseLog reverseLog;                              // what this LP's undo handlers pop
+    std::uint32_t nextSequence = 0;
+    double lookahead = 0.0;
+    EventKey lastProcessed = kMinKey;
+    bool inHistory = false;                             // listed in its worker's historyLps
+
+    std::uint64_t sentEnd() const { return sentBase + sentLog.size(); }
+};
+
+struct alignas(64) TimeWarp::Worker {
+    std::size_t id = 0;
+    SegmentPool pool;                                   // backs the worker's queues and its LPs' histories
+    std::vector<ReadyEntry> ready;                      // min-heap on key
+    SegmentQueue<TwMessage> local;                      // messages for this worker's own LPs
+    std::vector<std::vector<TwMessage>> outbox;         // per destination worker
+    std::vector<std::vector<TwMessage>> remote;         // per destination rank
+    std::vector<std::pair<LpId, Event>> sends;          // sends issued by the running handler
+    std::vector<LpId> historyLps;                       // LPs holding uncommitted history
+    ReverseLog scratchLog;                              // state saved by handlers when nothing is rolled back
+
+    std::mutex inboxLock;
+    std::vector<TwMessage> inbox;
+    std::vector<TwMessage> drained;
+
+    // GVT bookkeeping
+    std::uint32_t reportedEpoch = 0;                    // last round this worker reported in
+    double sendMin = kInfinity;                         // earliest message sent in an unreported round
+    double localMin = kInfinity;                        // this worker's report
+    double collectedGvt = -kInfinity;                   // GVT of the last fossil collection
+    std::uint64_t history = 0;                          // uncommitted processed events held
+
+    // Conservative window bookkeeping, read by the barrier completion
+    double windowMin = kInfinity;                       // earliest pending event
+    double windowBound = kInfinity;                     // earliest timestamp this worker's LPs could send
+
+    TimeWarpStats stats;
+};
+
+// Two barriers per conservative window: `agree` publishes the window once every
+// worker has drained its inbox and posted its bounds, `exchange` holds the next
+// window until every worker has flushed what it sent in this one
+struct TimeWarp::WindowSync {
+    struct Agree {
+        TimeWarp* kernel;
+        WindowSync* sync;
+
+        void operator()() noexcept {
+            double earliest = kInfinity;
+            double bound = kInfinity;
+            for (const auto& worker : kernel->workers) {
+                earliest = std::min(earliest, worker->windowMin);
+                bound = std::min(bound, worker->windowBound);
+            }
+            sync->earliest = earliest;
+            sync->end = bound;
+
+            // Every event before the checkpoint has run and everything sent is queued
+            if (kernel->checkpointPending() && earliest >= kernel->nextCheckpoint)
+                kernel->writeCheckpoint();
+            if (earliest < kInfinity && earliest <= kernel->config.endTime) {
+                ++kernel->workers[0]->stats.windows;
+                trace<TraceKind::Window>(bound, kernel->workers[0]->stats.windows);
+            }
+        }
+    };
+
+    explicit WindowSync(TimeWarp& kernel)
+        : agree(static_cast<std::ptrdiff_t>(kernel.workers.size()), Agree{&kernel, this}),
+          exchange(static_cast<std::ptrdiff_t>(kernel.workers.size())) {}
+
+    double earliest = kInfinity;   // earliest pending event of any worker
+    double end = kInfinity;        // events strictly below this are safe to execute
+    std::barrier<Agree> agree;
+    std::barrier<> exchange;
+};
+
+// Distributed runs: rank 0 coordinates GVT with Mattern's algorithm. It opens
+// a round by broadcasting a cut; from its cut on, a rank tags what it sends
+// with the new epoch (red messages) and tracks the earliest of them. Each rank
+// tells rank 0 how many messages it sent to every rank before its cut, and
+// rank 0 tells every rank how many of these white messages it has to receive.
+// Once they are all in, none is in transit any more, and the rank runs a
+// shared-memory round; the last reporter lowers the result to the earliest red
+// message and worker 0 forwards it to rank 0, which broadcasts the minimum
+// over the ranks. Worker 0 does all of the rank's receiving and control
+// traffic; the other workers only send event batches.
+struct TimeWarp::Cluster {
+    struct Incoming {
+        std::size_t source;
+        std::vector<unsigned char> bytes;
+    };
+
+    explicit Cluster(Transport& transport)
+        : transport(transport), rank(transport.rank()), ranks(transport.ranks()),
+          sent(ranks, 0), counts(ranks, std::vector<std::uint64_t>(ranks, 0)) {}
+
+    Transport& transport;
+    std::size_t rank;
+    std::size_t ranks;
+
+    // Send side, shared by the workers under sendLock
+    std::mutex sendLock;
+    std::uint32_t epoch = 0;                    // round whose cut this rank has passed
+    std::vector<std::uint64_t> sent;            // messages sent to each rank so far
+    double redMin = kInfinity;                  // earliest message sent since the cut
+    std::vector<unsigned char> batch;
+
+    // Receive side, worker 0 only
+    std::vector<Incoming> held;                 // messages to ourselves, or held back before the run
+    Incoming incoming;
+    std::unordered_map<std::uint32_t, std::uint64_t> received;   // messages received by the sender's epoch
+    std::uint64_t expected = 0;                 // white messages of the current round
+    bool awaitingWhite = false;
+    bool requestSent = false;
+
+    // Set by any worker, handled by worker 0
+    std::atomic<bool> requested{false};         // a worker wants a round
+    std::atomic<bool> reportReady{false};       // the local round closed with `report`
+    double report = kInfinity;
+
+    // Coordinator, rank 0 only
+    std::uint32_t round = 0;
+    bool roundOpen = false;
+    bool roundWanted = false;
+    std::vector<std::vector<std::uint64_t>> counts;   // [sender][receiver] before the cut
+    std::size_t countsIn = 0;
+    std::size_t reportsIn = 0;
+    double reportMin = kInfinity;
+
+    void sendControl(std::size_t dst, WireKind kind, std::uint32_t tag, const void* payload, std::size_t bytes) {
+        std::vector<unsigned char> message;
+        appendWire(message, WireHeader{kind, tag});
+        const auto* data = static_cast<const unsigned char*>(payload);
+        message.insert(message.end(), data, data + bytes);
+        if (dst == rank)
+            held.push_back({rank, std::move(message)});
+        else
+            transport.send(dst, message.data(), message.size());
+    }
+
+    void broadcast(WireKind kind, std::uint32_t tag, const void* payload, std::size_t bytes) {
+        for (std::size_t r = 0; r < ranks; ++r)
+            sendControl(r, kind, tag, payload, bytes);
+    }
+
+    bool next() {
+        if (!held.empty()) {
+            incoming = std::move(held.front());
+            held.erase(held.begin());
+            return true;
+        }
+        return transport.receive(incoming.bytes, incoming.source);
+    }
+
+    // Sends `payload` to every other rank and returns what each of them sent,
+    // indexed by rank. Other messages arriving meanwhile are held for the run,
+    // or dropped when `discard` is set, except for what a rank sends after its
+    // own payload: that is for the model and goes back to the transport.
+    std::vector<std::vector<unsigned char>> exchange(WireKind kind, const void* payload, std::size_t bytes, bool discard) {
+        for (std::size_t r = 0; r < ranks; ++r) {
+            if (r != rank)
+                sendControl(r, kind, 0, payload, bytes);
+        }
+
+        std::vector<std::vector<unsigned char>> values(ranks);
+        const auto* data = static_cast<const unsigned char*>(payload);
+        values[rank].assign(data, data + bytes);
+        std::vector<bool> done(ranks, false);
+        std::vector<Incoming> later;
+        for (std::size_t missing = ranks - 1; missing > 0;) {
+            if (!transport.receive(incoming.bytes, incoming.source)) {
+                std::this_thread::yield();
+                continue;
+            }
+            bool finished = done[incoming.source];
+            if (!finished && peekWire<WireHeader>(incoming.bytes.data()).kind == kind) {
+                values[incoming.source].assign(incoming.bytes.begin() + sizeof(WireHeader), incoming.bytes.end());
+                done[incoming.source] = true;
+                --missing;
+            } else if (!discard) {
+                held.push_back(std::move(incoming));
+            } else if (finished) {
+                later.push_back(std::move(incoming));
+            }
+            incoming = Incoming{};
+        }
+        for (auto it = later.rbegin(); it != later.rend(); ++it)
+            transport.putBack(std::move(it->bytes), it->source);
+        return values;
+    }
+
+    // Messages received from senders that had not passed cut `round` yet
+    std::uint64_t whiteReceived(std::uint32_t round) {
+        std::uint64_t total = 0;
+        for (const auto& [tag, count] : received) {
+            if (tag < round)
+                total += count;
+        }
+        return total;
+    }
+};
+
+TimeWarp::TimeWarp(std::size_t lpCount, const TimeWarpConfig& config)
+    : config(config), lpTotal(lpCount), lps(lpCount) {
+    if (this->config.mode == ExecutionMode::Sequential)
+        this->config.threads = 1;
+
+    // A distributed run only synchronizes optimistically
+    if (config.transport) {
+        this->config.mode = ExecutionMode::Optimistic;
+        cluster = std::make_unique<Cluster>(*config.transport);
+        rankCount = cluster->ranks;
+    }
+    firstLocal = static_cast<LpId>((cluster ? cluster->rank * lpCount + rankCount - 1 : 0) / rankCount);
+    endLocal = static_cast<LpId>((cluster ? (cluster->rank + 1) * lpCount + rankCount - 1 : lpCount) / rankCount);
+
+    for (std::size_t w = 0; w < this->config.threads; ++w) {
+        workers.push_back(std::make_unique<Worker>());
+        workers.back()->id = w;
+        workers.back()->outbox.resize(this->config.threads);
+        workers.back()->remote.resize(rankCount);
+        workers.back()->local.attach(workers.back()->pool);
+    }
+    for (std::size_t i = 0; i < lpCount; ++i) {
+        lps[i].id = static_cast<LpId>(i);
+        lps[i].lookahead = config.lookahead;
+        if (!isLocal(lps[i].id))
+            continue;
+        lps[i].worker = workerOf(static_cast<LpId>(i));
+        lps[i].processed.attach(workers[lps[i].worker]->pool);
+        lps[i].sentLog.attach(workers[lps[i].worker]->pool);
+    }
+}
+
+TimeWarp::~TimeWarp() = default;
+
+double TimeWarp::now() {
+    return context.now;
+}
+
+LpId TimeWarp::self() {
+    return context.lp->id;
+}
+
+void TimeWarp::post(LpId dst, const Event& event) {
+    // Undo handlers replay the forward body; its sends are cancelled by anti-messages instead.
+    // Outside a kernel (the undo handler verifier) there is nowhere to send to.
+    if (context.reversing || !context.sends)
+        return;
+
+    // Model bugs, so reported even without tracing: the first on each worker, every one in the stats
+    if (!(event.timestamp() > context.now)) {
+        if (context.stats->pastEvents++ == 0)
+            std::fprintf(stderr, "Event at time %g is not after the sender's time %g, dropping it "
+                                 "(further ones are counted in TimeWarpStats::pastEvents)\n",
+                         event.timestamp(), context.now);
+        trace<TraceKind::PastEvent>(context.now, event.forward);
+        return;
+    }
+    // Conservative mode only: the window may already have run past it
+    if (event.timestamp() < context.earliestSend) {
+        if (context.stats->lookaheadViolations++ == 0)
+            std::fprintf(stderr, "Event at time %g is inside the sender's lookahead (time %g, earliest send %g), "
+                                 "dropping it (further ones are counted in TimeWarpStats::lookaheadViolations)\n",
+                         event.timestamp(), context.now, context.earliestSend);
+        trace<TraceKind::PastEvent>(context.now, event.forward);
+        return;
+    }
+
+    context.sends->emplace_back(dst, event);
+}
+
+void TimeWarp::setLookahead(LpId lp, double lookahead) {
+    lps[lp].lookahead = lookahead;
+}
+
+bool TimeWarp::restore(const CheckpointSnapshot& snapshot) {
+    const CheckpointHeader& header = snapshot.header();
+    if (header.lpCount != lpTotal)
+        return false;
+
+    const CheckpointLp* table = snapshot.lps();
+    for (LogicalProcess& lp : lps) {
+        lp.nextSequence = table[lp.id].nextSequence;
+        lp.lookahead = table[lp.id].lookahead;
+    }
+
+    // Keys were stamped when the events were sent; they are queued as they are
+    for (std::size_t i = 0; i < header.eventCount; ++i) {
+        TwMessage message{};
+        snapshot.pendingEvent(i, message.event, message.dst);
+        if (!isLocal(message.dst))
+            continue;
+        LogicalProcess& lp = lps[message.dst];
+        pushInput(*workers[lp.worker], lp, message);
+    }
+    restoredTime = header.time;
+    return true;
+}
+
+// Without a writer nextCheckpoint stays infinite, and after the last pending
+// event it becomes infinite, which an endTime of infinity must not count as due
+bool TimeWarp::checkpointPending() const {
+    return checkpoints && nextCheckpoint < kInfinity && nextCheckpoint <= config.endTime;
+}
+
+double TimeWarp::checkpointLimit() const {
+    return checkpointPending() ? std::nextafter(nextCheckpoint, -kInfinity) : kInfinity;
+}
+
+void TimeWarp::writeCheckpoint() {
+    // Called with every worker paused: LP queues hold everything not yet executed
+    std::vector<CheckpointLp> table(lpTotal);
+    std::vector<CheckpointEvent> pending;
+    double earliest = kInfinity;
+    for (const LogicalProcess& lp : lps) {
+        table[lp.id] = CheckpointLp{lp.nextSequence, 0, lp.lookahead};
+        for (const TwMessage& message : lp.inputQueue) {
+            if (!lp.cancelled.empty() && lp.cancelled.count(message.key()))
+                continue;
+            pending.push_back(CheckpointEvent{message.event, message.dst});
+            earliest = std::min(earliest, message.event.timestamp());
+        }
+    }
+
+    std::size_t pages = checkpoints->write(nextCheckpoint, table, pending);
+    trace<TraceKind::Checkpoint>(nextCheckpoint, pages);
+    ++workers[0]->stats.checkpoints;
+    workers[0]->stats.checkpointPages += pages;
+
+    // Nothing changes until the earliest pending event, so the next checkpoint is the first multiple after it
+    nextCheckpoint = config.checkpointInterval * (std::floor(earliest / config.checkpointInterval) + 1);
+}
+
+void TimeWarp::pauseForCheckpoint(Worker& worker) {
+    flushOutboxes(worker);
+    checkpointPause->arrive_and_wait();   // everything sent is in an inbox
+    drainInbox(worker);
+    checkpointPause->arrive_and_wait();   // and in its LP's queue
+    if (worker.id == 0)
+        writeCheckpoint();
+    checkpointPause->arrive_and_wait();
+}
+
+void TimeWarp::seed(LpId dst, const Event& event) {
+    // Every rank seeds the whole model; each keeps its own LPs' events
+    if (!isLocal(dst))
+        return;
+
+    LogicalProcess& lp = lps[dst];
+    TwMessage message{event, dst, false};
+    message.event.key.setOrigin(dst, lp.nextSequence++);
+    pushInput(*workers[lp.worker], lp, message);
+}
+
+void TimeWarp::pushInput(Worker& worker, LogicalProcess& lp, const TwMessage& message) {
+    std::uint64_t probe = profileBegin();
+    lp.inputQueue.push_back(message);
+    std::push_heap(lp.inputQueue.begin(), lp.inputQueue.end(), LaterMessage());
+
+    // A new head makes the LP a candidate at the new key
+    EventKey key = message.key();
+    if (lp.inputQueue.front().key() == key) {
+        worker.ready.push_back({key, lp.id});
+        std::push_heap(worker.ready.begin(), worker.ready.end(), LaterReady());
+    }
+    profileEnd(ProfilePhase::Enqueue, probe, lp.id, message.event.forward);
+}
+
+void TimeWarp::route(Worker& worker, const TwMessage& message) {
+    if (!isLocal(message.dst)) {
+        worker.remote[rankOf(message.dst)].push_back(message);
+        return;
+    }
+
+    std::size_t owner = lps[message.dst].worker;
+    if (owner == worker.id)
+        worker.local.push_back(message);
+    else
+        worker.outbox[owner].push_back(message);
+}
+
+void TimeWarp::receive(Worker& worker, const TwMessage& message) {
+    LogicalProcess& lp = lps[message.dst];
+    EventKey key = message.key();
+
+    if (message.anti) {
+        // Already executed: roll back past it, which returns it to the input queue
+        if (!(lp.lastProcessed < key))
+            rollback(worker, lp, key);
+        lp.cancelled.insert(key);
+        return;
+    }
+
+    // Straggler: undo everything the LP executed after it
+    if (key < lp.lastProcessed)
+        rollback(worker, lp, key);
+    pushInput(worker, lp, message);
+}
+
+void TimeWarp::processLocal(Worker& worker) {
+    while (!worker.local.empty()) {
+        TwMessage message = worker.local.front();
+        worker.local.pop_front();
+        receive(worker, message);
+    }
+}
+
+void TimeWarp::rollback(Worker& worker, LogicalProcess& lp, const EventKey& key) {
+    ++worker.stats.rollbacks;
+    trace<TraceKind::Rollback>(key.timestamp(), lp.id);
+
+    HandlerContext saved = context;
+    context.lp = &lp;
+    context.reversing = true;
+    ReverseLogScope scope(lp.reverseLog);
+
+    // Undo newest-first down to and including `key`
+    while (!lp.processed.empty() && !(lp.processed.back().message.key() < key)) {
+        ProcessedEvent undone = lp.processed.back();
+        lp.processed.pop_back();
+
+        context.now = undone.message.event.timestamp();
+        trace<TraceKind::UndoBegin>(context.now, lp.id);
+        std::uint64_t logEnd = lp.reverseLog.position();
+        std::uint64_t probe = profileBegin();
+        undone.message.event.callUndo(lp.reverseLog);
+        profileEnd(ProfilePhase::Reverse, probe, lp.id, undone.message.event.forward, logEnd - undone.logBegin);
+        trace<TraceKind::UndoEnd>(context.now, lp.id);
+        lp.reverseLog.truncate(undone.logBegin);
+        ++worker.stats.rolledBack;
+
+        // Cancel everything the undone event sent
+        for (std::uint64_t i = undone.sentBegin; i < lp.sentEnd(); ++i) {
+            const SentRecord& sent = lp.sentLog[i - lp.sentBase];
+            TwMessage anti{};
+            anti.event.key = sent.key;
+            anti.dst = sent.dst;
+            anti.anti = true;
+            route(worker, anti);
+            trace<TraceKind::AntiMessage>(sent.key.timestamp(), sent.dst);
+            ++worker.stats.antiMessages;
+        }
+        lp.sentLog.truncate(undone.sentBegin - lp.sentBase);
+        --worker.history;
+
+        pushInput(worker, lp, undone.message);
+    }
+
+    lp.lastProcessed = lp.processed.empty() ? kMinKey : lp.processed.back().message.key();
+    context = saved;
+}
+
+TimeWarp::LogicalProcess* TimeWarp::nextEvent(Worker& worker, double limit) {
+    while (!worker.ready.empty()) {
+        const ReadyEntry& top = worker.ready.front();
+        LogicalProcess& lp = lps[top.lp];
+
+        // Stale entry: the LP's head has changed since it was pushed
+        if (lp.inputQueue.empty() || !(lp.inputQueue.front().key() == top.key)) {
+            std::pop_heap(worker.ready.begin(), worker.ready.end(), LaterReady());
+            worker.ready.pop_back();
+            continue;
+        }
+
+        // Annihilated by an anti-message while pending
+        if (!lp.cancelled.empty() && lp.cancelled.erase(top.key)) {
+            std::pop_heap(worker.ready.begin(), worker.ready.end(), LaterReady());
+            worker.ready.pop_back();
+            std::pop_heap(lp.inputQueue.begin(), lp.inputQueue.end(), LaterMessage());
+            lp.inputQueue.pop_back();
+            if (!lp.inputQueue.empty()) {
+                worker.ready.push_back({lp.inputQueue.front().key(), lp.id});
+                std::push_heap(worker.ready.begin(), worker.ready.end(), LaterReady());
+            }
+            continue;
+        }
+
+        if (top.key.timestamp() > limit)
+            return nullptr;
+        return &lp;
+    }
+    return nullptr;
+}
+
+void TimeWarp::processEvent(Worker& worker, LogicalProcess& lp) {
+    std::uint64_t probe = profileBegin();
+    std::pop_heap(worker.ready.begin(), worker.ready.end(), LaterReady());
+    worker.ready.pop_back();
+
+    std::pop_heap(lp.inputQueue.begin(), lp.inputQueue.end(), LaterMessage());
+    TwMessage message = lp.inputQueue.back();
+    lp.inputQueue.pop_back();
+    if (!lp.inputQueue.empty()) {
+        worker.ready.push_back({lp.inputQueue.front().key(), lp.id});
+        std::push_heap(worker.ready.begin(), worker.ready.end(), LaterReady());
+    }
+    profileEnd(ProfilePhase::Dequeue, probe, lp.id, message.event.forward);
+
+    context.lp = &lp;
+    context.now = message.event.timestamp();
+    context.earliestSend = config.mode == ExecutionMode::Conservative ? context.now + lp.lookahead : context.now;
+
+    // Without speculation nothing is undone: the saved state goes to a scratch
+    // log that is cut back after every event, and no history is kept
+    bool optimistic = config.mode == ExecutionMode::Optimistic;
+    ReverseLog& log = optimistic ? lp.reverseLog : worker.scratchLog;
+    std::uint64_t sentBegin = lp.sentEnd();
+    std::uint64_t logBegin = log.position();
+
+    {
+        ReverseLogScope scope(log);
+        trace<TraceKind::EventBegin>(context.now, lp.id);
+        probe = profileBegin();
+        message.event.call(log);
+        profileEnd(ProfilePhase::Forward, probe, lp.id, message.event.forward, log.position() - logBegin);
+        trace<TraceKind::EventEnd>(context.now, lp.id);
+    }
+    ++worker.stats.processed;
+    lp.lastProcessed = message.key();
+
+    if (optimistic) {
+        lp.processed.push_back({message, sentBegin, logBegin});
+        if (!lp.inHistory) {
+            lp.inHistory = true;
+            worker.historyLps.push_back(lp.id);
+        }
+        worker.stats.peakHistory = std::max(worker.stats.peakHistory, ++worker.history);
+    } else {
+        log.truncate(logBegin);
+    }
+
+    // Stamp and route what the handler sent
+    for (const auto& [dst, event] : worker.sends) {
+        TwMessage sent{event, dst, false};
+        sent.event.key.setOrigin(lp.id, lp.nextSequence++);
+        if (optimistic)
+            lp.sentLog.push_back({dst, sent.key()});
+        route(worker, sent);
+    }
+    worker.sends.clear();
+
+    processLocal(worker);
+}
+
+void TimeWarp::flushOutboxes(Worker& worker) {
+    for (std::size_t w = 0; w < workers.size(); ++w) {
+        auto& pending = worker.outbox[w];
+        if (pending.empty())
+            continue;
+
+        double earliest = kInfinity;
+        for (const TwMessage& message : pending)
+            earliest = std::min(earliest, message.event.timestamp());
+
+        Worker& target = *workers[w];
+        {
+            std::lock_guard<std::mutex> guard(target.inboxLock);
+            target.inbox.insert(target.inbox.end(), pending.begin(), pending.end());
+        }
+        pending.clear();
+
+        // Checked after the enqueue: either the receiver drains these before it
+        // reports, or the round was already open and we account for them ourselves
+        std::uint64_t state = gvtState.load();
+        if ((state & 0xffffffffu) != 0 && (state >> 32) != worker.reportedEpoch)
+            worker.sendMin = std::min(worker.sendMin, earliest);
+    }
+
+    for (std::size_t r = 0; r < worker.remote.size(); ++r) {
+        if (!worker.remote[r].empty())
+            sendRemote(r, worker.remote[r]);
+    }
+}
+
+void TimeWarp::sendRemote(std::size_t rank, std::vector<TwMessage>& pending) {
+    Cluster& net = *cluster;
+    std::lock_guard<std::mutex> guard(net.sendLock);
+
+    // Tagged and counted under the lock, so every message is on one side of a cut
+    net.batch.clear();
+    appendWire(net.batch, WireHeader{WireKind::Events, net.epoch});
+    for (const TwMessage& message : pending) {
+        appendWire(net.batch, WireMessage{message.dst, message.anti});
+        if (message.anti)
+            appendWire(net.batch, message.event.key);
+        else
+            appendWire(net.batch, message.event);
+        net.redMin = std::min(net.redMin, message.event.timestamp());
+    }
+    net.sent[rank] += pending.size();
+    net.transport.send(rank, net.batch.data(), net.batch.size());
+    pending.clear();
+}
+
+void TimeWarp::drainInbox(Worker& worker) {
+    {
+        std::lock_guard<std::mutex> guard(worker.inboxLock);
+        if (worker.inbox.empty())
+            return;
+        std::swap(worker.inbox, worker.drained);
+    }
+
+    for (const TwMessage& message : worker.drained) {
+        receive(worker, message);
+        processLocal(worker);
+    }
+    worker.drained.clear();
+}
+
+double TimeWarp::localMinimum(Worker& worker) {
+    while (!worker.ready.empty()) {
+        const ReadyEntry& top = worker.ready.front();
+        const LogicalProcess& lp = lps[top.lp];
+        if (!lp.inputQueue.empty() && lp.inputQueue.front().key() == top.key)
+            return top.key.timestamp();
+        std::pop_heap(worker.ready.begin(), worker.ready.end(), LaterReady());
+        worker.ready.pop_back();
+    }
+    return kInfinity;
+}
+
+void TimeWarp::startGvtRound() {
+    // Across ranks every round is opened by rank 0
+    if (cluster) {
+        if (!cluster->requested.load(std::memory_order_relaxed))
+            cluster->requested.store(true, std::memory_order_relaxed);
+        return;
+    }
+    openLocalRound();
+}
+
+void TimeWarp::openLocalRound() {
+    std::uint64_t state = gvtState.load();
+    if ((state & 0xffffffffu) != 0)
+        return;
+
+    // Every worker reports once, plus one count the last reporter holds while publishing
+    std::uint64_t epoch = (state >> 32) + 1;
+    gvtState.compare_exchange_strong(state, epoch << 32 | (workers.size() + 1));
+}
+
+void TimeWarp::reportGvt(Worker& worker) {
+    std::uint64_t state = gvtState.load();
+    std::uint32_t epoch = static_cast<std::uint32_t>(state >> 32);
+    if ((state & 0xffffffffu) == 0 || epoch == worker.reportedEpoch)
+        return;
+
+    // Receive everything addressed to us, push out everything we owe others
+    drainInbox(worker);
+    flushOutboxes(worker);
+
+    std::uint64_t probe = profileBegin();
+    worker.localMin = std::min(worker.sendMin, localMinimum(worker));
+    worker.reportedEpoch = epoch;
+    worker.sendMin = kInfinity;
+
+    // The last reporter sees every other report through the release sequence
+    if ((gvtState.fetch_sub(1, std::memory_order_acq_rel) & 0xffffffffu) == 2) {
+        double gvt = kInfinity;
+        for (const auto& w : workers)
+            gvt = std::min(gvt, w->localMin);
+        if (cluster) {
+            // Only this rank's part: worker 0 reports it to rank 0
+            {
+                std::lock_guard<std::mutex> guard(cluster->sendLock);
+                cluster->report = std::min(gvt, cluster->redMin);
+            }
+            cluster->reportReady.store(true, std::memory_order_release);
+        } else {
+            gvtValue.store(gvt, std::memory_order_release);
+            trace<TraceKind::Gvt>(gvt);
+            ++worker.stats.gvtRounds;
+        }
+        gvtState.fetch_sub(1, std::memory_order_release);
+    }
+    profileEnd(ProfilePhase::Gvt, probe);
+}
+
+void TimeWarp::pollCluster(Worker& worker) {
+    Cluster& net = *cluster;
+
+    if (net.requested.exchange(false, std::memory_order_relaxed)) {
+        if (net.rank == 0) {
+            net.roundWanted = true;
+        } else if (!net.requestSent) {
+            net.sendControl(0, WireKind::Request, net.epoch, nullptr, 0);
+            net.requestSent = true;
+        }
+    }
+
+    while (net.next()) {
+        const unsigned char* cursor = net.incoming.bytes.data();
+        const unsigned char* end = cursor + net.incoming.bytes.size();
+        WireHeader header = readWire<WireHeader>(cursor);
+
+        switch (header.kind) {
+        case WireKind::Events: {
+            std::uint64_t count = 0;
+            while (cursor < end) {
+                WireMessage wire = readWire<WireMessage>(cursor);
+                TwMessage message{};
+                message.dst = wire.dst;
+                message.anti = wire.anti != 0;
+                if (message.anti)
+                    message.event.key = readWire<EventKey>(cursor);
+                else
+                    message.event = readWire<Event>(cursor);
+                route(worker, message);
+                ++count;
+            }
+            net.received[header.epoch] += count;
+            // Handed to the owning workers before any round can count them as received
+            flushOutboxes(worker);
+            processLocal(worker);
+            break;
+        }
+        case WireKind::Request:
+            net.roundWanted = true;
+            break;
+        case WireKind::Cut: {
+            std::vector<std::uint64_t> snapshot;
+            {
+                std::lock_guard<std::mutex> guard(net.sendLock);
+                net.epoch = header.epoch;
+                snapshot = net.sent;
+                net.redMin = kInfinity;
+            }
+            net.sendControl(0, WireKind::Counts, header.epoch, snapshot.data(), snapshot.size() * sizeof(std::uint64_t));
+            break;
+        }
+        case WireKind::Counts:
+            std::memcpy(net.counts[net.incoming.source].data(), cursor, net.ranks * sizeof(std::uint64_t));
+            if (++net.countsIn == net.ranks) {
+                for (std::size_t r = 0; r < net.ranks; ++r) {
+                    std::uint64_t white = 0;
+                    for (std::size_t s = 0; s < net.ranks; ++s)
+                        white += net.counts[s][r];
+                    net.sendControl(r, WireKind::Expect, header.epoch, &white, sizeof(white));
+                }
+            }
+            break;
+        case WireKind::Expect:
+            net.expected = readWire<std::uint64_t>(cursor);
+            net.awaitingWhite = true;
+            break;
+        case WireKind::Report:
+            net.reportMin = std::min(net.reportMin, readWire<double>(cursor));
+            if (++net.reportsIn == net.ranks)
+                net.broadcast(WireKind::Gvt, header.epoch, &net.reportMin, sizeof(net.reportMin));
+            break;
+        case WireKind::Gvt: {
+            double gvt = readWire<double>(cursor);
+            gvtValue.store(gvt, std::memory_order_release);
+            trace<TraceKind::Gvt>(gvt);
+            net.requestSent = false;
+            if (net.rank == 0) {
+                net.roundOpen = false;
+                ++worker.stats.gvtRounds;
+            }
+            break;
+        }
+        case WireKind::Start:
+        case WireKind::Final:
+            break;
+        }
+    }
+
+    // Nothing sent before the cut is in transit any more
+    if (net.awaitingWhite && net.whiteReceived(net.epoch) == net.expected) {
+        net.awaitingWhite = false;
+        openLocalRound();
+    }
+
+    if (net.reportReady.exchange(false, std::memory_order_acquire))
+        net.sendControl(0, WireKind::Report, net.epoch, &net.report, sizeof(net.report));
+
+    if (net.rank == 0 && net.roundWanted && !net.roundOpen) {
+        net.roundWanted = false;
+        net.roundOpen = true;
+        net.countsIn = 0;
+        net.reportsIn = 0;
+        net.reportMin = kInfinity;
+        net.broadcast(WireKind::Cut, ++net.round, nullptr, 0);
+    }
+}
+
+void TimeWarp::fossilCollect(Worker& worker, double gvt) {
+    // Nothing below GVT can be rolled back any more: drop it in one pass over the
+    // LPs that hold history
+    std::uint64_t probe = profileBegin();
+    std::uint64_t collectedBefore = worker.stats.fossilCollected;
+    std::size_t kept = 0;
+    for (LpId id : worker.historyLps) {
+        LogicalProcess& lp = lps[id];
+        while (!lp.processed.empty() && lp.processed.front().message.event.timestamp() < gvt) {
+            lp.processed.pop_front();
+            ++worker.stats.fossilCollected;
+            --worker.history;
+        }
+
+        std::uint64_t sentKeep = lp.processed.empty() ? lp.sentEnd() : lp.processed.front().sentBegin;
+        lp.sentLog.pop_front(sentKeep - lp.sentBase);
+        lp.sentBase = sentKeep;
+        lp.reverseLog.release(lp.processed.empty() ? lp.reverseLog.position() : lp.processed.front().logBegin);
+
+        if (lp.processed.empty())
+            lp.inHistory = false;
+        else
+            worker.historyLps[kept++] = id;
+    }
+    worker.historyLps.resize(kept);
+    worker.collectedGvt = gvt;
+    profileEnd(ProfilePhase::Commit, probe);
+    trace<TraceKind::FossilCollect>(gvt, worker.stats.fossilCollected - collectedBefore);
+}
+
+void TimeWarp::runWorker(Worker& worker) {
+    context = HandlerContext{};
+    context.sends = &worker.sends;
+    context.stats = &worker.stats;
+
+    std::size_t sinceRound = 0;
+    std::size_t sincePoll = 0;
+    while (true) {
+        double gvt = gvtValue.load(std::memory_order_acquire);
+        // GVT past the checkpoint with nothing executed beyond it: the state is
+        // exactly that at the checkpoint. Checked before termination, so every
+        // worker that sees this GVT or a later one pauses.
+        if (checkpointPending() && gvt >= nextCheckpoint) {
+            pauseForCheckpoint(worker);
+            continue;
+        }
+        // Infinite GVT: nothing is pending or in transit anywhere, also with endTime = inf
+        if (gvt > config.endTime || gvt == kInfinity)
+            break;
+        if (gvt > worker.collectedGvt)
+            fossilCollect(worker, gvt);
+
+        if (++sincePoll >= config.pollInterval) {
+            flushOutboxes(worker);
+            drainInbox(worker);
+            if (cluster && worker.id == 0)
+                pollCluster(worker);
+            sincePoll = 0;
+        }
+        reportGvt(worker);
+
+        LogicalProcess* lp = nextEvent(worker, std::min({config.endTime, gvt + config.optimismWindow, checkpointLimit()}));
+        if (lp) {
+            processEvent(worker, *lp);
+            if (++sinceRound >= config.gvtInterval) {
+                startGvtRound();
+                sinceRound = 0;
+            }
+            continue;
+        }
+
+        // Idle: hand over what we have and push GVT forward so the window can
+        // advance or the run can terminate
+        flushOutboxes(worker);
+        drainInbox(worker);
+        startGvtRound();
+        if (cluster && worker.id == 0)
+            pollCluster(worker);
+        reportGvt(worker);
+        std::this_thread::yield();
+    }
+}
+
+void TimeWarp::runOptimistic() {
+    // Seeded events are all there is before the first round
+    double initial = kInfinity;
+    for (auto& worker : workers)
+        initial = std::min(initial, localMinimum(*worker));
+    if (cluster) {
+        for (const auto& value : cluster->exchange(WireKind::Start, &initial, sizeof(initial), false)) {
+            double other;
+            std::memcpy(&other, value.data(), sizeof(other));
+            initial = std::min(initial, other);
+        }
+    }
+    gvtValue.store(initial);
+
+    std::barrier<> pause(static_cast<std::ptrdiff_t>(workers.size()));
+    checkpointPause = &pause;
+
+    std::vector<std::thread> threads;
+    for (std::size_t w = 1; w < workers.size(); ++w)
+        threads.emplace_back([this, w] { runWorker(*workers[w]); });
+    runWorker(*workers[0]);
+    for (auto& thread : threads)
+        thread.join();
+}
+
+void TimeWarp::runSequential() {
+    Worker& worker = *workers[0];
+    context = HandlerContext{};
+    context.sends = &worker.sends;
+    context.stats = &worker.stats;
+
+    while (true) {
+        while (LogicalProcess* lp = nextEvent(worker, std::min(config.endTime, checkpointLimit())))
+            processEvent(worker, *lp);
+        if (!checkpointPending())
+            break;
+        writeCheckpoint();
+    }
+}
+
+void TimeWarp::runWindows(Worker& worker, WindowSync& sync) {
+    context = HandlerContext{};
+    context.sends = &worker.sends;
+    context.stats = &worker.stats;
+
+    while (true) {
+        // Everything sent in the last window has been flushed; receive it, then
+        // post the earliest timestamp this worker could still send to
+        drainInbox(worker);
+        worker.windowMin = localMinimum(worker);
+        worker.windowBound = kInfinity;
+        for (const auto& [key, id] : worker.ready) {
+            const LogicalProcess& lp = lps[id];
+            if (!lp.inputQueue.empty() && lp.inputQueue.front().key() == key)
+                worker.windowBound = std::min(worker.windowBound, key.timestamp() + lp.lookahead);
+        }
+        std::uint64_t probe = profileBegin();
+        sync.agree.arrive_and_wait();
+        profileEnd(ProfilePhase::Gvt, probe);
+
+        // Nothing pending anywhere: done, also with endTime = inf
+        if (sync.earliest > config.endTime || sync.earliest == kInfinity)
+            break;
+
+        // Strictly below the window end; events at the earliest timestamp are
+        // always safe because sends must be strictly later
+        double limit = std::max(sync.earliest, std::nextafter(sync.end, -kInfinity));
+        while (LogicalProcess* lp = nextEvent(worker, std::min({limit, config.endTime, checkpointLimit()})))
+            processEvent(worker, *lp);
+
+        flushOutboxes(worker);
+        probe = profileBegin();
+        sync.exchange.arrive_and_wait();
+        profileEnd(ProfilePhase::Gvt, probe);
+    }
+}
+
+void TimeWarp::runConservative() {
+    WindowSync sync(*this);
+
+    std::vector<std::thread> threads;
+    for (std::size_t w = 1; w < workers.size(); ++w)
+        threads.emplace_back([this, w, &sync] { runWindows(*workers[w], sync); });
+    runWindows(*workers[0], sync);
+    for (auto& thread : threads)
+        thread.join();
+}
+
+void TimeWarp::run() {
+    auto start = std::chrono::steady_clock::now();
+
+    if (config.checkpointPath && config.checkpointInterval < kInfinity && !cluster) {
+        checkpoints = std::make_unique<CheckpointWriter>(config.checkpointPath, state);
+        nextCheckpoint = config.checkpointInterval * (std::floor(restoredTime / config.checkpointInterval) + 1);
+    }
+
+    switch (config.mode) {
+    case ExecutionMode::Sequential:
+        runSequential();
+        break;
+    case ExecutionMode::Conservative:
+        runConservative();
+        break;
+    case ExecutionMode::Optimistic:
+        runOptimistic();
+        break;
+    }
+    // The sequential kernel ran its handlers on this thread; later sends from here go nowhere
+    context = HandlerContext{};
+
+    totals = TimeWarpStats{};
+    for (const auto& worker : workers) {
+        totals.processed += worker->stats.processed;
+        totals.rolledBack += worker->stats.rolledBack;
+        totals.antiMessages += worker->stats.antiMessages;
+        totals.rollbacks += worker->stats.rollbacks;
+        totals.gvtRounds += worker->stats.gvtRounds;
+        totals.windows += worker->stats.windows;
+        totals.fossilCollected += worker->stats.fossilCollected;
+        totals.peakHistory += worker->stats.peakHistory;
+        totals.poolPeakBytes += worker->pool.stats().peakBytes();
+        totals.poolReservedBytes += worker->pool.stats().reservedBytes();
+        totals.checkpoints += worker->stats.checkpoints;
+        totals.checkpointPages += worker->stats.checkpointPages;
+        totals.pastEvents += worker->stats.pastEvents;
+        totals.lookaheadViolations += worker->stats.lookaheadViolations;
+    }
+    totals.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (cluster)
+        gatherStats();
+}
+
+void TimeWarp::gatherStats() {
+    // The last message on every link: once each rank's stats are in, nothing
+    // the run sent is left in transit and the transport is free for the model
+    TimeWarpStats local = totals;
+    std::vector<std::vector<unsigned char>> values = cluster->exchange(WireKind::Final, &local, sizeof(local), true);
+
+    totals = TimeWarpStats{};
+    for (const auto& value : values) {
+        TimeWarpStats rank;
+        std::memcpy(&rank, value.data(), sizeof(rank));
+        totals.processed += rank.processed;
+        totals.rolledBack += rank.rolledBack;
+        totals.antiMessages += rank.antiMessages;
+        totals.rollbacks += rank.rollbacks;
+        totals.gvtRounds += rank.gvtRounds;
+        totals.windows += rank.windows;
+        totals.fossilCollected += rank.fossilCollected;
+        totals.peakHistory += rank.peakHistory;
+        totals.poolPeakBytes += rank.poolPeakBytes;
+        totals.poolReservedBytes += rank.poolReservedBytes;
+        totals.checkpoints += rank.checkpoints;
+        totals.checkpointPages += rank.checkpointPages;
+        totals.pastEvents += rank.pastEvents;
+        totals.lookaheadViolations += rank.lookaheadViolations;
+        totals.seconds = std::max(totals.seconds, rank.seconds);
+    }
+}
@@ -0,0 +1,226 @@
+#pragma once
+
+#include <atomic>
+#include <barrier>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <utility>
+#include <vector>
+#include "event.hpp"
+
+// Optimistic (Time Warp) parallel engine. Logical processes (LPs) are partitioned
+// across worker threads; each worker executes its LPs' events speculatively in
+// timestamp order. A message that arrives in an LP's past (a straggler) rolls the
+// LP back: processed events are undone newest-first with the undo handlers
+// generated by the reverse-pass, and every message they sent is cancelled with an
+// anti-message.
+//
+// Global virtual time is computed without barriers (Fujimoto & Hybinette's
+// shared-memory algorithm): any worker may open a round, every worker reports its
+// local minimum the next time it polls, and the last reporter publishes GVT.
+// Workers fossil-collect the history of their LPs below each new GVT in one
+// batch, which bounds memory to the events inside the rollback horizon.
+//
+// Handlers send events with TimeWarp::send<F>(dst, timestamp, args...). Sends are
+// not replayed by undo handlers: while an undo handler runs, send() is a no-op and
+// the kernel cancels the original messages itself.
+//
+// The same model also runs without speculation (TimeWarpConfig::mode):
+//  - Sequential: one thread executes every event in key order.
+//  - Conservative: YAWNS-style windows. At each barrier the workers agree on the
+//    earliest pending timestamp plus lookahead; nothing sent inside the window
+//    can land before its end, so every worker executes its events below it
+//    with no rollback, no history and no state saving, then exchanges
+//    messages at the next barrier. Each LP declares its lookahead (the minimum
+//    delay of everything it sends); with zero lookahead a window only covers
+//    the earliest timestamp.
+// Every message's EventKey is stamped with the sending LP and that LP's send
+// counter, which makes it unique (an anti-message matches exactly one event) and
+// only depends on each LP's own execution order, so sequential and conservative
+// runs are bit-identical for any thread count. A rollback only re-stamps a suffix
+// of an LP's sends, so committed optimistic runs break ties the same way. Keys
+// hold 24-bit LP ids, which caps a model at EventKey::kMaxSources LPs.
+//
+// An optimistic run can also span processes (TimeWarpConfig::transport, see
+// transport.hpp). LPs are split across the ranks in contiguous blocks and then
+// across each rank's workers. Messages for another rank are batched per
+// destination rank in every worker and go out whenever the worker flushes its
+// outboxes: a batch is a header followed by each message's destination and
+// the event exactly as CreateEvent built it, or just the key of an
+// anti-message. GVT across ranks uses Mattern's cut-based algorithm on top of
+// the shared-memory rounds (see time_warp.cpp). Events carry raw handler and
+// argument addresses, so every rank must run the same binary with its model
+// state at the same addresses, which launchLocalRanks provides by forking
+// after the model is set up.
+//
+// With TimeWarpConfig::checkpointInterval and checkpointPath set, the kernel
+// snapshots the committed state each time simulation time passes a multiple
+// of the interval (see checkpoint.hpp). Execution is held just below the
+// checkpoint time until every event before it has run: in the optimistic mode
+// until GVT reaches it, when the workers pause while worker 0 writes the
+// snapshot; in the conservative mode at the window barrier. restore() starts a
+// kernel from a snapshot instead of seeding it. Distributed runs do not take
+// checkpoints yet.
+
+class Transport;
+class StateArena;
+class CheckpointSnapshot;
+class CheckpointWriter;
+
+// An event travelling to its destination LP, or the anti-message cancelling one
+struct TwMessage {
+    Event event;
+    LpId dst;
+    bool anti;
+
+    const EventKey& key() const { return event.key; }
+};
+
+enum class ExecutionMode {
+    Sequential,
+    Conservative,
+    Optimistic,
+};
+
+struct TimeWarpConfig {
+    ExecutionMode mode = ExecutionMode::Optimistic;
+    std::size_t threads = 1;          // forced to 1 in sequential mode
+    double endTime = std::numeric_limits<double>::infinity();
+    std::size_t gvtInterval = 4096;   // events a worker processes before opening a GVT round
+    std::size_t pollInterval = 16;    // events between flushing outboxes and draining the inbox
+    double optimismWindow = std::numeric_limits<double>::infinity();  // max distance ahead of GVT
+    double lookahead = 0.0;           // every LP's lookahead unless set with setLookahead()
+    Transport* transport = nullptr;   // spread the LPs over its ranks; forces optimistic mode
+    double checkpointInterval = std::numeric_limits<double>::infinity();
+    const char* checkpointPath = nullptr;  // snapshots go to <path>.0 and <path>.1 in turn
+};
+
+struct TimeWarpStats {
+    std::uint64_t processed = 0;      // forward executions, including ones later undone
+    std::uint64_t rolledBack = 0;     // undo executions
+    std::uint64_t antiMessages = 0;
+    std::uint64_t rollbacks = 0;      // straggler or anti-message rollbacks (each may undo many events)
+    std::uint64_t gvtRounds = 0;
+    std::uint64_t windows = 0;        // conservative synchronization windows
+    std::uint64_t fossilCollected = 0;  // processed events reclaimed below GVT
+    std::uint64_t peakHistory = 0;      // high-water mark of uncommitted processed events
+    std::uint64_t poolPeakBytes = 0;    // high-water mark of history/queue segments in use
+    std::uint64_t poolReservedBytes = 0;  // slab memory the worker pools obtained from the system
+    std::uint64_t checkpoints = 0;
+    std::uint64_t checkpointPages = 0;    // model state pages written by checkpoints
+    std::uint64_t pastEvents = 0;         // sends dropped for not being after the sender's time: a model bug
+    std::uint64_t lookaheadViolations = 0;  // conservative sends dropped for breaking the declared lookahead
+    double seconds = 0.0;
+
+    std::uint64_t committed() const { return processed - rolledBack; }
+};
+
+class TimeWarp {
+public:
+    struct LogicalProcess;
+    struct Worker;
+
+    TimeWarp(std::size_t lpCount, const TimeWarpConfig& config);
+    ~TimeWarp();
+
+    TimeWarp(const TimeWarp&) = delete;
+    TimeWarp& operator=(const TimeWarp&) = delete;
+
+    // Seed the model before run(); the event is sent by `dst` to itself
+    template <auto F, typename... Args>
+    void scheduleInitial(LpId dst, double timestamp, Args&&... args) {
+        seed(dst, CreateEvent<F>(timestamp, std::forward<Args>(args)...));
+    }
+
+    // Minimum delay of every event `lp` sends; enforced in conservative mode
+    void setLookahead(LpId lp, double lookahead);
+
+    // Model state written with every checkpoint; the model allocates it from `arena`
+    void attachState(StateArena& arena) { state = &arena; }
+
+    // Continue from a snapshot instead of seeding: pending events, send counters
+    // and lookaheads. The model state comes back through StateArena(snapshot).
+    // False if the snapshot holds a different number of LPs.
+    bool restore(const CheckpointSnapshot& snapshot);
+
+    void run();
+
+    // Summed over every rank in a distributed run
+    const TimeWarpStats& stats() const { return totals; }
+    std::size_t lpCount() const { return lpTotal; }
+    std::size_t rankOf(LpId lp) const { return static_cast<std::size_t>(lp) * rankCount / lpTotal; }
+    bool isLocal(LpId lp) const { return lp >= firstLocal && lp < endLocal; }
+    std::size_t workerOf(LpId lp) const { return static_cast<std::size_t>(lp - firstLocal) * config.threads / (endLocal - firstLocal); }
+
+    // Handler-side API; only valid inside a handler executed by the kernel.
+    // Kept out of line and marked reverse_ignore so the reverse-pass leaves it out
+    // of undo handlers; the kernel cancels sent messages itself.
+    template <auto F, typename... Args>
+    __attribute__((noinline, annotate("reverse_ignore"))) static void send(LpId dst, double timestamp, Args&&... args) {
+        post(dst, CreateEvent<F>(timestamp, std::forward<Args>(args)...));
+    }
+
+    static double now();
+    static LpId self();
+
+private:
+    static void post(LpId dst, const Event& event);
+
+    void seed(LpId dst, const Event& event);
+
+    struct WindowSync;
+    struct Cluster;
+
+    void runOptimistic();
+    void runWorker(Worker& worker);
+    void runSequential();
+    void runConservative();
+    void runWindows(Worker& worker, WindowSync& sync);
+    void startGvtRound();
+    void openLocalRound();
+    void pollCluster(Worker& worker);
+    void sendRemote(std::size_t rank, std::vector<TwMessage>& pending);
+    void gatherStats();
+    void pauseForCheckpoint(Worker& worker);
+    void writeCheckpoint();
+    bool checkpointPending() const;
+    double checkpointLimit() const;
+    void reportGvt(Worker& worker);
+    void fossilCollect(Worker& worker, double gvt);
+
+    void receive(Worker& worker, const TwMessage& message);
+    void processLocal(Worker& worker);
+    void route(Worker& worker, const TwMessage& message);
+    void flushOutboxes(Worker& worker);
+    void drainInbox(Worker& worker);
+
+    void pushInput(Worker& worker, LogicalProcess& lp, const TwMessage& message);
+    LogicalProcess* nextEvent(Worker& worker, double limit);
+    void processEvent(Worker& worker, LogicalProcess& lp);
+    void rollback(Worker& worker, LogicalProcess& lp, const EventKey& key);
+    double localMinimum(Worker& worker);
+
+    TimeWarpConfig config;
+    std::size_t lpTotal;
+    std::size_t rankCount = 1;
+    LpId firstLocal = 0;              // this rank's LPs are [firstLocal, endLocal)
+    LpId endLocal = 0;
+    std::vector<LogicalProcess> lps;
+    std::vector<std::unique_ptr<Worker>> workers;
+
+    // GVT round state: epoch in the high 32 bits, workers still to report (+1 while
+    // the last reporter publishes) in the low 32 bits; zero count means no round open
+    std::atomic<std::uint64_t> gvtState{0};
+    std::atomic<double> gvtValue{0.0};
+    std::unique_ptr<Cluster> cluster;
+
+    // Checkpoints; nextCheckpoint only changes while every worker is paused
+    StateArena* state = nullptr;
+    std::unique_ptr<CheckpointWriter> checkpoints;
+    std::barrier<>* checkpointPause = nullptr;
+    double restoredTime = 0.0;
+    double nextCheckpoint = std::numeric_limits<double>::infinity();
+    TimeWarpStats totals;
+};
@@ -0,0 +1,250 @@
+#include "trace.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef FRACTURE_TRACE_RING_RECORDS
+#define FRACTURE_TRACE_RING_RECORDS (1u << 16)
+#endif
+
+namespace {
+    constexpr std::uint64_t kRingRecords = FRACTURE_TRACE_RING_RECORDS;
+    static_assert((kRingRecords & (kRingRecords - 1)) == 0, "trace ring size must be a power of two");
+
+    // Single-producer single-consumer ring: the owning thread appends, the
+    // writer (holding the registry lock) drains. Rings outlive their threads so
+    // nothing recorded before a thread exits is lost, and are handed to the
+    // next new thread once released.
+    struct TraceRing {
+        alignas(64) std::atomic<std::uint64_t> head{0};      // next record the producer writes
+        alignas(64) std::atomic<std::uint64_t> tail{0};      // next record the consumer reads
+        std::atomic<std::uint64_t> dropped{0};
+        std::uint64_t reported = 0;                          // drops already written out
+        std::uint32_t thread = 0;
+        std::atomic<bool> owned{true};
+        std::unique_ptr<TraceRecord[]> records{new TraceRecord[kRingRecords]};
+    };
+
+    class TraceWriter {
+        std::mutex lock;                                     // guards rings, file and the drain
+        std::condition_variable wake;
+        std::vector<std::unique_ptr<TraceRing>> rings;
+        std::FILE* file = nullptr;
+        std::thread thread;
+        std::uint32_t nextThread = 0;
+        bool stopping = false;
+        std::size_t rank = 0;          // forked ranks write $FRACTURE_TRACE.<rank>
+        std::size_t rankFiles = 1;     // ranks whose file this run has already started
+        bool append = false;
+
+        void open() {
+            const char* base = std::getenv("FRACTURE_TRACE");
+            std::string path = base ? base : "fracture.trace";
+            if (rank > 0)
+                path += "." + std::to_string(rank);
+            file = std::fopen(path.c_str(), append ? "ab" : "wb");
+            if (!file)
+                return;
+            std::fseek(file, 0, SEEK_END);
+            if (std::ftell(file) > 0)
+                return;
+            TraceFileHeader header{};
+            std::copy(std::begin(kTraceMagic), std::end(kTraceMagic), header.magic);
+            header.version = kTraceVersion;
+            header.recordSize = sizeof(TraceRecord);
+            std::fwrite(&header, sizeof(header), 1, file);
+        }
+
+        void start() {
+            thread = std::thread([this] { loop(); });
+        }
+
+        void stop() {
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                stopping = true;
+            }
+            wake.notify_one();
+            if (thread.joinable())
+                thread.join();
+            stopping = false;
+        }
+
+        void drainLocked() {
+            if (!file)
+                return;
+            for (const auto& ring : rings) {
+                std::uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+                std::uint64_t head = ring->head.load(std::memory_order_acquire);
+                while (tail != head) {
+                    // Up to the end of the buffer, then wrap
+                    std::uint64_t begin = tail & (kRingRecords - 1);
+                    std::uint64_t run = std::min(head - tail, kRingRecords - begin);
+                    std::fwrite(&ring->records[begin], sizeof(TraceRecord), run, file);
+                    tail += run;
+                }
+                ring->tail.store(tail, std::memory_order_release);
+
+                std::uint64_t dropped = ring->dropped.load(std::memory_order_relaxed);
+                if (dropped != ring->reported) {
+                    TraceRecord record{};
+                    record.wallNs = static_cast<std::uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+                    record.value = dropped - ring->reported;
+                    record.thread = ring->thread;
+                    record.kind = TraceKind::Dropped;
+                    std::fwrite(&record, sizeof(record), 1, file);
+                    ring->reported = dropped;
+                }
+            }
+            std::fflush(file);
+        }
+
+        void loop() {
+            std::unique_lock<std::mutex> guard(lock);
+            while (!stopping) {
+                wake.wait_for(guard, std::chrono::milliseconds(10));
+                drainLocked();
+            }
+        }
+
+    public:
+        ~TraceWriter() {
+            stop();
+            std::lock_guard<std::mutex> guard(lock);
+            drainLocked();
+            if (file)
+                std::fclose(file);
+        }
+
+        TraceRing* registerThread() {
+            std::lock_guard<std::mutex> guard(lock);
+            if (rings.empty()) {
+                open();
+                start();
+            }
+
+            TraceRing* ring = nullptr;
+            for (const auto& candidate : rings) {
+                if (!candidate->owned.load(std::memory_order_acquire)) {
+                    ring = candidate.get();
+                    break;
+                }
+            }
+            if (!ring) {
+                rings.push_back(std::make_unique<TraceRing>());
+                ring = rings.back().get();
+            }
+            ring->owned.store(true, std::memory_order_relaxed);
+            ring->thread = nextThread++;
+            return ring;
+        }
+
+        void flush() {
+            std::lock_guard<std::mutex> guard(lock);
+            drainLocked();
+        }
+
+        // Everything recorded so far goes to this process's file, then the
+        // writer thread stops and the lock stays held across the fork
+        void beforeFork() {
+            stop();
+            lock.lock();
+            drainLocked();
+        }
+
+        void afterForkParent(std::size_t ranks) {
+            rankFiles = std::max(rankFiles, ranks);
+            bool running = !rings.empty();
+            lock.unlock();
+            if (running)
+                start();
+        }
+
+        // Only the forking thread exists in the child. The rings hold nothing of
+        // its own, and whatever other threads of the parent record is theirs.
+        void afterForkChild(std::size_t forkedRank, TraceRing* own) {
+            for (const auto& ring : rings) {
+                ring->tail.store(ring->head.load(std::memory_order_relaxed), std::memory_order_relaxed);
+                ring->reported = ring->dropped.load(std::memory_order_relaxed);
+                if (ring.get() != own)
+                    ring->owned.store(false, std::memory_order_relaxed);
+            }
+            // The parent's buffer was flushed, so closing writes nothing to its file
+            if (file)
+                std::fclose(file);
+            file = nullptr;
+            rank = forkedRank;
+            append = rank < rankFiles;
+            bool running = !rings.empty();
+            if (running)
+                open();
+            lock.unlock();
+            if (running)
+                start();
+        }
+    };
+
+    TraceWriter& traceWriter() {
+        static TraceWriter writer;
+        return writer;
+    }
+
+    // Releases the thread's ring when the thread exits
+    struct RingLease {
+        TraceRing* ring = nullptr;
+
+        ~RingLease() {
+            if (ring)
+                ring->owned.store(false, std::memory_order_release);
+        }
+    };
+
+    thread_local RingLease threadRing;
+}
+
+void traceWrite(TraceKind kind, double simTime, std::uint64_t value) {
+    TraceRing* ring = threadRing.ring;
+    if (!ring)
+        ring = threadRing.ring = traceWriter().registerThread();
+
+    std::uint64_t head = ring->head.load(std::memory_order_relaxed);
+    if (head - ring->tail.load(std::memory_order_acquire) == kRingRecords) {
+        ring->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    TraceRecord& record = ring->records[head & (kRingRecords - 1)];
+    record.wallNs = static_cast<std::uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+    record.simTime = simTime;
+    record.value = value;
+    record.thread = ring->thread;
+    record.kind = kind;
+    record.reserved = 0;
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+void traceFlush() {
+    traceWriter().flush();
+}
+
+void traceBeforeFork() {
+    traceWriter().beforeFork();
+}
+
+void traceAfterForkParent(std::size_t ranks) {
+    traceWriter().afterForkParent(ranks);
+}
+
+void traceAfterForkChild(std::size_t rank) {
+    traceWriter().afterForkChild(rank, threadRing.ring);
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Kernel tracing. Each trace point names a TraceKind, whose level and category
+// are fixed in kTraceKinds; a point whose level is above FRACTURE_TRACE_LEVEL or
+// whose category is not in FRACTURE_TRACE_CATEGORIES is discarded by
+// `if constexpr`, so a default build carries no tracing code at all.
+//
+// Enabled points append a 32-byte binary record to a lock-free ring owned by the
+// calling thread; a background writer drains every ring into one trace file
+// ($FRACTURE_TRACE, default fracture.trace). The producer never blocks: when its
+// ring is full the record is counted as dropped. fracture_trace_decode turns the
+// file, and those of forked ranks, into text or Chrome trace JSON.
+//
+// Build with e.g. -DFRACTURE_TRACE_LEVEL=4 (everything) or =3 with
+// -DFRACTURE_TRACE_CATEGORIES=0x0c (rollbacks and GVT only).
+
+#ifndef FRACTURE_TRACE_LEVEL
+#define FRACTURE_TRACE_LEVEL 0
+#endif
+
+#ifndef FRACTURE_TRACE_CATEGORIES
+#define FRACTURE_TRACE_CATEGORIES 0xffffffffu
+#endif
+
+enum class TraceLevel : std::uint8_t {
+    Off = 0,
+    Error = 1,
+    Warn = 2,
+    Info = 3,
+    Debug = 4,
+};
+
+enum TraceCategory : std::uint32_t {
+    TraceEvents = 1u << 0,       // forward and undo handler executions
+    TraceScheduling = 1u << 1,   // events entering the pending set
+    TraceRollback = 1u << 2,     // rollbacks and anti-messages
+    TraceGvt = 1u << 3,          // GVT rounds, conservative windows and fossil collection
+};
+
+enum class TraceKind : std::uint16_t {
+    EventBegin,      // value: forward handler (sequential) or LP id (Time Warp)
+    EventEnd,
+    UndoBegin,
+    UndoEnd,
+    Schedule,        // sim time: the event's timestamp
+    PastEvent,       // an event scheduled before the sender's time was dropped
+    MissingUndo,     // value: forward handler without an undo handler
+    Rollback,        // sim time: rollback target; value: LP id
+    AntiMessage,     // value: destination LP
+    Gvt,             // sim time: the new GVT
+    FossilCollect,   // value: history records reclaimed
+    Dropped,         // written by the trace writer; value: records lost to a full ring
+    Window,          // sim time: conservative window end; value: window number
+    Checkpoint,      // sim time: checkpoint time; value: model state pages written
+    Count
+};
+
+struct TraceKindInfo {
+    const char* name;
+    TraceLevel level;
+    TraceCategory category;
+};
+
+inline constexpr TraceKindInfo kTraceKinds[] = {
+    {"event", TraceLevel::Debug, TraceEvents},
+    {"event", TraceLevel::Debug, TraceEvents},
+    {"undo", TraceLevel::Debug, TraceEvents},
+    {"undo", TraceLevel::Debug, TraceEvents},
+    {"schedule", TraceLevel::Debug, TraceScheduling},
+    {"past event", TraceLevel::Error, TraceScheduling},
+    {"missing undo", TraceLevel::Warn, TraceScheduling},
+    {"rollback", TraceLevel::Info, TraceRollback},
+    {"anti-message", TraceLevel::Debug, TraceRollback},
+    {"gvt", TraceLevel::Info, TraceGvt},
+    {"fossil collect", TraceLevel::Info, TraceGvt},
+    {"dropped", TraceLevel::Error, TraceGvt},
+    {"window", TraceLevel::Info, TraceGvt},
+    {"checkpoint", TraceLevel::Info, TraceGvt},
+};
+static_assert(sizeof(kTraceKinds) / sizeof(kTraceKinds[0]) == static_cast<std::size_t>(TraceKind::Count));
+
+struct TraceRecord {
+    std::uint64_t wallNs;        // steady clock
+    double simTime;
+    std::uint64_t value;
+    std::uint32_t thread;        // trace-local thread number, in order of first record
+    TraceKind kind;
+    std::uint16_t reserved;
+};
+static_assert(sizeof(TraceRecord) == 32, "trace records are written to disk as-is");
+
+// Trace file: this header, then records in the order the writer drained them
+struct TraceFileHeader {
+    char magic[8];               // "FRTRACE"
+    std::uint32_t version;
+    std::uint32_t recordSize;
+};
+
+inline constexpr char kTraceMagic[8] = "FRTRACE";
+inline constexpr std::uint32_t kTraceVersion = 1;
+
+constexpr bool traceEnabled(TraceKind kind) {
+    const TraceKindInfo& info = kTraceKinds[static_cast<std::size_t>(kind)];
+    return static_cast<unsigned>(info.level) <= FRACTURE_TRACE_LEVEL &&
+           (info.category & FRACTURE_TRACE_CATEGORIES) != 0;
+}
+
+// Out of line and reverse_ignore: trace points inside handlers stay out of undo handlers
+__attribute__((noinline, annotate("reverse_ignore"))) void traceWrite(TraceKind kind, double simTime, std::uint64_t value);
+
+// Drain every thread's ring to the trace file now; the writer also does this on its own
+void traceFlush();
+
+// Forking while the writer runs would leave the child a thread object with no
+// thread behind it, possibly a held lock, and the parent's file. Forks that go
+// on tracing are bracketed by these (launchLocalRanks does): the writer drains
+// and stops before the fork, the parent restarts it, and each forked rank
+// writes $FRACTURE_TRACE.<rank>, which fracture_trace_decode merges with the
+// parent's file.
+void traceBeforeFork();
+void traceAfterForkParent(std::size_t ranks);
+void traceAfterForkChild(std::size_t rank);
+
+template <TraceKind K>
+inline void trace(double simTime, std::uint64_t value = 0) {
+    if constexpr (traceEnabled(K))
+        traceWrite(K, simTime, value);
+}
+
+template <TraceKind K, typename T>
+inline void trace(double simTime, T* pointer) {
+    trace<K>(simTime, reinterpret_cast<std::uintptr_t>(pointer));
+}
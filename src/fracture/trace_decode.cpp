@@ -0,0 +1,140 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "trace.hpp"
+
+// Offline decoder for trace files written by the tracing runtime (trace.hpp).
+// Usage: fracture_trace_decode [--text | --chrome] [trace=fracture.trace] [rank traces...]
+//   --text    one line per record (default)
+//   --chrome  Chrome trace JSON, for chrome://tracing or Perfetto
+// Ranks forked by launchLocalRanks write <trace>.1, <trace>.2, ...; given one
+// trace, the decoder also reads those that exist and merges every file into one
+// timeline, the n-th file being rank n. Wall times come from the steady clock,
+// which processes on one machine share.
+
+namespace {
+    const char* levelName(TraceLevel level) {
+        switch (level) {
+        case TraceLevel::Error: return "error";
+        case TraceLevel::Warn: return "warn";
+        case TraceLevel::Info: return "info";
+        case TraceLevel::Debug: return "debug";
+        default: return "off";
+        }
+    }
+
+    struct RankRecord {
+        TraceRecord record;
+        std::uint32_t rank;
+    };
+
+    bool readTrace(const char* path, std::uint32_t rank, std::vector<RankRecord>& records) {
+        std::FILE* file = std::fopen(path, "rb");
+        if (!file) {
+            std::fprintf(stderr, "cannot open %s\n", path);
+            return false;
+        }
+
+        TraceFileHeader header{};
+        if (std::fread(&header, sizeof(header), 1, file) != 1 || std::memcmp(header.magic, kTraceMagic, sizeof(kTraceMagic)) != 0) {
+            std::fprintf(stderr, "%s is not a fracture trace\n", path);
+            std::fclose(file);
+            return false;
+        }
+        if (header.version != kTraceVersion || header.recordSize != sizeof(TraceRecord)) {
+            std::fprintf(stderr, "%s: unsupported trace version %u (record size %u)\n", path, header.version, header.recordSize);
+            std::fclose(file);
+            return false;
+        }
+
+        TraceRecord record;
+        while (std::fread(&record, sizeof(record), 1, file) == 1) {
+            if (static_cast<std::size_t>(record.kind) < static_cast<std::size_t>(TraceKind::Count))
+                records.push_back({record, rank});
+        }
+        std::fclose(file);
+        return true;
+    }
+
+    bool exists(const std::string& path) {
+        std::FILE* file = std::fopen(path.c_str(), "rb");
+        if (file)
+            std::fclose(file);
+        return file != nullptr;
+    }
+
+    void printText(const std::vector<RankRecord>& records, bool ranked) {
+        std::uint64_t origin = records.empty() ? 0 : records.front().record.wallNs;
+        for (const auto& [record, rank] : records) {
+            const TraceKindInfo& info = kTraceKinds[static_cast<std::size_t>(record.kind)];
+            const char* phase = record.kind == TraceKind::EventBegin || record.kind == TraceKind::UndoBegin ? " begin"
+                              : record.kind == TraceKind::EventEnd || record.kind == TraceKind::UndoEnd   ? " end"
+                                                                                                          : "";
+            std::printf("%14.3f us  ", (record.wallNs - origin) / 1e3);
+            if (ranked)
+                std::printf("rank %-3u ", rank);
+            // Small values are ids and counts, large ones handler addresses
+            std::printf(record.value >> 32 ? "thread %-3u %-5s %s%s  sim %.9g  value %#llx\n"
+                                           : "thread %-3u %-5s %s%s  sim %.9g  value %llu\n",
+                        record.thread, levelName(info.level), info.name, phase,
+                        record.simTime, static_cast<unsigned long long>(record.value));
+        }
+    }
+
+    // One Chrome process per rank
+    void printChrome(const std::vector<RankRecord>& records) {
+        std::uint64_t origin = records.empty() ? 0 : records.front().record.wallNs;
+        std::printf("{\"traceEvents\":[\n");
+        for (std::size_t i = 0; i < records.size(); ++i) {
+            const auto& [record, rank] = records[i];
+            const TraceKindInfo& info = kTraceKinds[static_cast<std::size_t>(record.kind)];
+            const char* phase = record.kind == TraceKind::EventBegin || record.kind == TraceKind::UndoBegin ? "B"
+                              : record.kind == TraceKind::EventEnd || record.kind == TraceKind::UndoEnd   ? "E"
+                                                                                                          : "i";
+            std::printf("{\"name\":\"%s\",\"ph\":\"%s\",%s\"ts\":%.3f,\"pid\":%u,\"tid\":%u,"
+                        "\"args\":{\"sim\":%.17g,\"value\":%llu}}%s\n",
+                        info.name, phase, phase[0] == 'i' ? "\"s\":\"t\"," : "", (record.wallNs - origin) / 1e3,
+                        rank, record.thread, record.simTime, static_cast<unsigned long long>(record.value),
+                        i + 1 < records.size() ? "," : "");
+        }
+        std::printf("],\"displayTimeUnit\":\"ns\"}\n");
+    }
+}
+
+int main(int argc, char** argv) {
+    bool chrome = false;
+    std::vector<std::string> paths;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--chrome") == 0)
+            chrome = true;
+        else if (std::strcmp(argv[i], "--text") == 0)
+            chrome = false;
+        else
+            paths.push_back(argv[i]);
+    }
+    if (paths.empty())
+        paths.push_back("fracture.trace");
+    if (paths.size() == 1) {
+        for (std::size_t rank = 1; exists(paths[0] + "." + std::to_string(rank)); ++rank)
+            paths.push_back(paths[0] + "." + std::to_string(rank));
+    }
+
+    std::vector<RankRecord> records;
+    for (std::size_t rank = 0; rank < paths.size(); ++rank) {
+        if (!readTrace(paths[rank].c_str(), static_cast<std::uint32_t>(rank), records))
+            return 1;
+    }
+
+    // The writers drain thread by thread; put every thread of every rank back on one timeline
+    std::stable_sort(records.begin(), records.end(), [](const RankRecord& lhs, const RankRecord& rhs) {
+        return lhs.record.wallNs < rhs.record.wallNs;
+    });
+
+    if (chrome)
+        printChrome(records);
+    else
+        printText(records, paths.size() > 1);
+    return 0;
+}
@@ -0,0 +1,293 @@
+#include "transport.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <thread>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "trace.hpp"
+
+namespace {
+    using FrameLength = std::uint32_t;
+
+    // One socketpair per pair of ranks; each rank keeps its own ends
+    class SocketTransport : public StreamTransport {
+    public:
+        SocketTransport(std::size_t rank, std::vector<int> links)
+            : StreamTransport(rank, links.size()), fds(std::move(links)) {}
+
+        ~SocketTransport() override {
+            for (int fd : fds)
+                if (fd >= 0)
+                    ::close(fd);
+        }
+
+    protected:
+        std::size_t writeSome(std::size_t dst, const unsigned char* data, std::size_t bytes) override {
+            ssize_t written = ::send(fds[dst], data, bytes, MSG_NOSIGNAL);
+            return written > 0 ? static_cast<std::size_t>(written) : 0;
+        }
+
+        std::size_t readSome(std::size_t src, unsigned char* data, std::size_t bytes) override {
+            ssize_t read = ::recv(fds[src], data, bytes, 0);
+            return read > 0 ? static_cast<std::size_t>(read) : 0;
+        }
+
+        void wait(std::size_t dst) override {
+            std::vector<pollfd> polled;
+            for (std::size_t r = 0; r < fds.size(); ++r) {
+                if (fds[r] >= 0)
+                    polled.push_back({fds[r], static_cast<short>(r == dst ? POLLIN | POLLOUT : POLLIN), 0});
+            }
+            ::poll(polled.data(), polled.size(), 10);
+        }
+
+    private:
+        std::vector<int> fds;   // per peer rank, -1 for ourselves
+    };
+
+    // Byte ring written by one rank and read by another. The counters only grow;
+    // each side owns one of them.
+    struct alignas(64) SharedRing {
+        static constexpr std::size_t kBytes = std::size_t(1) << 20;
+
+        alignas(64) std::atomic<std::uint64_t> head;   // bytes written, producer side
+        alignas(64) std::atomic<std::uint64_t> tail;   // bytes read, consumer side
+        alignas(64) unsigned char data[kBytes];
+    };
+
+    class SharedMemoryTransport : public StreamTransport {
+    public:
+        SharedMemoryTransport(std::size_t rank, std::size_t ranks, SharedRing* rings, std::size_t mappedBytes)
+            : StreamTransport(rank, ranks), rings(rings), mappedBytes(mappedBytes) {}
+
+        ~SharedMemoryTransport() override {
+            ::munmap(rings, mappedBytes);
+        }
+
+    protected:
+        std::size_t writeSome(std::size_t dst, const unsigned char* data, std::size_t bytes) override {
+            SharedRing& ring = rings[rank() * ranks() + dst];
+            std::uint64_t head = ring.head.load(std::memory_order_relaxed);
+            std::uint64_t tail = ring.tail.load(std::memory_order_acquire);
+            std::size_t count = std::min<std::size_t>(bytes, SharedRing::kBytes - (head - tail));
+            copyIn(ring, head, data, count);
+            ring.head.store(head + count, std::memory_order_release);
+            return count;
+        }
+
+        std::size_t readSome(std::size_t src, unsigned char* data, std::size_t bytes) override {
+            SharedRing& ring = rings[src * ranks() + rank()];
+            std::uint64_t tail = ring.tail.load(std::memory_order_relaxed);
+            std::uint64_t head = ring.head.load(std::memory_order_acquire);
+            std::size_t count = std::min<std::size_t>(bytes, head - tail);
+            copyOut(ring, tail, data, count);
+            ring.tail.store(tail + count, std::memory_order_release);
+            return count;
+        }
+
+        void wait(std::size_t) override {
+            std::this_thread::yield();
+        }
+
+    private:
+        static void copyIn(SharedRing& ring, std::uint64_t position, const unsigned char* data, std::size_t count) {
+            std::size_t offset = position % SharedRing::kBytes;
+            std::size_t first = std::min(count, SharedRing::kBytes - offset);
+            std::memcpy(ring.data + offset, data, first);
+            std::memcpy(ring.data, data + first, count - first);
+        }
+
+        static void copyOut(const SharedRing& ring, std::uint64_t position, unsigned char* data, std::size_t count) {
+            std::size_t offset = position % SharedRing::kBytes;
+            std::size_t first = std::min(count, SharedRing::kBytes - offset);
+            std::memcpy(data, ring.data + offset, first);
+            std::memcpy(data + first, ring.data, count - first);
+        }
+
+        SharedRing* rings;   // [source * ranks + destination]
+        std::size_t mappedBytes;
+    };
+}
+
+bool Transport::receive(std::vector<unsigned char>& message, std::size_t& source) {
+    {
+        std::lock_guard<std::mutex> guard(returnedLock);
+        if (!returned.empty()) {
+            source = returned.back().first;
+            message.swap(returned.back().second);
+            returned.pop_back();
+            return true;
+        }
+    }
+    return receiveNext(message, source);
+}
+
+void Transport::putBack(std::vector<unsigned char> message, std::size_t source) {
+    std::lock_guard<std::mutex> guard(returnedLock);
+    returned.emplace_back(source, std::move(message));
+}
+
+StreamTransport::StreamTransport(std::size_t rank, std::size_t ranks)
+    : Transport(rank, ranks), partial(ranks), partialStart(ranks, 0) {}
+
+StreamTransport::~StreamTransport() {
+    for (pid_t child : children)
+        ::waitpid(child, nullptr, 0);
+}
+
+void StreamTransport::send(std::size_t dst, const void* data, std::size_t bytes) {
+    std::lock_guard<std::mutex> guard(lock);
+    FrameLength length = static_cast<FrameLength>(bytes);
+    writeAll(dst, reinterpret_cast<const unsigned char*>(&length), sizeof(length));
+    writeAll(dst, static_cast<const unsigned char*>(data), bytes);
+}
+
+void StreamTransport::writeAll(std::size_t dst, const unsigned char* data, std::size_t bytes) {
+    while (bytes > 0) {
+        std::size_t written = writeSome(dst, data, bytes);
+        data += written;
+        bytes -= written;
+        if (written == 0) {
+            // The peer may itself be blocked sending to us
+            pump();
+            wait(dst);
+        }
+    }
+}
+
+bool StreamTransport::receiveNext(std::vector<unsigned char>& message, std::size_t& source) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (arrivedStart == arrived.size())
+        pump();
+    if (arrivedStart == arrived.size())
+        return false;
+
+    Arrived& next = arrived[arrivedStart++];
+    source = next.source;
+    message.swap(next.bytes);
+    if (arrivedStart == arrived.size()) {
+        arrived.clear();
+        arrivedStart = 0;
+    }
+    return true;
+}
+
+void StreamTransport::pump() {
+    constexpr std::size_t kChunk = 64 * 1024;
+    for (std::size_t src = 0; src < ranks(); ++src) {
+        if (src == rank())
+            continue;
+
+        std::vector<unsigned char>& bytes = partial[src];
+        scratch.resize(kChunk);
+        while (std::size_t read = readSome(src, scratch.data(), kChunk))
+            bytes.insert(bytes.end(), scratch.begin(), scratch.begin() + static_cast<std::ptrdiff_t>(read));
+
+        // Cut out every complete message
+        std::size_t& start = partialStart[src];
+        while (bytes.size() - start >= sizeof(FrameLength)) {
+            FrameLength length;
+            std::memcpy(&length, bytes.data() + start, sizeof(length));
+            if (bytes.size() - start - sizeof(length) < length)
+                break;
+            const unsigned char* body = bytes.data() + start + sizeof(length);
+            arrived.push_back({src, std::vector<unsigned char>(body, body + length)});
+            start += sizeof(length) + length;
+        }
+        if (start == bytes.size()) {
+            bytes.clear();
+            start = 0;
+        } else if (start > kChunk) {
+            bytes.erase(bytes.begin(), bytes.begin() + static_cast<std::ptrdiff_t>(start));
+            start = 0;
+        }
+    }
+}
+
+std::unique_ptr<Transport> launchLocalRanks(std::size_t ranks, TransportKind kind) {
+    if (ranks == 0)
+        return nullptr;
+
+    // Links are created before forking so every rank inherits them
+    std::vector<std::vector<int>> links(ranks, std::vector<int>(ranks, -1));
+    SharedRing* rings = nullptr;
+    std::size_t mappedBytes = ranks * ranks * sizeof(SharedRing);
+    if (kind == TransportKind::Socket) {
+        for (std::size_t a = 0; a < ranks; ++a) {
+            for (std::size_t b = a + 1; b < ranks; ++b) {
+                int pair[2];
+                if (::socketpair(AF_UNIX, SOCK_STREAM, 0, pair) != 0) {
+                    std::perror("socketpair");
+                    return nullptr;
+                }
+                for (int fd : pair)
+                    ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+                links[a][b] = pair[0];
+                links[b][a] = pair[1];
+            }
+        }
+    } else {
+        void* mapped = ::mmap(nullptr, mappedBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (mapped == MAP_FAILED) {
+            std::perror("mmap");
+            return nullptr;
+        }
+        rings = static_cast<SharedRing*>(mapped);
+        for (std::size_t i = 0; i < ranks * ranks; ++i) {
+            new (&rings[i].head) std::atomic<std::uint64_t>(0);
+            new (&rings[i].tail) std::atomic<std::uint64_t>(0);
+        }
+    }
+
+    // Buffered output would otherwise be written once per rank; the trace
+    // writer's thread would not survive the fork
+    std::fflush(nullptr);
+    traceBeforeFork();
+    std::size_t rank = 0;
+    std::vector<pid_t> children;
+    for (std::size_t r = 1; r < ranks; ++r) {
+        pid_t child = ::fork();
+        if (child < 0) {
+            std::perror("fork");
+            traceAfterForkParent(r);
+            for (pid_t started : children) {
+                ::kill(started, SIGKILL);
+                ::waitpid(started, nullptr, 0);
+            }
+            return nullptr;
+        }
+        if (child == 0) {
+            rank = r;
+            children.clear();
+            traceAfterForkChild(rank);
+            break;
+        }
+        children.push_back(child);
+    }
+    if (rank == 0)
+        traceAfterForkParent(ranks);
+
+    std::unique_ptr<StreamTransport> transport;
+    if (kind == TransportKind::Socket) {
+        // Keep only this rank's ends
+        for (std::size_t a = 0; a < ranks; ++a)
+            for (std::size_t b = 0; b < ranks; ++b)
+                if (a != rank && links[a][b] >= 0)
+                    ::close(links[a][b]);
+        transport.reset(new SocketTransport(rank, links[rank]));
+    } else {
+        transport.reset(new SharedMemoryTransport(rank, ranks, rings, mappedBytes));
+    }
+    transport->children = std::move(children);
+    return transport;
+}
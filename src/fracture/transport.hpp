@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+#include <sys/types.h>
+
+// Message transport between the ranks (processes) of a distributed Time Warp
+// run. A message is a byte string; messages on one link arrive whole and in the
+// order they were sent. Transports are shared by a rank's worker threads: any
+// of them may send, one receives at a time. A send waits while its link is
+// full, and keeps receiving meanwhile, so two ranks sending to each other
+// cannot deadlock.
+class Transport {
+public:
+    Transport(std::size_t rank, std::size_t ranks) : rankId(rank), rankCount(ranks) {}
+    virtual ~Transport() = default;
+
+    Transport(const Transport&) = delete;
+    Transport& operator=(const Transport&) = delete;
+
+    std::size_t rank() const { return rankId; }
+    std::size_t ranks() const { return rankCount; }
+
+    virtual void send(std::size_t dst, const void* data, std::size_t bytes) = 0;
+
+    // Next message from any rank; false if none has arrived
+    bool receive(std::vector<unsigned char>& message, std::size_t& source);
+
+    // Hands a received message back; it is received again before anything else
+    void putBack(std::vector<unsigned char> message, std::size_t source);
+
+protected:
+    virtual bool receiveNext(std::vector<unsigned char>& message, std::size_t& source) = 0;
+
+private:
+    std::size_t rankId;
+    std::size_t rankCount;
+    std::mutex returnedLock;
+    std::vector<std::pair<std::size_t, std::vector<unsigned char>>> returned;   // newest last
+};
+
+// Backends for ranks on one machine
+enum class TransportKind {
+    Socket,         // a Unix stream socket per pair of ranks
+    SharedMemory,   // a single-producer byte ring per ordered pair of ranks, in one shared mapping
+};
+
+// Forks `ranks` - 1 copies of the calling process and connects all of them;
+// returns this process's end, rank 0 in the caller. Everything set up before
+// the call (model state, handler and argument addresses) is at the same
+// address in every rank, so events can travel as raw bytes. Rank 0's
+// transport reaps the other ranks when it is destroyed; the others should
+// exit once they are done. Returns nullptr if the links cannot be created.
+std::unique_ptr<Transport> launchLocalRanks(std::size_t ranks, TransportKind kind);
+
+// Length-framed messages over one byte stream per link; backends provide the
+// raw nonblocking reads and writes
+class StreamTransport : public Transport {
+public:
+    ~StreamTransport() override;
+
+    void send(std::size_t dst, const void* data, std::size_t bytes) override;
+
+protected:
+    StreamTransport(std::size_t rank, std::size_t ranks);
+
+    bool receiveNext(std::vector<unsigned char>& message, std::size_t& source) override;
+
+    // Bytes moved, 0 when the link is full or empty
+    virtual std::size_t writeSome(std::size_t dst, const unsigned char* data, std::size_t bytes) = 0;
+    virtual std::size_t readSome(std::size_t src, unsigned char* data, std::size_t bytes) = 0;
+    // Blocks briefly until `dst` may take more bytes or something arrives
+    virtual void wait(std::size_t dst) = 0;
+
+private:
+    friend std::unique_ptr<Transport> launchLocalRanks(std::size_t ranks, TransportKind kind);
+
+    struct Arrived {
+        std::size_t source;
+        std::vector<unsigned char> bytes;
+    };
+
+    void writeAll(std::size_t dst, const unsigned char* data, std::size_t bytes);
+    void pump();
+
+    std::mutex lock;
+    std::vector<std::vector<unsigned char>> partial;   // per source: bytes of incomplete messages
+    std::vector<std::size_t> partialStart;             // per source: start of the first one
+    std::vector<unsigned char> scratch;
+    std::vector<Arrived> arrived;                      // complete messages, oldest first
+    std::size_t arrivedStart = 0;
+    std::vector<pid_t> children;                       // ranks forked by rank 0
+};
@@ -0,0 +1,356 @@
+#include "verify.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <type_traits>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "profile.hpp"
+#include "reverse_log.hpp"
+
+// Bounds of the program's writable data, from the C runtime and the linker;
+// weak, so the global data check is skipped where they are missing
+extern "C" {
+    extern char __data_start[] __attribute__((weak));
+    extern char _end[] __attribute__((weak));
+}
+
+namespace {
+    constexpr std::size_t kBufferAlignment = 64;
+    constexpr std::size_t kRedZone = 64;
+    // Words under each trial's log records, so an undo handler that pops too much reads these instead of nothing
+    constexpr std::size_t kLogSentinels = 16;
+
+    std::uint64_t mix(std::uint64_t x) {
+        x ^= x >> 30;
+        x *= 0xbf58476d1ce4e5b9ULL;
+        x ^= x >> 27;
+        x *= 0x94d049bb133111ebULL;
+        return x ^ (x >> 31);
+    }
+
+    std::uint64_t trialSeed(const VerifyConfig& config, std::size_t handler, std::size_t trial) {
+        return mix(mix(config.seed + handler) + trial);
+    }
+
+    struct Random {
+        std::uint64_t state;
+
+        std::uint64_t next() { return mix(state += 0x9e3779b97f4a7c15ULL); }
+
+        double real() { return (static_cast<double>(next() >> 11) * 0x1.0p-53 - 0.5) * 2048.0; }
+
+        // Mostly values real state holds: zero, small counts and ordinary
+        // doubles, so loop bounds and arithmetic stay within reason
+        std::uint64_t word() {
+            std::uint64_t r = next();
+            switch (r & 3) {
+            case 0:
+                return 0;
+            case 1:
+                return (r >> 2) & 0xff;
+            case 2: {
+                double value = real();
+                std::uint64_t bits;
+                std::memcpy(&bits, &value, sizeof(bits));
+                return bits;
+            }
+            default:
+                return next();
+            }
+        }
+    };
+
+    struct Parameter {
+        char kind;                 // 'p', 'i', 'f' or 'd'
+        std::size_t size;          // pointer: buffer bytes; integer: bits
+        std::size_t offset = 0;    // pointer: buffer offset in the trial memory
+    };
+
+    // One handler's trials: parameters, the memory they point into and the running totals
+    class Harness {
+    public:
+        Harness(const VerifyEntry& entry, const VerifyConfig& config) : entry(entry) {
+            result.name = entry.name;
+            result.signature = entry.signature;
+
+            const char* token = entry.signature;
+            while (*token) {
+                char* end = const_cast<char*>(token) + 1;
+                std::size_t size = std::strtoull(token + 1, &end, 10);
+                switch (*token) {
+                case 'p':
+                    parameters.push_back({'p', size ? size : config.pointerBytes});
+                    break;
+                case 'i':
+                    parameters.push_back({'i', size});
+                    break;
+                case 'f':
+                case 'd':
+                    parameters.push_back({*token, 0});
+                    break;
+                default:
+                    result.supported = false;
+                    return;
+                }
+                token = *end == ' ' ? end + 1 : end;
+            }
+
+            std::size_t bytes = 0;
+            for (Parameter& parameter : parameters) {
+                if (parameter.kind != 'p')
+                    continue;
+                parameter.offset = (bytes + kBufferAlignment - 1) / kBufferAlignment * kBufferAlignment;
+                bytes = parameter.offset + parameter.size + kRedZone;
+            }
+            memory.resize((bytes + kBufferAlignment) / sizeof(std::uint64_t));
+            before.resize(bytes);
+            base = reinterpret_cast<unsigned char*>(
+                (reinterpret_cast<std::uintptr_t>(memory.data()) + kBufferAlignment - 1) & ~(kBufferAlignment - 1));
+
+            values.resize(parameters.size());
+            slots.resize(parameters.size());
+            for (std::size_t i = 0; i < parameters.size(); ++i)
+                slots[i] = &values[i];
+
+            if (__data_start && _end && +__data_start < +_end)
+                globals.resize(static_cast<std::size_t>(_end - __data_start));
+
+            // Timer overhead, subtracted from every measurement
+            timerOverhead = ~std::uint64_t{0};
+            for (int i = 0; i < 64; ++i) {
+                std::uint64_t start = profileCycles();
+                timerOverhead = std::min(timerOverhead, profileCycles() - start);
+            }
+
+            for (std::size_t i = 0; i < kLogSentinels; ++i)
+                log.push(~std::uint64_t{0});
+        }
+
+        bool supported() const { return result.supported; }
+
+        void trial(std::uint64_t seed, bool checkGlobals) {
+            Random random{seed};
+            for (std::size_t i = 0; i < before.size(); i += sizeof(std::uint64_t)) {
+                std::uint64_t word = random.word();
+                std::memcpy(base + i, &word, std::min(sizeof(word), before.size() - i));
+            }
+            for (std::size_t i = 0; i < parameters.size(); ++i) {
+                const Parameter& parameter = parameters[i];
+                values[i] = 0;
+                if (parameter.kind == 'p') {
+                    values[i] = reinterpret_cast<std::uintptr_t>(base + parameter.offset);
+                } else if (parameter.kind == 'i') {
+                    std::uint64_t word = random.word();
+                    values[i] = parameter.size >= 64 ? word : word & ((std::uint64_t{1} << parameter.size) - 1);
+                } else if (parameter.kind == 'f') {
+                    float value = static_cast<float>(random.real());
+                    std::memcpy(&values[i], &value, sizeof(value));
+                } else {
+                    double value = random.real();
+                    std::memcpy(&values[i], &value, sizeof(value));
+                }
+            }
+            std::memcpy(before.data(), base, before.size());
+            if (checkGlobals && !globals.empty())
+                std::memcpy(globals.data(), __data_start, globals.size());
+
+            ReverseLogScope scope(log);
+            std::uint64_t position = log.position();
+            std::uint64_t start = profileCycles();
+            entry.callForward(slots.data());
+            std::uint64_t forward = profileCycles() - start;
+            log.endForward();
+            std::uint64_t saved = log.position() - position;
+
+            log.beginUndo();
+            start = profileCycles();
+            entry.callUndo(slots.data());
+            std::uint64_t undo = profileCycles() - start;
+
+            ++result.trials;
+            forwardCycles += forward > timerOverhead ? forward - timerOverhead : 0;
+            undoCycles += undo > timerOverhead ? undo - timerOverhead : 0;
+            logWords += saved;
+
+            bool logMismatch = log.position() != position;
+            if (logMismatch) {
+                ++result.logMismatches;
+                while (log.position() < position)
+                    log.push(~std::uint64_t{0});
+                log.truncate(position);
+            }
+
+            bool mismatch = false;
+            if (std::memcmp(base, before.data(), before.size()) != 0) {
+                mismatch = true;
+                std::size_t i = 0;
+                while (base[i] == before[i])
+                    ++i;
+                // Red zones belong to the buffer before them
+                for (std::size_t p = 0; p < parameters.size(); ++p) {
+                    if (parameters[p].kind == 'p' && i >= parameters[p].offset && !located) {
+                        result.firstArgument = static_cast<int>(p);
+                        result.firstOffset = i - parameters[p].offset;
+                    }
+                }
+            } else if (checkGlobals && !globals.empty() && std::memcmp(__data_start, globals.data(), globals.size()) != 0) {
+                mismatch = true;
+                std::size_t i = 0;
+                while (static_cast<unsigned char>(__data_start[i]) == globals[i])
+                    ++i;
+                if (!located) {
+                    result.firstArgument = -1;
+                    result.firstOffset = i;
+                }
+            }
+            if (mismatch) {
+                ++result.mismatches;
+                located = true;
+            }
+            if ((mismatch || logMismatch) && !failed) {
+                result.firstSeed = seed;
+                failed = true;
+            }
+        }
+
+        VerifyResult finish() {
+            if (result.trials) {
+                result.forwardCycles = static_cast<double>(forwardCycles) / result.trials;
+                result.undoCycles = static_cast<double>(undoCycles) / result.trials;
+                result.logWords = static_cast<double>(logWords) / result.trials;
+            }
+            return result;
+        }
+
+    private:
+        const VerifyEntry& entry;
+        VerifyResult result{};
+        std::vector<Parameter> parameters;
+        std::vector<std::uint64_t> memory;   // the pointed-to buffers, each followed by its red zone
+        unsigned char* base = nullptr;       // memory, aligned
+        std::vector<unsigned char> before;
+        std::vector<unsigned char> globals;
+        std::vector<std::uint64_t> values;   // parameter values, one word each
+        std::vector<void*> slots;
+        ReverseLog log;
+        std::uint64_t timerOverhead = 0;
+        std::uint64_t forwardCycles = 0;
+        std::uint64_t undoCycles = 0;
+        std::uint64_t logWords = 0;
+        bool failed = false;    // firstSeed is set
+        bool located = false;   // firstArgument and firstOffset are set
+    };
+
+    VerifyResult verifyHandler(const VerifyEntry& entry, std::size_t index, const VerifyConfig& config) {
+        Harness harness(entry, config);
+        if (!harness.supported())
+            return harness.finish();
+        for (std::size_t trial = 0; trial < config.trials; ++trial)
+            harness.trial(trialSeed(config, index, trial), trial > 0);
+        return harness.finish();
+    }
+
+    static_assert(std::is_trivially_copyable_v<VerifyResult>, "results come back from the child as bytes");
+
+    // The child writes its result to a pipe; a child that dies first leaves the signal
+    VerifyResult verifyIsolated(const VerifyEntry& entry, std::size_t index, const VerifyConfig& config) {
+        VerifyResult result{};
+        result.name = entry.name;
+        result.signature = entry.signature;
+
+        int fds[2];
+        if (pipe(fds) != 0)
+            return verifyHandler(entry, index, config);
+        std::fflush(nullptr);
+        pid_t pid = fork();
+        if (pid < 0) {
+            close(fds[0]);
+            close(fds[1]);
+            return verifyHandler(entry, index, config);
+        }
+        if (pid == 0) {
+            close(fds[0]);
+            alarm(config.timeoutSeconds);
+            VerifyResult child = verifyHandler(entry, index, config);
+            const char* data = reinterpret_cast<const char*>(&child);
+            for (std::size_t sent = 0; sent < sizeof(child);) {
+                ssize_t n = write(fds[1], data + sent, sizeof(child) - sent);
+                if (n <= 0)
+                    _exit(1);
+                sent += static_cast<std::size_t>(n);
+            }
+            _exit(0);
+        }
+
+        close(fds[1]);
+        VerifyResult received;
+        std::size_t got = 0;
+        while (got < sizeof(received)) {
+            ssize_t n = read(fds[0], reinterpret_cast<char*>(&received) + got, sizeof(received) - got);
+            if (n <= 0)
+                break;
+            got += static_cast<std::size_t>(n);
+        }
+        close(fds[0]);
+
+        int status = 0;
+        while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+        }
+        if (got == sizeof(received))
+            return received;
+        result.signal = WIFSIGNALED(status) ? WTERMSIG(status) : -1;
+        return result;
+    }
+}
+
+std::vector<VerifyResult> verifyUndoHandlers(const VerifyConfig& config) {
+    std::vector<VerifyResult> results;
+    std::size_t index = 0;
+    for (const VerifyEntry* entry = __start_fracture_verify; entry != __stop_fracture_verify; ++entry, ++index) {
+        if (config.filter && !std::strstr(entry->name, config.filter))
+            continue;
+        results.push_back(config.isolate ? verifyIsolated(*entry, index, config) : verifyHandler(*entry, index, config));
+    }
+    return results;
+}
+
+VerifyResult verifyTrial(const VerifyEntry& entry, std::uint64_t trialSeed, const VerifyConfig& config) {
+    Harness harness(entry, config);
+    if (harness.supported())
+        harness.trial(trialSeed, true);
+    return harness.finish();
+}
+
+void verifyDump(const std::vector<VerifyResult>& results, std::FILE* out) {
+    std::fprintf(out, "%-8s %10s %10s %10s %14s %14s %8s %10s  %s\n", "status", "trials", "mismatch", "log",
+                 "fwd cycles/op", "undo cycles/op", "undo/fwd", "log words", "handler");
+    for (const VerifyResult& result : results) {
+        const char* status = result.passed()                      ? "ok"
+                             : !result.supported                  ? "skipped"
+                             : result.signal == SIGALRM           ? "timeout"
+                             : result.signal != 0                 ? "crashed"
+                                                                  : "FAILED";
+        std::fprintf(out, "%-8s %10zu %10zu %10zu %14.1f %14.1f %8.2f %10.2f  %s [%s]\n", status, result.trials,
+                     result.mismatches, result.logMismatches, result.forwardCycles, result.undoCycles,
+                     result.forwardCycles > 0 ? result.undoCycles / result.forwardCycles : 0.0, result.logWords,
+                     result.name, result.signature);
+
+        if (result.signal > 0)
+            std::fprintf(out, "%8s signal %d (%s)\n", "", result.signal, strsignal(result.signal));
+        else if (result.signal < 0)
+            std::fprintf(out, "%8s exited without a result\n", "");
+        else if (result.mismatches && result.firstArgument < 0)
+            std::fprintf(out, "%8s first mismatch: global data byte %zu; first failing trial seed %#llx\n", "",
+                         result.firstOffset, static_cast<unsigned long long>(result.firstSeed));
+        else if (result.mismatches)
+            std::fprintf(out, "%8s first mismatch: argument %d byte %zu; first failing trial seed %#llx\n", "",
+                         result.firstArgument, result.firstOffset, static_cast<unsigned long long>(result.firstSeed));
+        else if (result.logMismatches)
+            std::fprintf(out, "%8s undo handler left the reverse log elsewhere; first failing trial seed %#llx\n", "",
+                         static_cast<unsigned long long>(result.firstSeed));
+    }
+}
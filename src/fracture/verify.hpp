@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+// Undo handler verifier. A wrong undo handler does not fail loudly: the
+// optimistic kernel rolls back into a state that was never reached and the run
+// silently computes a different answer. The verifier checks every handler on
+// its own instead, with state nobody wrote a test for.
+//
+// Targets built with add_reverse_test(... VERIFY) carry a table the
+// reverse-pass emits (reverse-pass<verify>): for each handler annotated
+// "reverse", its undo handler, thunks that call both from an array of argument
+// slots, and a description of the parameters. For every trial the verifier
+// makes up arguments from a seeded random stream, pointer arguments pointing at
+// buffers of random words, runs the forward handler and then the undo handler,
+// and compares byte for byte
+//  - every pointed-to buffer, plus a red zone after it that catches stray writes,
+//  - the program's global data, except on the first trial, when function-local
+//    statics may still be initializing, and
+//  - the reverse log position: the undo handler pops exactly what the forward pushed.
+// It also times both handlers, in the cycles of profile.hpp.
+//
+// Random state can send a handler off the rails (a garbage pointer inside a
+// struct, a loop running for 2^63 iterations), so by default each handler is
+// verified in a forked child with a time limit, and a crash is reported as such.
+// Handlers that send events may be verified too: outside a kernel
+// TimeWarp::send drops the event.
+
+// Entry of the table emitted by reverse-pass<verify>
+struct VerifyEntry {
+    void* forward;
+    void* undo;
+    const char* name;                          // demangled forward handler
+    void (*callForward)(void* const* slots);   // slots[i] points to the value of parameter i
+    void (*callUndo)(void* const* slots);
+    const char* signature;                     // "p<bytes>", "i<bits>", "f", "d" or "?" per parameter
+};
+
+// Emitted by reverse-pass<verify>; weak so a program built without it still links
+extern "C" {
+    extern const VerifyEntry __start_fracture_verify[] __attribute__((weak));
+    extern const VerifyEntry __stop_fracture_verify[] __attribute__((weak));
+}
+
+struct VerifyConfig {
+    std::size_t trials = 1000;         // per handler
+    std::uint64_t seed = 1;
+    std::size_t pointerBytes = 256;    // buffer for a pointer parameter of unknown size
+    const char* filter = nullptr;      // only handlers whose name contains it
+    bool isolate = true;               // each handler in a forked child
+    unsigned timeoutSeconds = 10;      // per handler, when isolated
+};
+
+struct VerifyResult {
+    const char* name;
+    const char* signature;
+    bool supported = true;             // false: a parameter the verifier cannot make up
+    int signal = 0;                    // the child died on it (SIGALRM: timed out); -1: exited without a result
+    std::size_t trials = 0;            // trials completed
+    std::size_t mismatches = 0;        // trials whose state the undo handler left changed
+    std::size_t logMismatches = 0;     // trials whose undo handler left the reverse log elsewhere
+    int firstArgument = -1;            // first mismatch: parameter index, -1 for global data,
+    std::size_t firstOffset = 0;       // and the byte offset in it
+    std::uint64_t firstSeed = 0;       // reproduces the first failing trial with verifyTrial
+    double forwardCycles = 0.0;        // mean per call
+    double undoCycles = 0.0;
+    double logWords = 0.0;             // mean reverse log words a forward call saves
+
+    bool passed() const { return supported && signal == 0 && mismatches == 0 && logMismatches == 0; }
+};
+
+// One result per verifier table entry, in table order
+std::vector<VerifyResult> verifyUndoHandlers(const VerifyConfig& config = {});
+
+// Verifies the handler of one entry with one trial seed, without a child, to reproduce a failure
+VerifyResult verifyTrial(const VerifyEntry& entry, std::uint64_t trialSeed, const VerifyConfig& config = {});
+
+// Per-handler table: trials, failures and the cost of both handlers
+void verifyDump(const std::vector<VerifyResult>& results, std::FILE* out = stderr);
@@ -1,22 +1,92 @@
+# Runtime the reverse-pass instruments against; every reverse target links it
+set(FRACTURE_RUNTIME_DIR "${CMAKE_CURRENT_LIST_DIR}/../../fracture")
+get_filename_component(FRACTURE_RUNTIME_DIR ${FRACTURE_RUNTIME_DIR} ABSOLUTE)
+
+# Defaults for every reverse target; the PER_TU, OPT_LEVEL and ARCH keywords override them per target
+set(FRACTURE_REVERSE_PER_TU OFF CACHE BOOL "Run the reverse-pass on each translation unit instead of the merged module")
+set(FRACTURE_REVERSE_THIN_LTO OFF CACHE BOOL "Per-TU targets: link the instrumented bitcode with ThinLTO (needs lld)")
+set(FRACTURE_REVERSE_OPT_LEVEL "" CACHE STRING "Optimization level 0-3 for reverse targets; empty keeps each target's own flags")
+set(FRACTURE_REVERSE_ARCH "" CACHE STRING "-march for reverse targets, e.g. native; empty for the compiler default")
+
 function(add_reverse_test TARGET_NAME)
-    set(CMAKE_EXE_LINKER_FLAGS "${CMAKE_EXE_LINKER_FLAGS} -rdynamic")
-    set(CMAKE_CXX_FLAGS "${CMAKE_CXX_FLAGS} -rdynamic")
+    # Sources are the unparsed arguments; the keywords are optional
+    #   PER_TU                   reverse-pass and codegen per translation unit (see below)
+    #   VERIFY                   emit the table the undo handler verifier reads (src/fracture/verify.hpp)
+    #   OPT_LEVEL <0-3>          -O level for compile, undo handler pipeline and codegen
+    #   ARCH <arch>              -march for compile and codegen
+    #   INCLUDE_DIRS <dirs...>   extra include directories for the bitcode compile
+    #   COMPILE_FLAGS <flags...> extra flags for the bitcode compile
+    #   LINK_FLAGS <flags...>    extra flags for the final link
+    cmake_parse_arguments(ART "PER_TU;VERIFY" "OPT_LEVEL;ARCH" "INCLUDE_DIRS;COMPILE_FLAGS;LINK_FLAGS" ${ARGN})
     message(STATUS "Running add_reverse_test for target ${TARGET_NAME}")
 
+    if(NOT ART_PER_TU)
+        set(ART_PER_TU ${FRACTURE_REVERSE_PER_TU})
+    endif()
+    if(NOT DEFINED ART_OPT_LEVEL)
+        set(ART_OPT_LEVEL "${FRACTURE_REVERSE_OPT_LEVEL}")
+    endif()
+    if(NOT DEFINED ART_ARCH)
+        set(ART_ARCH "${FRACTURE_REVERSE_ARCH}")
+    endif()
+
+    set(INCLUDE_FLAGS "-I${FRACTURE_RUNTIME_DIR}")
+    set(RUNTIME_FLAGS -DFRACTURE_TRACE_LEVEL=${FRACTURE_TRACE_LEVEL} -DFRACTURE_TRACE_CATEGORIES=${FRACTURE_TRACE_CATEGORIES}
+        -DFRACTURE_TIME_TICKS=${FRACTURE_TIME_TICKS} -DFRACTURE_PROFILE=${FRACTURE_PROFILE})
+    foreach(DIR ${ART_INCLUDE_DIRS})
+        list(APPEND INCLUDE_FLAGS "-I${DIR}")
+    endforeach()
+
+    # The optimization knob applies to every stage and comes after the target's
+    # own flags; the reverse-pass runs the same level on the undo handlers it
+    # generates (O2 when unset)
+    set(OPT_FLAGS "")
+    set(PASS_LEVEL O2)
+    if(NOT ART_OPT_LEVEL STREQUAL "")
+        list(APPEND OPT_FLAGS -O${ART_OPT_LEVEL})
+        set(PASS_LEVEL O${ART_OPT_LEVEL})
+    endif()
+    if(NOT ART_ARCH STREQUAL "")
+        list(APPEND OPT_FLAGS -march=${ART_ARCH})
+    endif()
+    set(PASS_OPTIONS ${PASS_LEVEL})
+    if(ART_VERIFY)
+        string(APPEND PASS_OPTIONS "$<SEMICOLON>verify")
+    endif()
+
     # Step 1: Compile all the source files to LLVM bitcode
-    foreach(SRC ${ARGN})
+    set(BC_FILES "")
+    set(BC_NAMES "")
+    foreach(SRC ${ART_UNPARSED_ARGUMENTS} ${FRACTURE_RUNTIME_DIR}/reverse_log.cpp ${FRACTURE_RUNTIME_DIR}/trace.cpp ${FRACTURE_RUNTIME_DIR}/profile.cpp)
         get_filename_component(FILE_WE ${SRC} NAME_WE)  # Get the filename without extension
-        set(BC_FILE "${FILE_WE}.bc")
-        
+        set(BC_FILE "${TARGET_NAME}_${FILE_WE}.bc")     # Prefixed so targets can share sources
+
         add_custom_command(
             OUTPUT ${BC_FILE}
-            COMMAND clang++ -emit-llvm -c ${SRC} -o ${BC_FILE} 
+            COMMAND clang++ -std=c++${CMAKE_CXX_STANDARD} ${INCLUDE_FLAGS} ${RUNTIME_FLAGS} ${ART_COMPILE_FLAGS} ${OPT_FLAGS} -emit-llvm -c ${SRC} -o ${BC_FILE}
             DEPENDS ${SRC} reverse_pass
             COMMENT "Compiling ${SRC} to LLVM bitcode (${BC_FILE})"
         )
         list(APPEND BC_FILES ${BC_FILE})
+        list(APPEND BC_NAMES "${TARGET_NAME}_${FILE_WE}")
     endforeach()
 
+    if(ART_PER_TU)
+        _add_reverse_test_per_tu()
+    else()
+        _add_reverse_test_merged()
+    endif()
+
+    # Step 5: Create the custom target for building
+    add_custom_target(build_${TARGET_NAME} ALL
+        DEPENDS ${TARGET_NAME}
+        COMMENT "Building the final ${TARGET_NAME} executable"
+    )
+endfunction()
+
+# Whole-program mode (default): link every bitcode file into one module, run
+# the reverse-pass on it once and compile the result
+macro(_add_reverse_test_merged)
     # Step 2: Link all the generated bitcode files into one
     set(MERGED_BC "${TARGET_NAME}_merged.bc")
     add_custom_command(
@@ -30,22 +100,98 @@ function(add_reverse_test TARGET_NAME)
     set(OPT_BC "${TARGET_NAME}_opt.bc")
     add_custom_command(
         OUTPUT ${OPT_BC}
-        COMMAND opt -load-pass-plugin ${REVERSE_PASS_LIB} -passes=reverse-pass ${MERGED_BC} -o ${OPT_BC}
+        COMMAND opt -load-pass-plugin ${REVERSE_PASS_LIB} "-passes=reverse-pass<${PASS_OPTIONS}>" ${MERGED_BC} -o ${OPT_BC}
         DEPENDS ${MERGED_BC} ${REVERSE_PASS_LIB}
         COMMENT "Applying reverse pass to ${MERGED_BC} (${OPT_BC})"
+        VERBATIM
     )
 
     # Step 4: Generate the final executable from the optimized bitcode
+    # Undo handlers are bound through the registry emitted by the pass, so no -rdynamic
     add_custom_command(
         OUTPUT ${TARGET_NAME}
-        COMMAND clang++ ${OPT_BC} -o ${TARGET_NAME} -rdynamic
+        COMMAND clang++ ${OPT_FLAGS} ${OPT_BC} -o ${TARGET_NAME} ${ART_LINK_FLAGS}
         DEPENDS ${OPT_BC}
         COMMENT "Linking final executable (${TARGET_NAME})"
     )
+endmacro()
 
-    # Step 5: Create the custom target for building
-    add_custom_target(build_${TARGET_NAME} ALL
-        DEPENDS ${TARGET_NAME}
-        COMMENT "Building the final ${TARGET_NAME} executable"
+# Per-TU mode: every translation unit is instrumented and compiled on its own,
+# so the steps run in parallel and an edit only redoes its own TU. Handlers
+# called across TUs are known from per-TU annotation summaries (the
+# reverse-summary pass), which are only rewritten when a TU's annotated
+# functions change; the undo registry is assembled by the linker.
+macro(_add_reverse_test_per_tu)
+    # Step 2: Summarize each TU's annotated functions
+    set(SUMMARIES "")
+    set(PASS_PARAMS ${PASS_OPTIONS})
+    foreach(NAME ${BC_NAMES})
+        set(SUMMARY "${NAME}.summary")
+        if(CMAKE_GENERATOR MATCHES "Ninja")
+            # The stamp changes every run; Ninja restats the byproduct, so TUs
+            # reading an unchanged summary are not rebuilt
+            add_custom_command(
+                OUTPUT ${SUMMARY}.stamp
+                BYPRODUCTS ${SUMMARY}
+                COMMAND opt -load-pass-plugin ${REVERSE_PASS_LIB} "-passes=reverse-summary<${SUMMARY}>" ${NAME}.bc -o /dev/null
+                COMMAND ${CMAKE_COMMAND} -E touch ${SUMMARY}.stamp
+                DEPENDS ${NAME}.bc ${REVERSE_PASS_LIB}
+                COMMENT "Summarizing reverse annotations of ${NAME}.bc"
+                VERBATIM
+            )
+        else()
+            # Make compares timestamps, so an untouched summary stops here
+            add_custom_command(
+                OUTPUT ${SUMMARY}
+                COMMAND opt -load-pass-plugin ${REVERSE_PASS_LIB} "-passes=reverse-summary<${SUMMARY}>" ${NAME}.bc -o /dev/null
+                DEPENDS ${NAME}.bc ${REVERSE_PASS_LIB}
+                COMMENT "Summarizing reverse annotations of ${NAME}.bc"
+                VERBATIM
+            )
+        endif()
+        list(APPEND SUMMARIES ${SUMMARY})
+        string(APPEND PASS_PARAMS "$<SEMICOLON>summary=${SUMMARY}")
+    endforeach()
+
+    # Step 3: Apply the reverse pass to each TU, then compile it
+    set(THIN_FLAGS "")
+    if(FRACTURE_REVERSE_THIN_LTO)
+        set(THIN_FLAGS --thinlto-bc)   # keep a ThinLTO module summary for cross-TU importing
+    endif()
+    set(LINK_INPUTS "")
+    foreach(NAME ${BC_NAMES})
+        set(OPT_BC "${NAME}_opt.bc")
+        add_custom_command(
+            OUTPUT ${OPT_BC}
+            COMMAND opt -load-pass-plugin ${REVERSE_PASS_LIB} "-passes=reverse-pass<${PASS_PARAMS}>" ${THIN_FLAGS} ${NAME}.bc -o ${OPT_BC}
+            DEPENDS ${NAME}.bc ${SUMMARIES} ${REVERSE_PASS_LIB}
+            COMMENT "Applying reverse pass to ${NAME}.bc (${OPT_BC})"
+            VERBATIM
+        )
+
+        if(FRACTURE_REVERSE_THIN_LTO)
+            list(APPEND LINK_INPUTS ${OPT_BC})
+        else()
+            set(OBJ "${NAME}.o")
+            add_custom_command(
+                OUTPUT ${OBJ}
+                COMMAND clang++ ${ART_COMPILE_FLAGS} ${OPT_FLAGS} -c ${OPT_BC} -o ${OBJ}
+                DEPENDS ${OPT_BC}
+                COMMENT "Compiling ${OPT_BC} (${OBJ})"
+            )
+            list(APPEND LINK_INPUTS ${OBJ})
+        endif()
+    endforeach()
+
+    # Step 4: Link; with ThinLTO the backends run in parallel and reuse a cache
+    set(LTO_FLAGS "")
+    if(FRACTURE_REVERSE_THIN_LTO)
+        set(LTO_FLAGS -flto=thin -fuse-ld=lld -Wl,--thinlto-cache-dir=${CMAKE_CURRENT_BINARY_DIR}/${TARGET_NAME}.thinlto-cache)
+    endif()
+    add_custom_command(
+        OUTPUT ${TARGET_NAME}
+        COMMAND clang++ ${OPT_FLAGS} ${LTO_FLAGS} ${LINK_INPUTS} -o ${TARGET_NAME} ${ART_LINK_FLAGS}
+        DEPENDS ${LINK_INPUTS}
+        COMMENT "Linking final executable (${TARGET_NAME})"
     )
-endfunction()
+endmacro()
@@ -1,16 +1,40 @@
+#include "llvm/ADT/MapVector.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/ConstantFolding.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/Dominators.h"
 #include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/IntrinsicInst.h"
 #include "llvm/IR/PassManager.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/Module.h"
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Passes/PassPlugin.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Transforms/InstCombine/InstCombine.h"
+#include "llvm/Transforms/Scalar/SimplifyCFG.h"
 #include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/Local.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
+#include "llvm/Transforms/Utils/PromoteMemToReg.h"
+#include "llvm/Transforms/Vectorize/LoopVectorize.h"
+#include "llvm/Transforms/Vectorize/SLPVectorizer.h"
 #include "llvm/Support/raw_ostream.h"
 #include <cxxabi.h> // Include for __cxa_demangle
 
 using namespace llvm;
 
+// Per-instruction decisions are printed with -debug-only=reverse-pass (assertion builds)
+#define DEBUG_TYPE "reverse-pass"
+
 namespace {
     // Helper function to demangle names
     std::string demangleFunctionName(const std::string &mangledName) {
@@ -21,226 +45,1229 @@ namespace {
         return demangledName;
     }
 
-Function *generateReverseFunction(Function &F, Module *M) {
-    // Skip if this function is already reversed
-    if (F.getName().starts_with("__undo_")) {
-        errs() << "Skipping undo creation for: " << F.getName() << "\n";
-        return nullptr;
-    }
+    // Forward handler -> generated undo handler, in annotation order
+    using UndoMap = MapVector<Function *, Function *>;
+
+    // Module-wide state shared by every undo handler the pass generates
+    struct ReverseContext {
+        UndoMap undoHandlers;                   // annotate("reverse")
+        SmallPtrSet<Function *, 8> ignored;     // annotate("reverse_ignore"): never replayed by undo handlers
+        SmallPtrSet<Function *, 8> batched;     // annotate("reverse,batch"): also get batched variants
+
+        // Reverse log entry points (src/fracture/reverse_log.hpp)
+        FunctionCallee pathPush, pathPop, logPush, logPop;
+        FunctionCallee eventEnd, eventRewind;   // event boundaries inside batched variants
+
+        explicit ReverseContext(Module &M) {
+            LLVMContext &Ctx = M.getContext();
+            Type *voidTy = Type::getVoidTy(Ctx);
+            Type *i64 = Type::getInt64Ty(Ctx);
+            Type *i32 = Type::getInt32Ty(Ctx);
+            pathPush = M.getOrInsertFunction("__fracture_path_push", voidTy, i64, i32);
+            pathPop = M.getOrInsertFunction("__fracture_path_pop", i64, i32);
+            logPush = M.getOrInsertFunction("__fracture_log_push", voidTy, i64);
+            logPop = M.getOrInsertFunction("__fracture_log_pop", i64);
+            eventEnd = M.getOrInsertFunction("__fracture_event_end", i64);
+            eventRewind = M.getOrInsertFunction("__fracture_event_rewind", voidTy, i64);
+        }
 
-    // Demangle the function name for readability
-    std::string demangledName = demangleFunctionName(F.getName().str());
-    errs() << "Processing annotated function: " << demangledName << "\n";
+        bool isRuntimeCall(const CallBase &call) {
+            const Value *callee = call.getCalledOperand();
+            return callee == pathPush.getCallee() || callee == pathPop.getCallee() ||
+                   callee == logPush.getCallee() || callee == logPop.getCallee();
+        }
+    };
 
-    // Create a new function type, same as the original function
-    FunctionType *funcType = F.getFunctionType();
-    std::string undoFunctionName = "__undo_" + demangledName;
+    constexpr uint64_t kUnknownSize = UINT64_MAX / 4;
 
-    // Check if the undo function already exists
-    if (M->getFunction(undoFunctionName)) {
-        errs() << "Skipping undo creation for existing function: " << undoFunctionName << "\n";
-        return nullptr;
+    // Largest memset/memcpy/memmove whose destination is saved before it is overwritten
+    constexpr uint64_t kMaxSavedBytes = 256;
+
+    uint64_t accessSize(const DataLayout &DL, Type *type) {
+        return DL.getTypeStoreSize(type).getKnownMinValue();
     }
 
-    // Create a new function for the reverse logic
-    Function *reverseFunc = Function::Create(
-        funcType, Function::ExternalLinkage, undoFunctionName, M);
-    reverseFunc->setLinkage(GlobalValue::ExternalLinkage);
-    reverseFunc->setVisibility(GlobalValue::DefaultVisibility);
-
-    // Map arguments from the original function to the reverse function
-    ValueToValueMapTy VMap;
-    Function::arg_iterator DestI = reverseFunc->arg_begin();
-    for (const Argument &Arg : F.args()) {
-        DestI->setName(Arg.getName());
-        VMap[&Arg] = &*DestI++;
+    bool isLocal(const Value *pointer) {
+        return isa<AllocaInst>(getUnderlyingObject(pointer));
     }
 
-    // Create the entry block for the new reverse function
-    BasicBlock *entryBlock = BasicBlock::Create(F.getContext(), "entry", reverseFunc);
-    IRBuilder<> builder(entryBlock);
-
-    // Iterate through the original function's basic blocks and instructions
-    for (auto &BB : F) {
-        for (auto &I : BB) {
-            // Clone and map instructions
-            if (isa<AllocaInst>(&I) || isa<LoadInst>(&I) || isa<StoreInst>(&I)) {
-                // Handle memory instructions
-                Instruction *newInst = I.clone();
-                for (unsigned idx = 0; idx < I.getNumOperands(); ++idx) {
-                    Value *operand = I.getOperand(idx);
-                    if (VMap.count(operand))
-                        newInst->setOperand(idx, VMap[operand]);
-                    else
-                        newInst->setOperand(idx, operand); // Assuming operand is a constant or global
+    bool mustAlias(const DataLayout &DL, const Value *p, const Value *q) {
+        APInt pOffset(DL.getIndexTypeSizeInBits(p->getType()), 0);
+        APInt qOffset(DL.getIndexTypeSizeInBits(q->getType()), 0);
+        const Value *pBase = p->stripAndAccumulateConstantOffsets(DL, pOffset, /*AllowNonInbounds=*/true);
+        const Value *qBase = q->stripAndAccumulateConstantOffsets(DL, qOffset, /*AllowNonInbounds=*/true);
+        return pBase == qBase && pOffset == qOffset;
+    }
+
+    // Conservative alias oracle for handler bodies. Accesses off one base at
+    // constant offsets alias only if their byte ranges overlap; distinct
+    // identified objects never alias, and neither does a frame-local object with
+    // memory reached through an argument or a global.
+    bool mayAlias(const DataLayout &DL, const Value *p, uint64_t pSize, const Value *q, uint64_t qSize) {
+        APInt pOffset(DL.getIndexTypeSizeInBits(p->getType()), 0);
+        APInt qOffset(DL.getIndexTypeSizeInBits(q->getType()), 0);
+        const Value *pBase = p->stripAndAccumulateConstantOffsets(DL, pOffset, /*AllowNonInbounds=*/true);
+        const Value *qBase = q->stripAndAccumulateConstantOffsets(DL, qOffset, /*AllowNonInbounds=*/true);
+        if (pBase == qBase) {
+            int64_t pBegin = pOffset.getSExtValue();
+            int64_t qBegin = qOffset.getSExtValue();
+            return pBegin < qBegin + static_cast<int64_t>(qSize) && qBegin < pBegin + static_cast<int64_t>(pSize);
+        }
+
+        const Value *pObject = getUnderlyingObject(pBase);
+        const Value *qObject = getUnderlyingObject(qBase);
+        if (pObject == qObject)
+            return true;
+        if (isIdentifiedObject(pObject) && isIdentifiedObject(qObject))
+            return false;
+
+        auto external = [](const Value *object) { return isa<Argument>(object) || isa<GlobalValue>(object); };
+        if ((isa<AllocaInst>(pObject) && external(qObject)) || (isa<AllocaInst>(qObject) && external(pObject)))
+            return false;
+        return true;
+    }
+
+    // Builds the undo handler of one annotated forward handler.
+    //
+    // The forward body is normalised first (locals promoted to registers, a single
+    // return block) and instrumented so its undo can retrace the path it took:
+    //  - a block with several predecessors records which one it was entered from
+    //    in ceil(log2(n)) path bits;
+    //  - a loop with one entering edge and one back edge counts its iterations
+    //    instead, and pushes the count on every edge that leaves it.
+    // The undo handler mirrors the CFG with one undo block per forward block,
+    // walked from the return block back to the entry, each undoing its block's
+    // effects in reverse order. Stores with an exact inverse are recomputed;
+    // destructive ones are undone from the old value the forward handler saved.
+    class ReverseFunctionBuilder {
+        struct CountedLoop {
+            BasicBlock *header;
+            BasicBlock *entering;               // the one predecessor outside the loop
+            BasicBlock *latch;                  // the one predecessor inside it
+            unsigned depth;
+            SmallPtrSet<BasicBlock *, 16> blocks;
+            PHINode *trips = nullptr;           // back edges taken so far
+            AllocaInst *counter = nullptr;      // back edges left to undo
+        };
+
+        // Integer induction variable of a counted loop: start + k * step in iteration k.
+        // While the undo handler is inside the loop, its counter holds k.
+        struct Induction {
+            const CountedLoop *loop;
+            Value *start;
+            Value *step;
+            bool decreasing;
+        };
+
+        // How the undo rebuilds the overwritten value from the stored one
+        struct Inversion {
+            enum Kind {
+                SubtractOperand,                // old = new - x
+                AddOperand,                     // old = new + x
+                SubtractFromOperand,            // old = x - new (negation when x is 0)
+                XorOperand,                     // old = new ^ x (bitwise not when x is -1)
+                MultiplyOperand,                // old = new * x, x the inverse of an odd factor
+                ShiftRightLogical,              // old = new >> x after a shl nuw
+                ShiftRightArithmetic,           // old = new >> x after a shl nsw
+                Negate                          // old = -new, floating point
+            } kind;
+            Value *operand;                     // null for Negate
+            CastInst *extension;                // non-null when the update ran on a widened copy
+        };
+
+        Function &F;
+        Function &undo;
+        ReverseContext &ctx;
+        const DataLayout &DL;
+        LLVMContext &C;
+        std::string name;
+
+        SmallVector<CountedLoop, 4> loops;
+        DenseMap<BasicBlock *, unsigned> loopOfHeader;
+        DenseMap<BasicBlock *, SmallVector<unsigned, 2>> exitRecords;   // exit-edge block -> loops it leaves, innermost first
+        DenseMap<BasicBlock *, SmallVector<BasicBlock *, 4>> pathPreds;  // merge block -> predecessors by path index
+        DenseMap<BasicBlock *, BasicBlock *> mirror;                     // forward block -> undo block
+
+    public:
+        ReverseFunctionBuilder(Function &F, Function &undo, ReverseContext &ctx)
+            : F(F), undo(undo), ctx(ctx), DL(F.getParent()->getDataLayout()), C(F.getContext()),
+              name(demangleFunctionName(F.getName().str())) {}
+
+        void build() {
+            normalizeForward();
+            instrumentLoops();
+            instrumentMerges();
+            emitUndo();
+        }
+
+    private:
+        void normalizeForward() {
+            removeUnreachableBlocks(F);
+
+            // Locals live in registers from here on, so only model state is left in memory
+            DominatorTree DT(F);
+            SmallVector<AllocaInst *, 8> promotable;
+            for (Instruction &I : F.getEntryBlock())
+                if (auto *alloca = dyn_cast<AllocaInst>(&I))
+                    if (isAllocaPromotable(alloca))
+                        promotable.push_back(alloca);
+            if (!promotable.empty())
+                PromoteMemToReg(promotable, DT);
+
+            // A single return block, where the undo handler starts
+            SmallVector<ReturnInst *, 4> returns;
+            for (BasicBlock &BB : F)
+                if (auto *ret = dyn_cast<ReturnInst>(BB.getTerminator()))
+                    returns.push_back(ret);
+            if (returns.size() < 2)
+                return;
+
+            BasicBlock *exit = BasicBlock::Create(C, "unified.return", &F);
+            IRBuilder<> builder(exit);
+            PHINode *value = nullptr;
+            if (!F.getReturnType()->isVoidTy())
+                value = builder.CreatePHI(F.getReturnType(), returns.size(), "retval");
+            builder.CreateRet(value);
+
+            for (ReturnInst *ret : returns) {
+                if (value)
+                    value->addIncoming(ret->getReturnValue(), ret->getParent());
+                IRBuilder<>(ret).CreateBr(exit);
+                ret->eraseFromParent();
+            }
+        }
+
+        void instrumentLoops() {
+            DominatorTree DT(F);
+            LoopInfo LI(DT);
+            Type *i64 = Type::getInt64Ty(C);
+
+            // Loops entered from one block and closed by one latch are counted;
+            // any other loop header is an ordinary merge point
+            SmallVector<Loop *, 4> counted;
+            for (Loop *L : LI.getLoopsInPreorder()) {
+                BasicBlock *header = L->getHeader();
+                BasicBlock *entering = nullptr;
+                BasicBlock *latch = nullptr;
+                bool simple = true;
+                for (BasicBlock *pred : predecessors(header)) {
+                    BasicBlock *&slot = L->contains(pred) ? latch : entering;
+                    simple &= !slot || slot == pred;
+                    slot = pred;
                 }
-                builder.Insert(newInst);
-                VMap[&I] = newInst;
-            } else if (auto *binOp = dyn_cast<BinaryOperator>(&I)) {
-                // Handle Add and Sub instructions
-                if (binOp->getOpcode() == Instruction::Add || binOp->getOpcode() == Instruction::Sub) {
-                    Value *lhs = binOp->getOperand(0);
-                    Value *rhs = binOp->getOperand(1);
-
-                    // Map operands
-                    if (VMap.count(lhs))
-                        lhs = VMap[lhs];
-                    if (VMap.count(rhs))
-                        rhs = VMap[rhs];
-
-                    // Create reverse operation
-                    Value *reverseOp = nullptr;
-                    if (binOp->getOpcode() == Instruction::Add) {
-                        reverseOp = builder.CreateSub(lhs, rhs, "reverseSub");
-                        errs() << "Reversing Add to Sub: " << *reverseOp << "\n";
-                    } else if (binOp->getOpcode() == Instruction::Sub) {
-                        reverseOp = builder.CreateAdd(lhs, rhs, "reverseAdd");
-                        errs() << "Reversing Sub to Add: " << *reverseOp << "\n";
-                    }
+                if (!simple || !entering || !latch)
+                    continue;
 
-                    VMap[&I] = reverseOp;
-                } else {
-                    // For other binary operators, clone them
-                    Instruction *newInst = I.clone();
-                    for (unsigned idx = 0; idx < I.getNumOperands(); ++idx) {
-                        Value *operand = I.getOperand(idx);
-                        if (VMap.count(operand))
-                            newInst->setOperand(idx, VMap[operand]);
+                loopOfHeader[header] = loops.size();
+                loops.push_back({header, entering, latch, L->getLoopDepth()});
+                loops.back().blocks.insert(L->block_begin(), L->block_end());
+                counted.push_back(L);
+            }
+
+            for (CountedLoop &loop : loops) {
+                IRBuilder<> builder(&loop.header->front());
+                loop.trips = builder.CreatePHI(i64, 2, "trips");
+                builder.SetInsertPoint(loop.latch->getTerminator());
+                Value *next = builder.CreateAdd(loop.trips, ConstantInt::get(i64, 1), "trips.next");
+                for (BasicBlock *pred : predecessors(loop.header))
+                    loop.trips->addIncoming(pred == loop.latch ? next : ConstantInt::get(i64, 0), pred);
+            }
+
+            // Every edge leaving counted loops gets a block pushing their counts
+            MapVector<std::pair<BasicBlock *, BasicBlock *>, SmallVector<unsigned, 2>> exits;
+            for (unsigned i = 0; i < counted.size(); ++i)
+                for (BasicBlock *from : counted[i]->blocks())
+                    for (BasicBlock *to : successors(from))
+                        if (!counted[i]->contains(to) && !is_contained(exits[{from, to}], i))
+                            exits[{from, to}].push_back(i);
+
+            for (auto &[edge, leaving] : exits) {
+                auto [from, to] = edge;
+                llvm::sort(leaving, [&](unsigned a, unsigned b) { return loops[a].depth > loops[b].depth; });
+
+                BasicBlock *record = BasicBlock::Create(C, from->getName() + ".exit", &F, to);
+                IRBuilder<> builder(record);
+                for (unsigned i : leaving)
+                    builder.CreateCall(ctx.logPush, {loops[i].trips});
+                builder.CreateBr(to);
+
+                Instruction *terminator = from->getTerminator();
+                for (unsigned s = 0; s < terminator->getNumSuccessors(); ++s)
+                    if (terminator->getSuccessor(s) == to)
+                        terminator->setSuccessor(s, record);
+
+                // Parallel edges from `from` collapse into the single edge from `record`
+                for (PHINode &phi : to->phis()) {
+                    bool redirected = false;
+                    for (unsigned k = phi.getNumIncomingValues(); k-- > 0;) {
+                        if (phi.getIncomingBlock(k) != from)
+                            continue;
+                        if (redirected)
+                            phi.removeIncomingValue(k, /*DeletePHIIfEmpty=*/false);
                         else
-                            newInst->setOperand(idx, operand);
+                            phi.setIncomingBlock(k, record);
+                        redirected = true;
                     }
-                    builder.Insert(newInst);
-                    VMap[&I] = newInst;
                 }
-            } else if (isa<ReturnInst>(&I)) {
-                // We'll add a return at the end
-                continue;
+
+                auto target = loopOfHeader.find(to);
+                if (target != loopOfHeader.end()) {
+                    CountedLoop &loop = loops[target->second];
+                    if (loop.entering == from)
+                        loop.entering = record;
+                    if (loop.latch == from)
+                        loop.latch = record;
+                }
+                exitRecords[record] = leaving;
+            }
+        }
+
+        void instrumentMerges() {
+            Type *i32 = Type::getInt32Ty(C);
+            Type *i64 = Type::getInt64Ty(C);
+
+            for (BasicBlock &BB : F) {
+                if (loopOfHeader.count(&BB))
+                    continue;
+
+                SmallVector<BasicBlock *, 4> preds;
+                for (BasicBlock *pred : predecessors(&BB))
+                    if (!is_contained(preds, pred))
+                        preds.push_back(pred);
+                if (preds.size() < 2)
+                    continue;
+
+                IRBuilder<> builder(&BB.front());
+                PHINode *from = builder.CreatePHI(i32, pred_size(&BB), "path.from");
+                for (BasicBlock *pred : predecessors(&BB))
+                    from->addIncoming(ConstantInt::get(i32, find(preds, pred) - preds.begin()), pred);
+
+                builder.SetInsertPoint(&BB, BB.getFirstInsertionPt());
+                builder.CreateCall(ctx.pathPush, {builder.CreateZExt(from, i64),
+                                                  ConstantInt::get(i32, Log2_32_Ceil(preds.size()))});
+                pathPreds[&BB] = std::move(preds);
+            }
+        }
+
+        void emitUndo() {
+            BasicBlock *entry = BasicBlock::Create(C, "entry", &undo);
+            for (BasicBlock &BB : F)
+                mirror[&BB] = BasicBlock::Create(C, BB.getName() + ".undo", &undo);
+
+            IRBuilder<> builder(entry);
+            for (CountedLoop &loop : loops)
+                loop.counter = builder.CreateAlloca(builder.getInt64Ty(), nullptr, loop.header->getName() + ".trips");
+
+            BasicBlock *exit = nullptr;
+            for (BasicBlock &BB : F)
+                if (isa<ReturnInst>(BB.getTerminator()))
+                    exit = &BB;
+            if (exit)
+                builder.CreateBr(mirror[exit]);
+            else
+                emitReturn(builder);
+
+            for (BasicBlock &BB : F) {
+                IRBuilder<> blockBuilder(mirror[&BB]);
+                auto record = exitRecords.find(&BB);
+                if (record != exitRecords.end()) {
+                    // Reload the trip counts pushed on this exit edge, outermost first
+                    for (unsigned i : reverse(record->second))
+                        blockBuilder.CreateStore(blockBuilder.CreateCall(ctx.logPop), loops[i].counter);
+                } else {
+                    // Saving state inserts into BB, so walk a snapshot of it
+                    SmallVector<Instruction *, 32> body;
+                    for (Instruction &I : BB)
+                        body.push_back(&I);
+                    for (Instruction *I : reverse(body))
+                        undoEffect(*I, blockBuilder);
+                }
+                emitPredecessorBranch(BB, blockBuilder);
+            }
+        }
+
+        void emitReturn(IRBuilder<> &builder) {
+            Type *type = undo.getReturnType();
+            if (type->isVoidTy())
+                builder.CreateRetVoid();
+            else
+                builder.CreateRet(Constant::getNullValue(type));
+        }
+
+        // Leave an undo block towards the undo block of the forward predecessor
+        void emitPredecessorBranch(BasicBlock &BB, IRBuilder<> &builder) {
+            if (&BB == &F.getEntryBlock()) {
+                emitReturn(builder);
+                return;
+            }
+
+            auto header = loopOfHeader.find(&BB);
+            if (header != loopOfHeader.end()) {
+                // The first visit came from outside the loop, every later one over the back edge
+                CountedLoop &loop = loops[header->second];
+                Value *trips = builder.CreateLoad(builder.getInt64Ty(), loop.counter);
+                BasicBlock *back = BasicBlock::Create(C, BB.getName() + ".undo.back", &undo);
+                builder.CreateCondBr(builder.CreateICmpEQ(trips, builder.getInt64(0)), mirror[loop.entering], back);
+                builder.SetInsertPoint(back);
+                builder.CreateStore(builder.CreateSub(trips, builder.getInt64(1)), loop.counter);
+                builder.CreateBr(mirror[loop.latch]);
+                return;
+            }
+
+            auto merge = pathPreds.find(&BB);
+            if (merge != pathPreds.end()) {
+                const SmallVector<BasicBlock *, 4> &preds = merge->second;
+                Value *bits = builder.getInt32(Log2_32_Ceil(preds.size()));
+                Value *index = builder.CreateTrunc(builder.CreateCall(ctx.pathPop, {bits}), builder.getInt32Ty());
+                SwitchInst *select = builder.CreateSwitch(index, mirror[preds[0]], preds.size() - 1);
+                for (unsigned i = 1; i < preds.size(); ++i)
+                    select->addCase(builder.getInt32(i), mirror[preds[i]]);
+                return;
+            }
+
+            if (BasicBlock *pred = BB.getUniquePredecessor())
+                builder.CreateBr(mirror[pred]);
+            else
+                builder.CreateUnreachable();
+        }
+
+        void undoEffect(Instruction &I, IRBuilder<> &builder) {
+            if (auto *store = dyn_cast<StoreInst>(&I))
+                undoStore(*store, builder);
+            else if (auto *call = dyn_cast<CallBase>(&I))
+                undoCall(*call, builder);
+            else if (I.mayWriteToMemory())
+                reportIrreversible(I);
+        }
+
+        void undoStore(StoreInst &store, IRBuilder<> &builder) {
+            Value *pointer = store.getPointerOperand();
+
+            // Frame-local memory dies with the forward call
+            if (isLocal(pointer))
+                return;
+
+            if (!store.isSimple()) {
+                reportIrreversible(store);
+                return;
+            }
+
+            // Destructive: the forward handler saves what the store overwrites
+            Inversion inversion;
+            if (!matchInversion(store, inversion) ||
+                !canRecompute(pointer, store) || (inversion.operand && !canRecompute(inversion.operand, store))) {
+                LLVM_DEBUG(dbgs() << "Saving state overwritten by" << store << "\n");
+                saveOverwritten(store, pointer, accessSize(DL, store.getValueOperand()->getType()),
+                                store.getAlign(), builder);
+                return;
+            }
+
+            DenseMap<Value *, Value *> cloned;
+            Value *address = materialize(pointer, store, builder, cloned);
+            Type *type = store.getValueOperand()->getType();
+            Value *current = builder.CreateAlignedLoad(type, address, store.getAlign());
+            if (inversion.extension)
+                current = builder.CreateCast(inversion.extension->getOpcode(), current, inversion.extension->getDestTy());
+
+            Value *operand = inversion.operand ? materialize(inversion.operand, store, builder, cloned) : nullptr;
+            Value *previous = nullptr;
+            switch (inversion.kind) {
+            case Inversion::SubtractOperand:
+                previous = builder.CreateSub(current, operand, "reverseSub");
+                break;
+            case Inversion::AddOperand:
+                previous = builder.CreateAdd(current, operand, "reverseAdd");
+                break;
+            case Inversion::SubtractFromOperand:
+                previous = builder.CreateSub(operand, current, "reverseSub");
+                break;
+            case Inversion::XorOperand:
+                previous = builder.CreateXor(current, operand, "reverseXor");
+                break;
+            case Inversion::MultiplyOperand:
+                previous = builder.CreateMul(current, operand, "reverseMul");
+                break;
+            case Inversion::ShiftRightLogical:
+                previous = builder.CreateLShr(current, operand, "reverseShl", true);
+                break;
+            case Inversion::ShiftRightArithmetic:
+                previous = builder.CreateAShr(current, operand, "reverseShl", true);
+                break;
+            case Inversion::Negate:
+                previous = builder.CreateFNeg(current, "reverseNeg");
+                break;
+            }
+            if (inversion.extension)
+                previous = builder.CreateTrunc(previous, type);
+            builder.CreateAlignedStore(previous, address, store.getAlign());
+            LLVM_DEBUG(dbgs() << "Reversing " << store << " with" << *previous << "\n");
+        }
+
+        void undoCall(CallBase &call, IRBuilder<> &builder) {
+            if (ctx.isRuntimeCall(call))
+                return;
+            if (auto *intrinsic = dyn_cast<IntrinsicInst>(&call))
+                if (intrinsic->isAssumeLikeIntrinsic())
+                    return;
+
+            Function *callee = call.getCalledFunction();
+            if (callee && ctx.ignored.count(callee))
+                return;
+
+            // A nested reversible handler: run its undo handler with the same arguments
+            if (callee) {
+                auto it = ctx.undoHandlers.find(callee);
+                if (it != ctx.undoHandlers.end()) {
+                    undoNestedHandler(call, *it->second, builder);
+                    return;
+                }
+            }
+
+            if (!call.mayWriteToMemory())
+                return;
+            if (auto *mem = dyn_cast<MemIntrinsic>(&call)) {
+                if (isLocal(mem->getDest()))
+                    return;
+                auto *length = dyn_cast<ConstantInt>(mem->getLength());
+                if (length && !mem->isVolatile() && length->getZExtValue() <= kMaxSavedBytes) {
+                    LLVM_DEBUG(dbgs() << "Saving state overwritten by" << call << "\n");
+                    saveOverwritten(call, mem->getDest(), length->getZExtValue(),
+                                    mem->getDestAlign().valueOrOne(), builder);
+                    return;
+                }
+            }
+            reportIrreversible(call);
+        }
+
+        // Arguments the undo cannot rebuild are pushed right after the call, above
+        // everything the callee itself logged
+        void undoNestedHandler(CallBase &call, Function &callee, IRBuilder<> &builder) {
+            SmallVector<unsigned, 4> saved;
+            for (unsigned i = 0; i < call.arg_size(); ++i) {
+                if (canRecompute(call.getArgOperand(i), call))
+                    continue;
+                if (call.isTerminator() || !fitsWord(call.getArgOperand(i)->getType())) {
+                    reportIrreversible(call);
+                    return;
+                }
+                saved.push_back(i);
+            }
+
+            if (!saved.empty()) {
+                IRBuilder<> forward(call.getNextNode());
+                for (unsigned i : saved)
+                    forward.CreateCall(ctx.logPush, {toWord(forward, call.getArgOperand(i))});
+            }
+
+            SmallVector<Value *, 4> args(call.arg_size(), nullptr);
+            for (unsigned i : reverse(saved))
+                args[i] = fromWord(builder, builder.CreateCall(ctx.logPop), call.getArgOperand(i)->getType());
+
+            DenseMap<Value *, Value *> cloned;
+            for (unsigned i = 0; i < call.arg_size(); ++i)
+                if (!args[i])
+                    args[i] = materialize(call.getArgOperand(i), call, builder, cloned);
+            builder.CreateCall(&callee, args);
+        }
+
+        // Incremental state saving: just before `at` runs forward, push the `size`
+        // bytes at `pointer` in 8-byte chunks, preceded by the address itself when
+        // the undo handler cannot rebuild it; the undo of `at` pops and stores them back
+        void saveOverwritten(Instruction &at, Value *pointer, uint64_t size, Align align, IRBuilder<> &builder) {
+            bool rebuild = canRecompute(pointer, at);
+            Type *i64 = builder.getInt64Ty();
+
+            SmallVector<std::pair<uint64_t, uint64_t>, 4> chunks;   // offset, bytes
+            for (uint64_t offset = 0; offset < size; offset += 8)
+                chunks.push_back({offset, std::min<uint64_t>(8, size - offset)});
+
+            IRBuilder<> forward(&at);
+            if (!rebuild)
+                forward.CreateCall(ctx.logPush, {forward.CreatePtrToInt(pointer, i64)});
+            for (auto [offset, bytes] : chunks) {
+                Value *old = forward.CreateAlignedLoad(forward.getIntNTy(bytes * 8), chunkAddress(forward, pointer, offset),
+                                                       commonAlignment(align, offset), "saved");
+                forward.CreateCall(ctx.logPush, {forward.CreateZExt(old, i64)});
+            }
+
+            SmallVector<Value *, 4> words;
+            for (unsigned i = 0; i < chunks.size(); ++i)
+                words.push_back(builder.CreateCall(ctx.logPop));
+
+            Value *address = nullptr;
+            if (rebuild) {
+                DenseMap<Value *, Value *> cloned;
+                address = materialize(pointer, at, builder, cloned);
             } else {
-                // Clone other instructions
-                Instruction *newInst = I.clone();
-                for (unsigned idx = 0; idx < I.getNumOperands(); ++idx) {
-                    Value *operand = I.getOperand(idx);
-                    if (VMap.count(operand))
-                        newInst->setOperand(idx, VMap[operand]);
-                    else
-                        newInst->setOperand(idx, operand);
+                address = builder.CreateIntToPtr(builder.CreateCall(ctx.logPop), pointer->getType());
+            }
+
+            for (unsigned i = 0; i < chunks.size(); ++i) {
+                auto [offset, bytes] = chunks[chunks.size() - 1 - i];
+                builder.CreateAlignedStore(builder.CreateTrunc(words[i], builder.getIntNTy(bytes * 8)),
+                                           chunkAddress(builder, address, offset), commonAlignment(align, offset));
+            }
+        }
+
+        static Value *chunkAddress(IRBuilder<> &builder, Value *pointer, uint64_t offset) {
+            return offset ? builder.CreateConstInBoundsGEP1_64(builder.getInt8Ty(), pointer, offset) : pointer;
+        }
+
+        unsigned bitWidth(Type *type) {
+            return DL.getTypeSizeInBits(type).getKnownMinValue();
+        }
+
+        bool fitsWord(Type *type) {
+            return (type->isIntOrPtrTy() || type->isFloatingPointTy()) && bitWidth(type) <= 64;
+        }
+
+        Value *toWord(IRBuilder<> &builder, Value *value) {
+            Type *type = value->getType();
+            if (type->isPointerTy())
+                return builder.CreatePtrToInt(value, builder.getInt64Ty());
+            if (!type->isIntegerTy())
+                value = builder.CreateBitCast(value, builder.getIntNTy(bitWidth(type)));
+            return builder.CreateZExt(value, builder.getInt64Ty());
+        }
+
+        Value *fromWord(IRBuilder<> &builder, Value *word, Type *type) {
+            if (type->isPointerTy())
+                return builder.CreateIntToPtr(word, type);
+            Value *bits = builder.CreateTrunc(word, builder.getIntNTy(bitWidth(type)));
+            return type->isIntegerTy() ? bits : builder.CreateBitCast(bits, type);
+        }
+
+        // Match a store of an exactly invertible update of the value it overwrites:
+        // `store op(load p, x), p` with op one of add, sub, xor, mul by an odd
+        // constant, shl nuw/nsw, or fneg. Integer updates may run on a widened copy
+        // of the loaded value that is truncated back before the store, except
+        // shifts, whose no-overflow flags then say nothing about the narrow value.
+        // Anything else is left to state saving.
+        bool matchInversion(StoreInst &store, Inversion &inversion) {
+            Type *type = store.getValueOperand()->getType();
+            Value *value = store.getValueOperand();
+
+            if (type->isFloatingPointTy()) {
+                auto *negation = dyn_cast<UnaryOperator>(value);
+                auto *load = negation && negation->getOpcode() == Instruction::FNeg
+                                 ? dyn_cast<LoadInst>(negation->getOperand(0)) : nullptr;
+                if (!load || !isSelfLoad(*load, store))
+                    return false;
+                inversion = {Inversion::Negate, nullptr, nullptr};
+                return true;
+            }
+            if (!type->isIntegerTy())
+                return false;
+
+            auto *truncation = dyn_cast<TruncInst>(value);
+            if (truncation)
+                value = truncation->getOperand(0);
+
+            auto *update = dyn_cast<BinaryOperator>(value);
+            if (!update)
+                return false;
+
+            for (unsigned side = 0; side < 2; ++side) {
+                Value *self = update->getOperand(side);
+                CastInst *extension = nullptr;
+                if (truncation) {
+                    extension = dyn_cast<CastInst>(self);
+                    if (!extension || !(isa<ZExtInst>(extension) || isa<SExtInst>(extension)) ||
+                        extension->getSrcTy() != type)
+                        continue;
+                    self = extension->getOperand(0);
                 }
-                builder.Insert(newInst);
-                VMap[&I] = newInst;
+
+                auto *load = dyn_cast<LoadInst>(self);
+                if (!load || !isSelfLoad(*load, store))
+                    continue;
+
+                inversion.operand = update->getOperand(1 - side);
+                inversion.extension = extension;
+                if (invertUpdate(*update, side, inversion))
+                    return true;
             }
+            return false;
         }
+
+        // Choose the inverse of `update`, whose operand `side` is the old value
+        bool invertUpdate(BinaryOperator &update, unsigned side, Inversion &inversion) {
+            switch (update.getOpcode()) {
+            case Instruction::Add:
+                inversion.kind = Inversion::SubtractOperand;
+                return true;
+            case Instruction::Sub:
+                inversion.kind = side == 0 ? Inversion::AddOperand : Inversion::SubtractFromOperand;
+                return true;
+            case Instruction::Xor:
+                inversion.kind = Inversion::XorOperand;
+                return true;
+            case Instruction::Mul: {
+                // Odd factors are units modulo 2^n, so the product wraps reversibly
+                auto *factor = dyn_cast<ConstantInt>(inversion.operand);
+                if (!factor || !factor->getValue()[0])
+                    return false;
+                inversion.kind = Inversion::MultiplyOperand;
+                inversion.operand = ConstantInt::get(factor->getType(), multiplicativeInverse(factor->getValue()));
+                return true;
+            }
+            case Instruction::Shl:
+                if (side != 0 || inversion.extension)
+                    return false;
+                if (update.hasNoUnsignedWrap())
+                    inversion.kind = Inversion::ShiftRightLogical;
+                else if (update.hasNoSignedWrap())
+                    inversion.kind = Inversion::ShiftRightArithmetic;
+                else
+                    return false;
+                return true;
+            default:
+                return false;
+            }
+        }
+
+        // Inverse of an odd value modulo 2^n by Newton's iteration: x = c is
+        // correct to 3 bits, and each step doubles the correct bits
+        static APInt multiplicativeInverse(const APInt &factor) {
+            unsigned width = factor.getBitWidth();
+            APInt inverse = factor;
+            for (unsigned bits = 3; bits < width; bits *= 2)
+                inverse *= APInt(width, 2) - factor * inverse;
+            return inverse;
+        }
+
+        // `load` reads the value `store` overwrites
+        bool isSelfLoad(LoadInst &load, StoreInst &store) {
+            if (!load.isSimple() || load.getParent() != store.getParent() || !load.comesBefore(&store))
+                return false;
+            if (load.getType() != store.getValueOperand()->getType() ||
+                !mustAlias(DL, load.getPointerOperand(), store.getPointerOperand()))
+                return false;
+
+            uint64_t size = accessSize(DL, load.getType());
+            for (Instruction *I = load.getNextNode(); I != &store; I = I->getNextNode())
+                if (mayWrite(*I, store.getPointerOperand(), size))
+                    return false;
+            return true;
+        }
+
+        // Can the undo of `at` rebuild `value` from its arguments and from memory
+        // that still holds what it held when the forward handler computed it?
+        bool canRecompute(Value *value, Instruction &at) {
+            if (isa<Constant>(value) || isa<Argument>(value))
+                return true;
+
+            auto *I = dyn_cast<Instruction>(value);
+            if (!I || isa<AllocaInst>(I) || I->isTerminator() || I->isEHPad())
+                return false;
+
+            if (auto *phi = dyn_cast<PHINode>(I)) {
+                Induction induction;
+                return matchInduction(*phi, at, induction);
+            }
+
+            if (auto *load = dyn_cast<LoadInst>(I))
+                return load->isSimple() && canRecompute(load->getPointerOperand(), at) && isStable(*load, at);
+            if (auto *call = dyn_cast<CallBase>(I)) {
+                if (!call->doesNotAccessMemory() || call->mayHaveSideEffects())
+                    return false;
+            } else if (I->mayReadOrWriteMemory()) {
+                return false;
+            }
+
+            for (Value *operand : I->operands())
+                if (!canRecompute(operand, at))
+                    return false;
+            return true;
+        }
+
+        bool matchInduction(PHINode &phi, Instruction &at, Induction &induction) {
+            auto header = loopOfHeader.find(phi.getParent());
+            if (header == loopOfHeader.end() || !phi.getType()->isIntegerTy())
+                return false;
+
+            // Only inside the loop does the counter name the iteration being undone
+            const CountedLoop &loop = loops[header->second];
+            if (!loop.blocks.count(at.getParent()))
+                return false;
+
+            auto *next = dyn_cast<BinaryOperator>(phi.getIncomingValueForBlock(loop.latch));
+            if (!next || (next->getOpcode() != Instruction::Add && next->getOpcode() != Instruction::Sub))
+                return false;
+
+            Value *step = nullptr;
+            if (next->getOperand(0) == &phi)
+                step = next->getOperand(1);
+            else if (next->getOpcode() == Instruction::Add && next->getOperand(1) == &phi)
+                step = next->getOperand(0);
+            else
+                return false;
+
+            Value *start = phi.getIncomingValueForBlock(loop.entering);
+            auto invariant = [&](Value *value) {
+                auto *def = dyn_cast<Instruction>(value);
+                return (!def || !loop.blocks.count(def->getParent())) && canRecompute(value, at);
+            };
+            if (!invariant(start) || !invariant(step))
+                return false;
+
+            induction = {&loop, start, step, next->getOpcode() == Instruction::Sub};
+            return true;
+        }
+
+        // Memory seen by the undo of `at` is the memory right after `at` ran forward
+        bool isStable(LoadInst &load, Instruction &at) {
+            Value *pointer = load.getPointerOperand();
+            uint64_t size = accessSize(DL, load.getType());
+
+            if (load.getParent() == at.getParent() && load.comesBefore(&at)) {
+                for (Instruction *I = load.getNextNode();; I = I->getNextNode()) {
+                    if (mayWrite(*I, pointer, size))
+                        return false;
+                    if (I == &at)
+                        return true;
+                }
+            }
+
+            // Anywhere else only if nothing in the handler may write the location
+            for (Instruction &I : instructions(F))
+                if (mayWrite(I, pointer, size))
+                    return false;
+            return true;
+        }
+
+        // Calls marked reverse_ignore and the reverse log runtime are assumed not
+        // to touch model state
+        bool mayWrite(Instruction &I, const Value *pointer, uint64_t size) {
+            if (auto *store = dyn_cast<StoreInst>(&I))
+                return mayAlias(DL, store->getPointerOperand(), accessSize(DL, store->getValueOperand()->getType()),
+                                pointer, size);
+
+            auto *call = dyn_cast<CallBase>(&I);
+            if (!call)
+                return I.mayWriteToMemory();
+            if (ctx.isRuntimeCall(*call) || !call->mayWriteToMemory())
+                return false;
+            if (auto *intrinsic = dyn_cast<IntrinsicInst>(call))
+                if (intrinsic->isAssumeLikeIntrinsic())
+                    return false;
+            if (auto *mem = dyn_cast<MemIntrinsic>(call)) {
+                auto *length = dyn_cast<ConstantInt>(mem->getLength());
+                return mayAlias(DL, mem->getDest(), length ? length->getZExtValue() : kUnknownSize, pointer, size);
+            }
+            Function *callee = call->getCalledFunction();
+            return !callee || !ctx.ignored.count(callee);
+        }
+
+        // Clone the expression tree of `value` into the undo handler of `at`
+        Value *materialize(Value *value, Instruction &at, IRBuilder<> &builder, DenseMap<Value *, Value *> &cloned) {
+            if (isa<Constant>(value))
+                return value;
+            if (auto *arg = dyn_cast<Argument>(value))
+                return undo.getArg(arg->getArgNo());
+
+            auto found = cloned.find(value);
+            if (found != cloned.end())
+                return found->second;
+
+            if (auto *phi = dyn_cast<PHINode>(value)) {
+                Induction induction;
+                matchInduction(*phi, at, induction);
+                Value *start = materialize(induction.start, at, builder, cloned);
+                Value *step = materialize(induction.step, at, builder, cloned);
+                Value *k = builder.CreateLoad(builder.getInt64Ty(), induction.loop->counter);
+                Value *offset = builder.CreateMul(builder.CreateZExtOrTrunc(k, phi->getType()), step);
+                Value *current = induction.decreasing ? builder.CreateSub(start, offset, phi->getName())
+                                                      : builder.CreateAdd(start, offset, phi->getName());
+                cloned[value] = current;
+                return current;
+            }
+
+            auto *original = cast<Instruction>(value);
+            Instruction *copy = original->clone();
+            copy->setDebugLoc(DebugLoc());
+            for (unsigned i = 0; i < copy->getNumOperands(); ++i)
+                copy->setOperand(i, materialize(original->getOperand(i), at, builder, cloned));
+            builder.Insert(copy, original->getName());
+            cloned[value] = copy;
+            return copy;
+        }
+
+        void reportIrreversible(Instruction &I) {
+            errs() << "Warning: " << name << ": cannot reverse" << I
+                   << "; its undo handler will not restore this\n";
+        }
+    };
+
+    // The undo handler of `F`: same signature, named after the demangled forward name
+    Function *declareReverseFunction(Function &F, Module &M) {
+        std::string undoFunctionName = "__undo_" + demangleFunctionName(F.getName().str());
+        if (Function *existing = M.getFunction(undoFunctionName))
+            return existing;
+
+        // Same linkage as the forward handler: an inline handler is defined in
+        // every module that uses it, and so is its undo handler
+        GlobalValue::LinkageTypes linkage = F.isDeclaration() ? GlobalValue::ExternalLinkage : F.getLinkage();
+        if (linkage == GlobalValue::AvailableExternallyLinkage)
+            linkage = GlobalValue::LinkOnceODRLinkage;
+        Function *reverseFunc = Function::Create(F.getFunctionType(), linkage, undoFunctionName, &M);
+        if (!reverseFunc->hasLocalLinkage())
+            reverseFunc->setVisibility(F.getVisibility());
+        for (unsigned i = 0; i < F.arg_size(); ++i)
+            reverseFunc->getArg(i)->setName(F.getArg(i)->getName());
+        return reverseFunc;
     }
 
-    // Add a return statement to the reverse function
-    builder.CreateRetVoid();
+    void generateReverseFunction(Function &F, Function &undo, ReverseContext &ctx) {
+        LLVM_DEBUG(dbgs() << "Processing annotated function: " << demangleFunctionName(F.getName().str()) << "\n");
+        ReverseFunctionBuilder(F, undo, ctx).build();
+    }
 
-    return reverseFunc;
-}
-/*
-    // Map arguments from the original function to the reverse function
-    ValueToValueMapTy VMap;
-    Function::arg_iterator DestI = reverseFunc->arg_begin();
-    for (const Argument &Arg : F.args()) {
-        DestI->setName(Arg.getName());  // Preserve argument names
-        VMap[&Arg] = &*DestI;           // Map original arguments to new function's arguments
-        DestI++;
+    // Direct callee of `call`, looking through the member function pointer check
+    // clang emits at -O0 for (self.*F)(...) with a constant F: a branch on the
+    // constant "is virtual" bit and a phi of the two candidate callees
+    Function *resolveCallee(CallBase &call, const DataLayout &DL) {
+        Value *callee = call.getCalledOperand();
+        if (auto *phi = dyn_cast<PHINode>(callee))
+            if (Value *only = phi->hasConstantValue())
+                callee = only;
+        if (auto *constant = dyn_cast<Constant>(callee))
+            callee = ConstantFoldConstant(constant, DL);
+        return dyn_cast<Function>(callee->stripPointerCasts());
     }
 
-    // Create the entry block for the new reverse function
-    BasicBlock *entryBlock = BasicBlock::Create(F.getContext(), "entry", reverseFunc);
-    IRBuilder<> builder(entryBlock);
-
-    // Iterate through the original function's instructions
-    for (auto &BB : F) {
-        for (auto &I : BB) {
-            errs() << "Processing instruction: " << I << "\n";
-            if (auto *binOp = dyn_cast<BinaryOperator>(&I)) {
-                // Handle only Add and Sub instructions
-                if (binOp->getOpcode() == Instruction::Add || binOp->getOpcode() == Instruction::Sub) {
-                    Value *lhs = binOp->getOperand(0);
-                    Value *rhs = binOp->getOperand(1);
-
-                    // Map operands to the reverse function's context
-                    if (VMap.count(lhs)) {
-                        lhs = VMap[lhs];
-                    } else if (isa<Constant>(lhs)) {
-                        // Use constants directly
-                    } else {
-                        errs() << "Unhandled lhs operand: " << *lhs << "\n";
-                        continue;
-                    }
+    // Handler thunks (CreateEvent in event.hpp) call a member function or lambda
+    // kept out of line by a call-site noinline. Make the call direct and drop the
+    // noinline, so the final compile inlines the handler; the thunk is reversible
+    // when all it does is call handlers that have undo handlers, and batched when
+    // those are all batched.
+    bool bindThunk(Function &F, const ReverseContext &ctx, bool &batch) {
+        removeUnreachableBlocks(F);
+        const DataLayout &DL = F.getParent()->getDataLayout();
 
-                    if (VMap.count(rhs)) {
-                        rhs = VMap[rhs];
-                    } else if (isa<Constant>(rhs)) {
-                        // Use constants directly
-                    } else {
-                        errs() << "Unhandled rhs operand: " << *rhs << "\n";
+        bool forwards = false;
+        bool reversible = true;
+        batch = true;
+        for (Instruction &I : instructions(F)) {
+            if (auto *call = dyn_cast<CallBase>(&I)) {
+                call->removeFnAttr(Attribute::NoInline);
+                if (Function *callee = resolveCallee(*call, DL)) {
+                    call->setCalledOperand(callee);
+                    if (ctx.undoHandlers.count(callee)) {
+                        forwards = true;
+                        batch &= ctx.batched.count(callee) != 0;
                         continue;
                     }
+                    if (ctx.ignored.count(callee))
+                        continue;
+                }
+                if (auto *intrinsic = dyn_cast<IntrinsicInst>(call))
+                    if (intrinsic->isAssumeLikeIntrinsic())
+                        continue;
+            }
+            if (auto *store = dyn_cast<StoreInst>(&I))
+                if (isLocal(store->getPointerOperand()))
+                    continue;
+            if (I.mayWriteToMemory())
+                reversible = false;
+        }
+        return forwards && reversible;
+    }
 
-                    // Now create new reverse instructions in the reverse function
-                    Value *reverseOp = nullptr;
-                    if (binOp->getOpcode() == Instruction::Add) {
-                        reverseOp = builder.CreateSub(lhs, rhs, "reverseSub");
-                        errs() << "Reversing Add to Sub: " << *reverseOp << "\n";
-                    } else if (binOp->getOpcode() == Instruction::Sub) {
-                        reverseOp = builder.CreateAdd(lhs, rhs, "reverseAdd");
-                        errs() << "Reversing Sub to Add: " << *reverseOp << "\n";
-                    }
+    // Emit the static forward->undo registry consumed by the runtime: this
+    // module's entries go into the fracture_undo section as
+    //   @__fracture_undo_entries = private constant [N x { ptr, ptr, ptr }]
+    // holding each forward handler, its undo handler and its demangled name,
+    // and the linker concatenates every module's entries between
+    // __start_fracture_undo and __stop_fracture_undo. Handlers defined in other
+    // modules are registered there. Every __fracture_undo_of(@F) call with a
+    // constant argument is folded into the address of @__undo_F, so
+    // CreateEvent<F> binds its undo handler with no runtime lookup.
+    void emitUndoRegistry(Module &M, const UndoMap &undoHandlers) {
+        LLVMContext &Ctx = M.getContext();
 
-                    // Optionally, map the new instruction if it will be used later
-                    VMap[&I] = reverseOp;
-                }
+        if (!M.getGlobalVariable("__fracture_undo_entries", /*AllowInternal=*/true)) {
+            PointerType *ptrTy = PointerType::getUnqual(Ctx);
+            StructType *entryTy = StructType::get(ptrTy, ptrTy, ptrTy);
+
+            std::vector<Constant *> entries;
+            for (const auto &[forward, undo] : undoHandlers) {
+                if (forward->isDeclaration())
+                    continue;
+                Constant *nameInit = ConstantDataArray::getString(Ctx, demangleFunctionName(forward->getName().str()));
+                auto *name = new GlobalVariable(M, nameInit->getType(), /*isConstant=*/true, GlobalValue::PrivateLinkage,
+                                                nameInit, "__fracture_undo_name");
+                name->setUnnamedAddr(GlobalValue::UnnamedAddr::Global);
+                entries.push_back(ConstantStruct::get(entryTy, {forward, undo, name}));
+            }
+
+            if (!entries.empty()) {
+                ArrayType *tableTy = ArrayType::get(entryTy, entries.size());
+                auto *table = new GlobalVariable(M, tableTy, /*isConstant=*/true, GlobalValue::PrivateLinkage,
+                                                 ConstantArray::get(tableTy, entries), "__fracture_undo_entries");
+                table->setSection("fracture_undo");
+                table->setAlignment(Align(alignof(void *)));
+                appendToCompilerUsed(M, {table});
             }
         }
-    }    
-/*
-    // Iterate through the original function's instructions
-    for (auto &BB : F) {
-        for (auto &I : BB) {
-            if (auto *binOp = dyn_cast<BinaryOperator>(&I)) {
-                // Handle only Add and Sub instructions
-                if (binOp->getOpcode() == Instruction::Add || binOp->getOpcode() == Instruction::Sub) {
-                    // Ensure both operands are recreated in the reverse function
-                    Value *lhs = binOp->getOperand(0);
-                    Value *rhs = binOp->getOperand(1);
-
-                    // Recreate the operands within the reverse function
-                    if (!isa<Constant>(lhs) && !VMap.count(lhs)) {
-                        errs() << "Recreating lhs in reverse function\n";
-                        lhs = builder.CreateAdd(builder.getInt32(0), builder.getInt32(0), "lhs");
-                    }
-                    if (!isa<Constant>(rhs) && !VMap.count(rhs)) {
-                        errs() << "Recreating rhs in reverse function\n";
-                        rhs = builder.CreateAdd(builder.getInt32(0), builder.getInt32(0), "rhs");
-                    }
 
-                    // Now create new reverse instructions in the reverse function
-                    if (binOp->getOpcode() == Instruction::Add) {
-                        // Reverse Add -> Sub
-                        Value *reverseOp = builder.CreateSub(lhs, rhs, "reverseSub");
-                        llvm::errs() << "Reversing Add to Sub: " << *reverseOp << "\n";
-                    } else if (binOp->getOpcode() == Instruction::Sub) {
-                        // Reverse Sub -> Add
-                        Value *reverseOp = builder.CreateAdd(lhs, rhs, "reverseAdd");
-                        llvm::errs() << "Reversing Sub to Add: " << *reverseOp << "\n";
-                    }
-                }
+        Function *marker = M.getFunction("__fracture_undo_of");
+        if (!marker)
+            return;
+
+        SmallVector<CallInst *, 16> resolved;
+        for (User *U : marker->users()) {
+            auto *call = dyn_cast<CallInst>(U);
+            if (!call || call->getCalledFunction() != marker || call->arg_size() != 1)
+                continue;
+
+            // Runtime function pointers are left to the table lookup in the runtime
+            auto *forward = dyn_cast<Function>(call->getArgOperand(0)->stripPointerCasts());
+            if (!forward)
+                continue;
+
+            auto it = undoHandlers.find(forward);
+            Constant *undo = it != undoHandlers.end()
+                ? static_cast<Constant *>(it->second)
+                : ConstantPointerNull::get(cast<PointerType>(call->getType()));
+            call->replaceAllUsesWith(undo);
+            resolved.push_back(call);
+        }
+
+        for (CallInst *call : resolved)
+            call->eraseFromParent();
+    }
+
+    // Batched variants of a handler F annotated "reverse,batch", which the
+    // engine calls once for a group of events with the same handler
+    // (src/fracture/event.hpp, BatchEntry):
+    //   void @__batch_F(i64 n, ptr marks, ptr column0, ptr column1, ...)
+    //   void @__batch_undo_F(i64 n, ptr marks, ptr column0, ptr column1, ...)
+    // Column k holds parameter k of every event, one element each (a pointer for
+    // a reference). The forward variant runs F on events 0..n-1 and the undo
+    // variant runs the undo handler on n-1..0, each with the handler inlined
+    // into the loop so it can be vectorized. When F records into the reverse
+    // log, the forward variant ends every event's records and stores the log
+    // position after event i in marks[i], so events can still be rolled back
+    // one at a time, and the undo variant rewinds the log to marks[i] before
+    // undoing event i. Only handlers with pointer, integer, float and double
+    // parameters are batched, so each parameter is exactly one column element.
+    bool batchable(Function &F) {
+        for (Argument &arg : F.args()) {
+            Type *type = arg.getType();
+            if (type->isPointerTy() ? arg.getPointeeInMemoryValueType() != nullptr
+                                    : !(type->isIntegerTy() && type->getIntegerBitWidth() <= 64) &&
+                                      !type->isFloatTy() && !type->isDoubleTy())
+                return false;
+        }
+        return !F.isVarArg();
+    }
+
+    // Whether F, as instrumented, records into the reverse log: it calls the log
+    // directly or another handler, which may
+    bool recordsLog(Function &F, ReverseContext &ctx) {
+        for (Instruction &I : instructions(F)) {
+            if (auto *call = dyn_cast<CallBase>(&I)) {
+                if (ctx.isRuntimeCall(*call))
+                    return true;
+                if (Function *callee = call->getCalledFunction())
+                    if (ctx.undoHandlers.count(callee))
+                        return true;
+            }
+        }
+        return false;
+    }
+
+    Function *emitBatchVariant(Module &M, Function &F, Function &handler, bool undo, bool logs, ReverseContext &ctx) {
+        LLVMContext &Ctx = M.getContext();
+        Type *i64 = Type::getInt64Ty(Ctx);
+        PointerType *ptrTy = PointerType::getUnqual(Ctx);
+
+        SmallVector<Type *, 8> params(F.arg_size() + 2, ptrTy);
+        params[0] = i64;
+        FunctionType *batchTy = FunctionType::get(Type::getVoidTy(Ctx), params, /*isVarArg=*/false);
+        Function *batch = Function::Create(batchTy, GlobalValue::InternalLinkage,
+                                           (undo ? "__batch_undo_" : "__batch_") + F.getName(), &M);
+        // Vectorized for the same target as the handler
+        for (StringRef attribute : {"target-cpu", "target-features", "tune-cpu"})
+            if (F.hasFnAttribute(attribute))
+                batch->addFnAttr(F.getFnAttribute(attribute));
+        Value *count = batch->getArg(0);
+        Value *marks = batch->getArg(1);
+
+        BasicBlock *entry = BasicBlock::Create(Ctx, "entry", batch);
+        BasicBlock *loop = BasicBlock::Create(Ctx, "loop", batch);
+        BasicBlock *exit = BasicBlock::Create(Ctx, "exit", batch);
+        IRBuilder<> builder(entry);
+        Value *first = undo ? builder.CreateSub(count, ConstantInt::get(i64, 1)) : ConstantInt::get(i64, 0);
+        builder.CreateCondBr(builder.CreateICmpEQ(count, ConstantInt::get(i64, 0)), exit, loop);
+
+        builder.SetInsertPoint(loop);
+        PHINode *index = builder.CreatePHI(i64, 2, "i");
+        index->addIncoming(first, entry);
+        if (undo && logs)
+            builder.CreateCall(ctx.eventRewind, {builder.CreateLoad(i64, builder.CreateGEP(i64, marks, index))});
+
+        // bool is an i1 parameter but a byte in memory
+        SmallVector<Value *, 8> args;
+        for (Argument &arg : F.args()) {
+            Type *type = arg.getType();
+            Type *element = type->isIntegerTy(1) ? builder.getInt8Ty() : type;
+            Value *value = builder.CreateLoad(element, builder.CreateGEP(element, batch->getArg(arg.getArgNo() + 2), index));
+            args.push_back(element == type ? value : builder.CreateTrunc(value, type));
+        }
+        CallInst *call = builder.CreateCall(handler.getFunctionType(), &handler, args);
+        call->setCallingConv(handler.getCallingConv());
+        call->setAttributes(handler.getAttributes());
+        if (!undo && logs)
+            builder.CreateStore(builder.CreateCall(ctx.eventEnd), builder.CreateGEP(i64, marks, index));
+
+        Value *next = undo ? builder.CreateSub(index, ConstantInt::get(i64, 1)) : builder.CreateAdd(index, ConstantInt::get(i64, 1));
+        index->addIncoming(next, loop);
+        builder.CreateCondBr(undo ? builder.CreateICmpEQ(index, ConstantInt::get(i64, 0)) : builder.CreateICmpEQ(next, count),
+                             exit, loop);
+        ReturnInst::Create(Ctx, exit);
+
+        if (!handler.isDeclaration() && !handler.hasFnAttribute(Attribute::OptimizeNone)) {
+            InlineFunctionInfo info;
+            InlineFunction(*call, info);
+        }
+        return batch;
+    }
+
+    // The batched variants go into the fracture_batch section as
+    //   @__fracture_batch_entries = private constant [N x { ptr, ptr, ptr, i64 }]
+    // holding each forward handler, its two batched variants and its number of
+    // parameters, delimited by __start_fracture_batch and __stop_fracture_batch
+    // like the undo registry
+    void emitBatchVariants(Module &M, ReverseContext &ctx, SmallVectorImpl<Function *> &variants) {
+        LLVMContext &Ctx = M.getContext();
+        PointerType *ptrTy = PointerType::getUnqual(Ctx);
+        Type *i64 = Type::getInt64Ty(Ctx);
+        StructType *entryTy = StructType::get(ptrTy, ptrTy, ptrTy, i64);
+
+        std::vector<Constant *> entries;
+        for (const auto &[forward, undo] : ctx.undoHandlers) {
+            if (!ctx.batched.count(forward) || forward->isDeclaration())
+                continue;
+            if (!batchable(*forward)) {
+                errs() << "Warning: " << demangleFunctionName(forward->getName().str())
+                       << " has a parameter that cannot be batched; it runs one event at a time\n";
+                continue;
             }
+
+            bool logs = recordsLog(*forward, ctx);
+            Function *batchForward = emitBatchVariant(M, *forward, *forward, /*undo=*/false, logs, ctx);
+            Function *batchUndo = emitBatchVariant(M, *forward, *undo, /*undo=*/true, logs, ctx);
+            variants.push_back(batchForward);
+            variants.push_back(batchUndo);
+            entries.push_back(ConstantStruct::get(entryTy, {forward, batchForward, batchUndo,
+                                                            ConstantInt::get(i64, forward->arg_size())}));
         }
+        if (entries.empty())
+            return;
+
+        ArrayType *tableTy = ArrayType::get(entryTy, entries.size());
+        auto *table = new GlobalVariable(M, tableTy, /*isConstant=*/true, GlobalValue::PrivateLinkage,
+                                         ConstantArray::get(tableTy, entries), "__fracture_batch_entries");
+        table->setSection("fracture_batch");
+        table->setAlignment(Align(alignof(void *)));
+        appendToCompilerUsed(M, {table});
     }
 
+    // A parameter as the verifier makes it up: "p<bytes>" a pointer to that many
+    // bytes (0 when the IR does not say), "i<bits>" an integer, "f" float, "d"
+    // double, "?" anything else
+    std::string describeParameter(Argument &arg, const DataLayout &DL) {
+        Type *type = arg.getType();
+        if (type->isPointerTy()) {
+            uint64_t bytes = arg.getDereferenceableBytes();
+            if (Type *pointee = arg.getPointeeInMemoryValueType())   // byval, sret, byref
+                bytes = std::max<uint64_t>(bytes, DL.getTypeAllocSize(pointee).getKnownMinValue());
+            return "p" + std::to_string(bytes);
+        }
+        if (type->isIntegerTy() && type->getIntegerBitWidth() <= 64)
+            return "i" + std::to_string(type->getIntegerBitWidth());
+        if (type->isFloatTy())
+            return "f";
+        if (type->isDoubleTy())
+            return "d";
+        return "?";
+    }
 
-    // Add a return statement to the reverse function
-    //builder.CreateRetVoid();
-*/
+    // void (ptr slots): calls `target` with each argument loaded from the storage slots[i] points to
+    Function *emitSlotThunk(Module &M, Function &target) {
+        LLVMContext &Ctx = M.getContext();
+        PointerType *ptrTy = PointerType::getUnqual(Ctx);
+        FunctionType *thunkTy = FunctionType::get(Type::getVoidTy(Ctx), {ptrTy}, /*isVarArg=*/false);
+        Function *thunk = Function::Create(thunkTy, GlobalValue::PrivateLinkage, "__fracture_verify_call", &M);
 
+        IRBuilder<> builder(BasicBlock::Create(Ctx, "entry", thunk));
+        SmallVector<Value *, 8> args;
+        for (Argument &arg : target.args()) {
+            Value *slot = builder.CreateLoad(ptrTy, builder.CreateConstGEP1_64(ptrTy, thunk->getArg(0), arg.getArgNo()));
+            args.push_back(builder.CreateLoad(arg.getType(), slot));
+        }
+        CallInst *call = builder.CreateCall(target.getFunctionType(), &target, args);
+        call->setCallingConv(target.getCallingConv());
+        call->setAttributes(target.getAttributes());
+        builder.CreateRetVoid();
+        return thunk;
+    }
 
+    // reverse-pass<verify>: the table the undo handler verifier reads
+    // (src/fracture/verify.hpp), in the fracture_verify section as
+    //   @__fracture_verify_entries = private constant [N x { ptr, ptr, ptr, ptr, ptr, ptr }]
+    // holding each forward handler, its undo handler, its name, a thunk calling
+    // each of them from an array of argument slots, and the parameters as a
+    // string of describeParameter tokens separated by spaces.
+    void emitVerifyTable(Module &M, const UndoMap &undoHandlers) {
+        if (M.getGlobalVariable("__fracture_verify_entries", /*AllowInternal=*/true))
+            return;
 
+        LLVMContext &Ctx = M.getContext();
+        const DataLayout &DL = M.getDataLayout();
+        PointerType *ptrTy = PointerType::getUnqual(Ctx);
+        StructType *entryTy = StructType::get(ptrTy, ptrTy, ptrTy, ptrTy, ptrTy, ptrTy);
 
-    // Function to find annotated functions
-    void findAnnotatedFunctions(Module &M) {
+        auto makeString = [&](StringRef text, const Twine &name) {
+            Constant *init = ConstantDataArray::getString(Ctx, text);
+            auto *string = new GlobalVariable(M, init->getType(), /*isConstant=*/true, GlobalValue::PrivateLinkage,
+                                              init, name);
+            string->setUnnamedAddr(GlobalValue::UnnamedAddr::Global);
+            return string;
+        };
+
+        std::vector<Constant *> entries;
+        for (const auto &[forward, undo] : undoHandlers) {
+            if (forward->isDeclaration())
+                continue;
+            std::string signature;
+            for (Argument &arg : forward->args())
+                signature += (arg.getArgNo() ? " " : "") + describeParameter(arg, DL);
+
+            entries.push_back(ConstantStruct::get(entryTy, {
+                forward, undo,
+                makeString(demangleFunctionName(forward->getName().str()), "__fracture_verify_name"),
+                emitSlotThunk(M, *forward), emitSlotThunk(M, *undo),
+                makeString(signature, "__fracture_verify_signature")}));
+        }
+        if (entries.empty())
+            return;
+
+        ArrayType *tableTy = ArrayType::get(entryTy, entries.size());
+        auto *table = new GlobalVariable(M, tableTy, /*isConstant=*/true, GlobalValue::PrivateLinkage,
+                                         ConstantArray::get(tableTy, entries), "__fracture_verify_entries");
+        table->setSection("fracture_verify");
+        table->setAlignment(Align(alignof(void *)));
+        appendToCompilerUsed(M, {table});
+    }
+
+    // Functions annotated "reverse" or "reverse,batch" (in annotation order, the
+    // latter also in `batched`), "reverse_ignore" and "reverse_bind" (the handler
+    // thunks of event.hpp)
+    void collectAnnotations(Module &M, SmallVectorImpl<Function *> &reversible, SmallPtrSetImpl<Function *> &ignored,
+                            SmallVectorImpl<Function *> &bound, SmallPtrSetImpl<Function *> &batched) {
         if (GlobalVariable *annotations = M.getGlobalVariable("llvm.global.annotations")) {
             if (ConstantArray *arr = dyn_cast<ConstantArray>(annotations->getOperand(0))) {
                 for (unsigned i = 0; i < arr->getNumOperands(); ++i) {
@@ -249,10 +1276,15 @@ Function *generateReverseFunction(Function &F, Module *M) {
                         if (Function *annotatedFunc = dyn_cast<Function>(annotation->getOperand(0)->stripPointerCasts())) {
                             if (ConstantDataArray *annoStr = dyn_cast<ConstantDataArray>(annotation->getOperand(1)->getOperand(0))) {
                                 StringRef annotationString = annoStr->getAsCString();
-                                if (annotationString == "reverse") {
-                                    errs() << "Found function with reverse annotation: " << annotatedFunc->getName() << "\n";
-                                    // Generate reverse function
-                                    generateReverseFunction(*annotatedFunc, &M);
+                                if (annotationString == "reverse" || annotationString == "reverse,batch") {
+                                    LLVM_DEBUG(dbgs() << "Found function with reverse annotation: " << annotatedFunc->getName() << "\n");
+                                    reversible.push_back(annotatedFunc);
+                                    if (annotationString == "reverse,batch")
+                                        batched.insert(annotatedFunc);
+                                } else if (annotationString == "reverse_ignore") {
+                                    ignored.insert(annotatedFunc);
+                                } else if (annotationString == "reverse_bind") {
+                                    bound.push_back(annotatedFunc);
                                 }
                             }
                         }
@@ -262,18 +1294,215 @@ Function *generateReverseFunction(Function &F, Module *M) {
         }
     }
 
+    // Per-translation-unit builds (add_reverse_test PER_TU) run the pass on each
+    // module alone, where a handler defined in another TU is only a declaration
+    // and carries no annotation. reverse-summary<file> first writes a summary of
+    // each TU's externally visible annotated functions, one "reverse <symbol>"
+    // or "ignore <symbol>" line each; reverse-pass<summary=file;...> reads all
+    // of them, so calls to handlers in other TUs are mirrored with the undo
+    // handler that TU defines.
+    std::string moduleSummary(Module &M) {
+        SmallVector<Function *, 8> reversible, bound;
+        SmallPtrSet<Function *, 8> ignored, batched;
+        collectAnnotations(M, reversible, ignored, bound, batched);
+
+        std::vector<std::string> lines;
+        for (Function *F : reversible)
+            if (!F->isDeclaration() && !F->hasLocalLinkage())
+                lines.push_back(("reverse " + F->getName()).str());
+        for (Function *F : ignored)
+            if (!F->isDeclaration() && !F->hasLocalLinkage())
+                lines.push_back(("ignore " + F->getName()).str());
+        llvm::sort(lines);
+        lines.erase(std::unique(lines.begin(), lines.end()), lines.end());
+
+        std::string summary;
+        for (const std::string &line : lines)
+            summary += line + "\n";
+        return summary;
+    }
+
+    void readSummaries(Module &M, ArrayRef<std::string> summaryFiles,
+                       SmallVectorImpl<Function *> &reversible, SmallPtrSetImpl<Function *> &ignored) {
+        for (const std::string &path : summaryFiles) {
+            ErrorOr<std::unique_ptr<MemoryBuffer>> buffer = MemoryBuffer::getFile(path);
+            if (!buffer) {
+                errs() << "Warning: cannot read reverse summary " << path << ": " << buffer.getError().message() << "\n";
+                continue;
+            }
+
+            SmallVector<StringRef, 64> lines;
+            (*buffer)->getBuffer().split(lines, '\n', -1, /*KeepEmpty=*/false);
+            for (StringRef line : lines) {
+                auto [kind, symbol] = line.split(' ');
+                Function *F = M.getFunction(symbol);
+                if (!F || !F->isDeclaration())
+                    continue;
+                if (kind == "reverse")
+                    reversible.push_back(F);
+                else if (kind == "ignore")
+                    ignored.insert(F);
+            }
+        }
+    }
+
+    // Collect the annotations once and generate every missing undo handler;
+    // returns the handlers generated, and the batched variants in `variants`
+    SmallVector<Function *, 8> generateUndoHandlers(Module &M, ArrayRef<std::string> summaryFiles, bool verify,
+                                                    SmallVectorImpl<Function *> &variants) {
+        ReverseContext ctx(M);
+        SmallVector<Function *, 8> reversible, bound;
+        collectAnnotations(M, reversible, ctx.ignored, bound, ctx.batched);
+        readSummaries(M, summaryFiles, reversible, ctx.ignored);
+
+        // Declare every undo handler before generating any, so calls between
+        // annotated handlers can be mirrored. A handler annotated more than once
+        // is listed once; an existing definition of its undo handler is kept.
+        SmallVector<Function *, 8> pending;
+        for (Function *F : reversible) {
+            if (F->getName().starts_with("__undo_") || ctx.undoHandlers.count(F))
+                continue;
+            if (F->isDeclaration() && summaryFiles.empty()) {
+                errs() << "Warning: no definition of " << demangleFunctionName(F->getName().str())
+                       << " in this module; it gets no undo handler\n";
+                continue;
+            }
+
+            // Handlers from other modules' summaries: the undo handler is defined there
+            Function *undo = declareReverseFunction(*F, M);
+            ctx.undoHandlers.insert({F, undo});
+            if (undo->isDeclaration() && !F->isDeclaration())
+                pending.push_back(F);
+            else
+                LLVM_DEBUG(dbgs() << "Skipping undo creation for existing function: " << undo->getName() << "\n");
+        }
+
+        // A thunk gets an undo handler once what it wraps is known to have one
+        for (Function *F : bound) {
+            bool batch = false;
+            if (F->isDeclaration() || ctx.undoHandlers.count(F) || !bindThunk(*F, ctx, batch))
+                continue;
+            if (batch)
+                ctx.batched.insert(F);
+            Function *undo = declareReverseFunction(*F, M);
+            ctx.undoHandlers.insert({F, undo});
+            if (undo->isDeclaration())
+                pending.push_back(F);
+        }
+
+        SmallVector<Function *, 8> generated;
+        for (Function *F : pending) {
+            Function *undo = ctx.undoHandlers.lookup(F);
+            generateReverseFunction(*F, *undo, ctx);
+            generated.push_back(undo);
+        }
+
+        // After the forward handlers are instrumented, so the variants inline what they record
+        emitBatchVariants(M, ctx, variants);
+        emitUndoRegistry(M, ctx.undoHandlers);
+        if (verify)
+            emitVerifyTable(M, ctx.undoHandlers);
+        return generated;
+    }
+
+    // Module pass: one scan of llvm.global.annotations per module, each undo
+    // handler generated once, then the generated handlers go through the same
+    // function simplification pipeline clang ran on the forward handlers
+    // (the undo IR is emitted unoptimized: reloads, dead path arithmetic,
+    // uncombined casts).
     struct ReversePass : public PassInfoMixin<ReversePass> {
-        PreservedAnalyses run(Function &F, FunctionAnalysisManager &AM) {
-            Module *M = F.getParent();
+        PassBuilder *PB;
+        OptimizationLevel level;
+        std::vector<std::string> summaryFiles;
+        bool verify;
+
+        ReversePass(PassBuilder &PB, OptimizationLevel level, std::vector<std::string> summaryFiles, bool verify)
+            : PB(&PB), level(level), summaryFiles(std::move(summaryFiles)), verify(verify) {}
 
-            // Find annotated functions and generate their reverse counterparts
-            findAnnotatedFunctions(*M);
+        PreservedAnalyses run(Module &M, ModuleAnalysisManager &MAM) {
+            // The registry is emitted and __fracture_undo_of calls folded even
+            // when every undo handler already exists
+            SmallVector<Function *, 8> variants;
+            SmallVector<Function *, 8> generated = generateUndoHandlers(M, summaryFiles, verify, variants);
+            if (generated.empty() && variants.empty())
+                return PreservedAnalyses::none();
 
+            if (level != OptimizationLevel::O0) {
+                FunctionAnalysisManager &FAM = MAM.getResult<FunctionAnalysisManagerModuleProxy>(M).getManager();
+                FunctionPassManager FPM = PB->buildFunctionSimplificationPipeline(level, ThinOrFullLTOPhase::None);
+                for (Function *undo : generated) {
+                    FAM.invalidate(*undo, PreservedAnalyses::none());
+                    FPM.run(*undo, FAM);
+                }
+
+                // Batched variants are loops over inlined handler bodies: simplified
+                // like the undo handlers, then vectorized where the bodies allow it
+                FunctionPassManager batchFPM = PB->buildFunctionSimplificationPipeline(level, ThinOrFullLTOPhase::None);
+                batchFPM.addPass(LoopVectorizePass(LoopVectorizeOptions()));
+                batchFPM.addPass(SLPVectorizerPass());
+                batchFPM.addPass(InstCombinePass());
+                batchFPM.addPass(SimplifyCFGPass());
+                for (Function *variant : variants) {
+                    FAM.invalidate(*variant, PreservedAnalyses::none());
+                    batchFPM.run(*variant, FAM);
+                }
+            }
+            return PreservedAnalyses::none();
+        }
+
+        static bool isRequired() { return true; }
+    };
+
+    // reverse-summary<file>: writes the module's summary, leaving the file
+    // untouched when it is unchanged so modules that read it are not rebuilt
+    struct ReverseSummaryPass : public PassInfoMixin<ReverseSummaryPass> {
+        std::string output;
+
+        explicit ReverseSummaryPass(std::string output) : output(std::move(output)) {}
+
+        PreservedAnalyses run(Module &M, ModuleAnalysisManager &) {
+            std::string summary = moduleSummary(M);
+            ErrorOr<std::unique_ptr<MemoryBuffer>> existing = MemoryBuffer::getFile(output);
+            if (existing && (*existing)->getBuffer() == summary)
+                return PreservedAnalyses::all();
+
+            std::error_code error;
+            raw_fd_ostream out(output, error);
+            if (error)
+                report_fatal_error(Twine("cannot write ") + output + ": " + error.message());
+            out << summary;
             return PreservedAnalyses::all();
         }
 
         static bool isRequired() { return true; }
     };
+
+    // reverse-pass<params>: ';'-separated O0|O1|O2|O3 (the pipeline run on the
+    // generated undo handlers, O2 by default), summary=<file> entries and
+    // verify (emit the verifier table)
+    bool parseParams(StringRef params, OptimizationLevel &level, std::vector<std::string> &summaryFiles, bool &verify) {
+        level = OptimizationLevel::O2;
+        verify = false;
+        while (!params.empty()) {
+            StringRef param;
+            std::tie(param, params) = params.split(';');
+            if (param == "O0")
+                level = OptimizationLevel::O0;
+            else if (param == "O1")
+                level = OptimizationLevel::O1;
+            else if (param == "O2")
+                level = OptimizationLevel::O2;
+            else if (param == "O3")
+                level = OptimizationLevel::O3;
+            else if (param.consume_front("summary="))
+                summaryFiles.push_back(param.str());
+            else if (param == "verify")
+                verify = true;
+            else
+                return false;
+        }
+        return true;
+    }
 }
 
 // The pass plugin entry point for dynamically loaded plugins.
@@ -282,12 +1511,28 @@ extern "C" ::llvm::PassPluginLibraryInfo llvmGetPassPluginInfo() {
         LLVM_PLUGIN_API_VERSION, "ReversePass", LLVM_VERSION_STRING,
         [](PassBuilder &PB) {
             PB.registerPipelineParsingCallback(
-                [](StringRef Name, FunctionPassManager &FPM, ArrayRef<PassBuilder::PipelineElement>) {
-                    if (Name == "reverse-pass") {
-                        FPM.addPass(ReversePass());
+                [&PB](StringRef Name, ModulePassManager &MPM, ArrayRef<PassBuilder::PipelineElement>) {
+                    if (Name.consume_front("reverse-summary<") && Name.consume_back(">")) {
+                        MPM.addPass(ReverseSummaryPass(Name.str()));
                         return true;
                     }
-                    return false;
+
+                    StringRef params;
+                    if (Name == "reverse-pass") {
+                        params = "";
+                    } else if (Name.consume_front("reverse-pass<") && Name.consume_back(">")) {
+                        params = Name;
+                    } else {
+                        return false;
+                    }
+
+                    OptimizationLevel level;
+                    std::vector<std::string> summaryFiles;
+                    bool verify;
+                    if (!parseParams(params, level, summaryFiles, verify))
+                        return false;
+                    MPM.addPass(ReversePass(PB, level, std::move(summaryFiles), verify));
+                    return true;
                 });
         }};
 }
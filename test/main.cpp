@@ -1,17 +1,16 @@
 #include <iostream>
-#include <dlfcn.h>
 #include <string>
 #include <type_traits>
-#include <cxxabi.h>
 #include "test_funcs.hpp"
 #include "event.hpp"
+#include "simulator.hpp"
 
 
 int main() {
     int a = 1;
 
     // Create an event
-    Event e = CreateEvent(20.0, freeFunctionBinaryAddByOne, a);
+    Event e = CreateEvent<freeFunctionBinaryAddByOne>(20.0, a);
 
     // Call the function
     std::cout << "Before function call: " << a << std::endl;
@@ -23,5 +22,29 @@ int main() {
     e.callUndo();
     std::cout << "After undo function call: " << a << std::endl;
 
+    // Run the same handler through the simulator and roll part of it back
+    Simulator<CalendarQueue> sim;
+    for (double ts : {1.0, 2.0, 3.0})
+        sim.scheduleEvent<freeFunctionBinaryAddByOne>(ts, a);
+
+    sim.run(10.0);
+    std::cout << "After simulator run: " << a << std::endl;
+    sim.rollback(1.0);
+    std::cout << "After rollback to time 1: " << a << std::endl;
+
+    // Member function and stateless lambda handlers, bound at compile time
+    static constexpr auto takeTwo = [](Counter& counter) __attribute__((annotate("reverse"))) {
+        counter.value = counter.value - 2;
+    };
+    Counter counter;
+    Event member = CreateEvent<&Counter::add>(30.0, counter, 5);
+    Event lambda = CreateEvent<takeTwo>(31.0, counter);
+    member.call();
+    lambda.call();
+    std::cout << "After member and lambda calls: " << counter.value << std::endl;
+    lambda.callUndo();
+    member.callUndo();
+    std::cout << "After their undo calls: " << counter.value << std::endl;
+
     return 0;
 }
\ No newline at end of file
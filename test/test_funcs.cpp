@@ -1,4 +1,5 @@
 #include "test_funcs.hpp"
+#include <cstring>
 #include <iostream>
 
 
@@ -6,3 +7,143 @@ void freeFunctionBinaryAddByOne(int& data) {
     data = data + 1;
 }
 
+void Counter::add(int amount) {
+    value = value + amount;
+}
+
+// The handlers test/verify_test.cpp checks are compiled as written, so the IR
+// the reverse-pass sees, and the log words it saves, follow the source
+#pragma clang optimize off
+
+void rampCells(Cells& cells) {
+    for (int i = 0; i < kCells; ++i)
+        cells.values[i] += i;
+}
+
+void fillRows(Cells& cells) {
+    for (int row = 0; row < kRows; ++row)
+        for (unsigned column = 0; column < cells.lengths[row] % kColumns; ++column)
+            cells.values[row * kColumns + column] += 1;
+}
+
+void scanCells(Cells& cells) {
+    for (int i = 0; i < kCells; ++i) {
+        if (cells.values[i] % 4 == 0)
+            break;
+        cells.values[i] += 3;
+    }
+}
+
+void mixCell(Cells& cells, unsigned amount) {
+    switch (cells.selector % 4) {
+    case 0:
+        cells.values[0] += amount;
+        break;
+    case 1:
+        cells.values[1] ^= amount;
+        break;
+    case 2:
+        cells.values[2] = amount - cells.values[2];
+        break;
+    default:
+        cells.values[3] -= amount;
+        break;
+    }
+}
+
+void xorWord(Scalars& scalars, unsigned key) {
+    scalars.word ^= key;
+}
+
+void flipWord(Scalars& scalars) {
+    scalars.word = ~scalars.word;
+}
+
+void scaleWord(Scalars& scalars) {
+    scalars.word *= 0x9e3779b1u;
+}
+
+void scaleSmall(Scalars& scalars) {
+    scalars.small *= 3;
+}
+
+void scaleHalf(Scalars& scalars) {
+    scalars.half *= 5;
+}
+
+void negateReal(Scalars& scalars) {
+    scalars.real = -scalars.real;
+}
+
+void setWord(Record& record, unsigned value) {
+    record.word = value;
+}
+
+void scaleWordEven(Record& record) {
+    record.word *= 6;
+}
+
+void divideWord(Record& record) {
+    record.word /= 3;
+}
+
+void addReals(Record& record) {
+    record.real += 0.5;
+    record.single *= 3.0f;
+}
+
+void clearValues(Record& record) {
+    std::memset(record.values, 0, sizeof(record.values));
+}
+
+void copyBlock(Block& to, const Block& from) {
+    std::memcpy(to.bytes, from.bytes, 256);
+}
+
+void setWide(Record& record, std::uint64_t value) {
+    record.wide = static_cast<unsigned __int128>(value) << 64 | value;
+}
+
+void copySample(Record& record) {
+    record.last = record.next;
+}
+
+void storeAt(Record& record, unsigned index, unsigned value) {
+    record.values[index % kCells] = value;
+}
+
+void storeAtCursor(Record& record, unsigned value) {
+    record.values[record.cursor % kCells] = value;
+    record.cursor += 1;
+}
+
+// Only the optimizer adds nuw and nsw to a shift, from what it knows of the operand
+#pragma clang optimize on
+
+namespace {
+    // Out of line and reverse_ignore: the optimizer has to reload the state
+    // after it, and the reverse-pass leaves it out of undo handlers
+    __attribute__((noinline, annotate("reverse_ignore"))) void settle(const void* state) {
+        asm volatile("" : : "r"(state) : "memory");
+    }
+}
+
+void shiftWord(Scalars& scalars) {
+    scalars.word &= 0xffffu;
+    settle(&scalars);
+    __builtin_assume((scalars.word & ~0xffffu) == 0);
+    scalars.word <<= 8;
+}
+
+void shiftSignedWord(Scalars& scalars) {
+    scalars.signedWord |= ~0xffff;
+    settle(&scalars);
+    __builtin_assume((scalars.signedWord & ~0xffff) == ~0xffff);
+    scalars.signedWord <<= 8;
+}
+
+void shiftWordUnflagged(Scalars& scalars) {
+    scalars.word &= 0xffffu;
+    settle(&scalars);
+    scalars.word <<= 8;
+}
@@ -1,5 +1,100 @@
 #pragma once
 
+#include <cstdint>
 
 __attribute__((annotate("reverse")))  void freeFunctionBinaryAddByOne(int& data);
 
+// A model written as an LP class: handlers are members, bound with
+// CreateEvent<&Counter::add>(ts, counter, amount)
+struct Counter {
+    int value = 0;
+
+    __attribute__((annotate("reverse"))) void add(int amount);
+};
+
+// State of the control flow handlers below, which test/verify_test.cpp runs
+// through the undo handler verifier
+constexpr int kRows = 4;
+constexpr int kColumns = 4;
+constexpr int kCells = kRows * kColumns;
+
+struct Cells {
+    unsigned values[kCells];
+    unsigned lengths[kRows];   // row r of fillRows covers lengths[r] % kColumns cells
+    unsigned selector;         // mixCell's case
+};
+
+// Counted loop: values[i] += i for every cell
+__attribute__((annotate("reverse"))) void rampCells(Cells& cells);
+
+// Nested loops, the inner one with a trip count read from the state
+__attribute__((annotate("reverse"))) void fillRows(Cells& cells);
+
+// Loop left early at the first cell that is a multiple of 4
+__attribute__((annotate("reverse"))) void scanCells(Cells& cells);
+
+// Switch whose four cases merge again
+__attribute__((annotate("reverse"))) void mixCell(Cells& cells, unsigned amount);
+
+// State of the inversion handlers below: each updates one field in a way the
+// undo handler recomputes instead of saving what it overwrote
+struct Scalars {
+    unsigned word;
+    int signedWord;
+    std::int8_t small;
+    std::uint16_t half;
+    double real;
+};
+
+__attribute__((annotate("reverse"))) void xorWord(Scalars& scalars, unsigned key);
+__attribute__((annotate("reverse"))) void flipWord(Scalars& scalars);
+__attribute__((annotate("reverse"))) void scaleWord(Scalars& scalars);    // by an odd constant
+__attribute__((annotate("reverse"))) void scaleSmall(Scalars& scalars);   // i8, multiplied as an int
+__attribute__((annotate("reverse"))) void scaleHalf(Scalars& scalars);    // i16, multiplied as an int
+__attribute__((annotate("reverse"))) void negateReal(Scalars& scalars);
+
+// Shifts whose operand the optimizer knows to lose no bits (shl nuw, shl nsw),
+// after a masking store that has to be saved; shiftWordUnflagged is shiftWord
+// without that knowledge, so its shift is saved as well
+__attribute__((annotate("reverse"))) void shiftWord(Scalars& scalars);
+__attribute__((annotate("reverse"))) void shiftSignedWord(Scalars& scalars);
+__attribute__((annotate("reverse"))) void shiftWordUnflagged(Scalars& scalars);
+
+// State of the state-saving handlers below: each overwrites memory in a way
+// that has no exact inverse, so the forward handler saves what it overwrites
+constexpr int kBlockBytes = 264;   // more than the 256 bytes the reverse-pass saves per memset or memcpy
+
+struct Block {
+    unsigned char bytes[kBlockBytes];
+};
+
+struct Sample {
+    double x;
+    double y;
+    std::uint64_t tag;
+};
+
+struct Record {
+    unsigned word;
+    float single;
+    double real;
+    unsigned __int128 wide;
+    Sample last;
+    Sample next;
+    unsigned values[kCells];
+    unsigned cursor;
+};
+
+__attribute__((annotate("reverse"))) void setWord(Record& record, unsigned value);
+__attribute__((annotate("reverse"))) void scaleWordEven(Record& record);
+__attribute__((annotate("reverse"))) void divideWord(Record& record);
+__attribute__((annotate("reverse"))) void addReals(Record& record);
+__attribute__((annotate("reverse"))) void clearValues(Record& record);                   // memset
+__attribute__((annotate("reverse"))) void copyBlock(Block& to, const Block& from);       // memcpy of 256 bytes
+__attribute__((annotate("reverse"))) void setWide(Record& record, std::uint64_t value);  // 16-byte store
+__attribute__((annotate("reverse"))) void copySample(Record& record);                    // aggregate copy
+__attribute__((annotate("reverse"))) void storeAt(Record& record, unsigned index, unsigned value);
+
+// Stores at an index read from the state and then advances it, so the undo
+// handler cannot rebuild the address and pops it from the log
+__attribute__((annotate("reverse"))) void storeAtCursor(Record& record, unsigned value);
@@ -0,0 +1,80 @@
+#include <cstdio>
+#include "time_warp.hpp"
+
+// Time Warp kernel checks: each execution mode runs a model to completion with
+// a default TimeWarpConfig, whose endTime is infinite and which takes no
+// checkpoints, and ends in the same state.
+
+constexpr LpId kRingLps = 8;
+constexpr int kTokens = 4;
+constexpr double kLastHop = 50.0;
+
+struct RingLp {
+    unsigned hops = 0;
+};
+
+RingLp ringLps[kRingLps];
+
+// Passes the token on to the next LP, one time unit later, until kLastHop
+__attribute__((annotate("reverse"))) void ringHop(RingLp& lp) {
+    lp.hops = lp.hops + 1;
+    if (TimeWarp::now() < kLastHop) {
+        LpId next = (TimeWarp::self() + 1) % kRingLps;
+        TimeWarp::send<ringHop>(next, TimeWarp::now() + 1.0, ringLps[next]);
+    }
+}
+
+int failures = 0;
+
+void check(bool condition, const char* what) {
+    if (!condition) {
+        std::printf("FAILED: %s\n", what);
+        ++failures;
+    }
+}
+
+void runRing(const TimeWarpConfig& config, const char* mode) {
+    for (RingLp& lp : ringLps)
+        lp = RingLp{};
+    TimeWarp kernel(kRingLps, config);
+    for (int token = 0; token < kTokens; ++token) {
+        LpId lp = static_cast<LpId>(token * kRingLps / kTokens);
+        kernel.scheduleInitial<ringHop>(lp, 1.0, ringLps[lp]);
+    }
+    kernel.run();
+
+    unsigned hops = 0;
+    for (const RingLp& lp : ringLps)
+        hops += lp.hops;
+    const TimeWarpStats& stats = kernel.stats();
+    bool ok = hops == kTokens * kLastHop && stats.committed() == hops && stats.checkpoints == 0 &&
+              stats.pastEvents == 0 && stats.lookaheadViolations == 0;
+    if (!ok)
+        std::printf("%s: %u hops, %llu committed\n", mode, hops, static_cast<unsigned long long>(stats.committed()));
+    check(ok, "a default config runs every event and stops");
+}
+
+int main() {
+    TimeWarpConfig config;
+    config.mode = ExecutionMode::Sequential;
+    runRing(config, "sequential");
+
+    config = TimeWarpConfig{};
+    config.mode = ExecutionMode::Conservative;
+    config.threads = 2;
+    runRing(config, "conservative");
+
+    config = TimeWarpConfig{};
+    config.threads = 2;
+    runRing(config, "optimistic");
+
+    // An interval without a path takes no checkpoints
+    config = TimeWarpConfig{};
+    config.mode = ExecutionMode::Sequential;
+    config.checkpointInterval = 10.0;
+    runRing(config, "sequential, interval without path");
+
+    if (failures == 0)
+        std::printf("time warp tests passed\n");
+    return failures == 0 ? 0 : 1;
+}
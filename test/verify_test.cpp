@@ -0,0 +1,99 @@
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include "test_funcs.hpp"
+#include "verify.hpp"
+
+// Undo handler checks: the handlers of test_funcs.hpp go through the undo
+// handler verifier on random state. Each must restore its state byte for byte
+// and save exactly the reverse log words its shape calls for, on every trial:
+// a counted loop pushes its trip count on each edge that leaves it, and a block
+// with several predecessors records the one it was entered from in path bits,
+// which the forward handler flushes as one word at its end. A store with an
+// exact inverse is recomputed and saves nothing; any other store saves the bytes
+// it overwrites in 8-byte words, preceded by its address when the undo handler
+// cannot rebuild it.
+
+struct Expectation {
+    const char* handler;   // demangled name without the parameter list
+    double logWords;       // saved by every forward call
+    bool restores = true;  // false: the reverse-pass warned that it cannot undo it
+};
+
+// More than the reverse-pass saves per memcpy: the build warns that it cannot
+// reverse the copy (ctest: verify_unreversible), and the undo handler leaves it in place
+__attribute__((annotate("reverse"))) void copyWholeBlock(Block& to, const Block& from) {
+    std::memcpy(to.bytes, from.bytes, sizeof(to.bytes));
+}
+
+constexpr Expectation kExpected[] = {
+    {"freeFunctionBinaryAddByOne", 0},
+    {"Counter::add", 0},
+    {"rampCells", 1},            // the trip count
+    {"fillRows", 5},             // the inner trip count of each row, then the outer one
+    {"scanCells", 2},            // the trip count on either exit, then the path word of their merge
+    {"mixCell", 1},              // the path word of the four cases' merge
+    {"xorWord", 0},
+    {"flipWord", 0},
+    {"scaleWord", 0},
+    {"scaleSmall", 0},
+    {"scaleHalf", 0},
+    {"negateReal", 0},
+    {"shiftWord", 1},            // the masked word; the shl nuw is recomputed
+    {"shiftSignedWord", 1},      // the masked word; the shl nsw is recomputed
+    {"shiftWordUnflagged", 2},   // the masked word and the shifted one
+    {"setWord", 1},
+    {"scaleWordEven", 1},
+    {"divideWord", 1},
+    {"addReals", 2},             // a double and a float
+    {"clearValues", 8},          // 64 bytes
+    {"copyBlock", 32},           // 256 bytes, the most a memcpy saves
+    {"setWide", 2},
+    {"copySample", 3},           // a 24-byte memcpy
+    {"storeAt", 1},              // the address is rebuilt from the index argument
+    {"storeAtCursor", 2},        // the address and the value; the cursor increment is recomputed
+    {"copyWholeBlock", 0, false},
+};
+
+int failures = 0;
+
+void check(bool condition, const char* handler, const char* what) {
+    if (!condition) {
+        std::printf("FAILED: %s: %s\n", handler, what);
+        ++failures;
+    }
+}
+
+const VerifyResult* findResult(const std::vector<VerifyResult>& results, const char* handler) {
+    std::size_t length = std::strlen(handler);
+    for (const VerifyResult& result : results)
+        if (std::strncmp(result.name, handler, length) == 0 && result.name[length] == '(')
+            return &result;
+    return nullptr;
+}
+
+int main() {
+    VerifyConfig config;
+    config.trials = 200;
+    std::vector<VerifyResult> results = verifyUndoHandlers(config);
+    verifyDump(results, stdout);
+
+    for (const Expectation& expected : kExpected) {
+        const VerifyResult* result = findResult(results, expected.handler);
+        check(result != nullptr, expected.handler, "not in the verifier table");
+        if (!result)
+            continue;
+        if (expected.restores)
+            check(result->passed(), expected.handler, "the undo handler does not restore the state");
+        else
+            check(result->signal == 0 && result->mismatches == result->trials, expected.handler,
+                  "the copy should survive its undo handler");
+        if (result->logWords != expected.logWords)
+            std::printf("%s: %.2f log words, expected %.0f\n", expected.handler, result->logWords, expected.logWords);
+        check(result->logWords == expected.logWords, expected.handler, "unexpected reverse log words");
+    }
+
+    if (failures == 0)
+        std::printf("verify tests passed\n");
+    return failures == 0 ? 0 : 1;
+}